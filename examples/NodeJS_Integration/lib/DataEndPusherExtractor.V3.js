@@ -4,12 +4,25 @@ const PACKET_SIGNETURE_LEN = 9;
 const packet_maker = Buffer.from('<-*->');
 const packet_info = Buffer.from([packet_maker[0], 0x0F, packet_maker[1], 0x0F, packet_maker[2], 0x0F, packet_maker[3], 0x0F, packet_maker[4]]); //packet length signeture
 
+//compact header: sync0 sync1 varint_length(1-3 bytes, low 7 bits first) check
+const { crc16Ccitt } = require('./crc-verification.js');
+const PACKET_COMPACT_SYNC0 = 0xA5;
+const PACKET_COMPACT_SYNC1 = 0x96;
+const PACKET_COMPACT_MIN_LEN = 4;
+
+function compactCheck(header) {
+    //CRC-16 of sync + varint folded to 8 bits
+    let crc = crc16Ccitt(header);
+    return (crc ^ (crc >> 8)) & 0xFF;
+}
+
 module.exports = class DataEndPusherExtractor {
     delimiter;
     packet_length = 0;
     packet_timeout_at = null;
     store_buff;
     only_buffer_mode = false; //true: accept Buffer only, false: accept string also
+    compact = false; //true: compact headers are recognised as well
 
     constructor(delimiter = '\r\n') {
         this.delimiter = delimiter;
@@ -25,6 +38,42 @@ module.exports = class DataEndPusherExtractor {
         this.only_buffer_mode = state;
     }
 
+    setCompactFraming(state) {
+        this.compact = state;
+    }
+
+    compactHeaderAt(transfer_buff, offset) {
+        //[header_len, packet_size] of a compact header at offset, null if there is none, undefined if it is not complete yet
+        if (transfer_buff.length - offset < PACKET_COMPACT_MIN_LEN) return undefined;
+        if (transfer_buff[offset] != PACKET_COMPACT_SYNC0 || transfer_buff[offset + 1] != PACKET_COMPACT_SYNC1) return null;
+
+        let packet_size = 0;
+        let i = 0;
+        while (true) {
+            if (i == 3) return null;
+            if (offset + 2 + i + 1 >= transfer_buff.length) return undefined;
+            let part = transfer_buff[offset + 2 + i];
+            packet_size |= (part & 0x7F) << (7 * i);
+            i++;
+            if ((part & 0x80) == 0) break;
+        }
+
+        if (packet_size == 0 || packet_size > 0xFFFF) return null;
+        if (transfer_buff[offset + 2 + i] != compactCheck(transfer_buff.subarray(offset, offset + 2 + i))) return null;
+        return [3 + i, packet_size];
+    }
+
+    compactPacketLength(packet_size) {
+        let header = [PACKET_COMPACT_SYNC0, PACKET_COMPACT_SYNC1];
+        do {
+            let part = packet_size & 0x7F;
+            packet_size >>= 7;
+            header.push(packet_size ? (part | 0x80) : part);
+        } while (packet_size);
+        header.push(compactCheck(Buffer.from(header)));
+        return Buffer.from(header);
+    }
+
     getPacketLength(transfer_buff) {
         if (transfer_buff[0] != packet_info[0] || transfer_buff[PACKET_SIGNETURE_LEN - 1] != packet_info[PACKET_SIGNETURE_LEN - 1]) return 0;
 
@@ -67,6 +116,16 @@ module.exports = class DataEndPusherExtractor {
         let search_offset = 0;
         while (transfer_buffer.length > search_offset) {
             let sfind = transfer_buffer.indexOf(packet_info[0], search_offset);
+
+            let cfind = this.compact ? transfer_buffer.indexOf(PACKET_COMPACT_SYNC0, search_offset) : -1;
+            if (cfind != -1 && (sfind == -1 || cfind < sfind)) {
+                let header = this.compactHeaderAt(transfer_buffer, cfind);
+                if (header === undefined) return null; //wait for the rest of the header
+                if (header !== null) return [cfind + header[0], header[1]];
+                search_offset = cfind + 1;
+                continue;
+            }
+
             if (sfind == -1 || (sfind + PACKET_SIGNETURE_LEN) > transfer_buffer.length) return null;
             search_offset = sfind + PACKET_SIGNETURE_LEN;
 
@@ -106,7 +165,7 @@ module.exports = class DataEndPusherExtractor {
                 else break receiver_loop; ///there has no enough data, and need to wait for next data update
             }
             else {
-                if ((this.store_buff.length - offset) >= PACKET_SIGNETURE_LEN) {
+                if ((this.store_buff.length - offset) >= (this.compact ? PACKET_COMPACT_MIN_LEN : PACKET_SIGNETURE_LEN)) {
                     let search_result = this.searchPacketMatch(this.store_buff.subarray(offset, this.store_buff.length));
                     if (search_result !== null) {
                         let [packet_end, packet_size] = search_result;
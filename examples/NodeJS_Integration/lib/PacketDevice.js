@@ -7,6 +7,29 @@ const TRANSFER_DATA_BUFFER_SIG = 0x2A;
 const BUFFER_TEXT_RESPNOSE = 0x5E;
 const BUFFER_PARAM_RESPNOSE = 0x5F;
 const BUFFER_ARRY_RESPNOSE = 0x60;
+const BUFFER_BATCH_RESPNOSE = 0x61;
+const BUFFER_DELTA_ARRY_RESPNOSE = 0x62;
+const BUFFER_CHANNEL_RESPNOSE = 0x63;
+const BUFFER_SEQUENCE_RESPNOSE = 0x64;
+
+//buff_signeture(1 byte)+data_signeture(1 byte)+record_count(2 bytes), then text/params/array records without CRC
+const TRANSFER_DATA_BATCH_HEADER_LEN = 4;
+
+//buff_signeture(1 byte)+data_signeture(1 byte)+type(1 byte)+type_size(1 byte)+pram_len(1 byte)+data_size(2 bytes)+flags(1 byte)+sequence(1 byte)+payload_len(2 bytes)
+const TRANSFER_DATA_DELTA_HEADER_LEN = 11;
+const DELTA_FLAG_KEYFRAME = 0x01;
+
+//buff_signeture(1 byte)+data_signeture(1 byte)+channel(1 byte), in front of the record of a channel other than 0
+const TRANSFER_DATA_CHANNEL_HEADER_LEN = 3;
+
+//buff_signeture(1 byte)+data_signeture(1 byte)+sequence(2 bytes), after the channel prefix of a request or reply record
+const TRANSFER_DATA_SEQUENCE_HEADER_LEN = 4;
+
+//frame header formats, PACKET_FRAMING_COMPACT is also the capability bit of the handshake
+const PACKET_FRAMING_NIBBLE = 0x00;
+const PACKET_FRAMING_COMPACT = 0x01;
+const FRAMING_REQUEST_CMD = '#FR';
+const FRAMING_ACCEPT_CMD = '#FA';
 
 const BUFFER_JSON_RESPONSE_START = 0x7B;
 const BUFFER_JSON_RESPONSE_END = 0x7D;
@@ -338,6 +361,15 @@ module.exports = class PacketDevice {
     delimiter = '';
     onDataCb = [];
     dataReceiverHolder = [];
+    channelCb = new Map(); //channel id -> callbacks of the frames of that channel (channel 0 is onData)
+    pending_requests = new Map(); //sequence id -> request() waiting for its reply
+    next_sequence = 0;
+    delta_states = new Map(); //last array of every delta coded property
+    framing_caps = PACKET_FRAMING_NIBBLE; //what this side can receive
+    tx_framing = PACKET_FRAMING_NIBBLE; //what packets are sent with, compact once the device accepted it
+
+    static FRAMING_NIBBLE = PACKET_FRAMING_NIBBLE;
+    static FRAMING_COMPACT = PACKET_FRAMING_COMPACT;
 
     static Type = Object.fromEntries(Object.entries(Struct.type).map(([name, type]) => {
         return [name, {
@@ -346,9 +378,34 @@ module.exports = class PacketDevice {
         }];
     }));
 
-    constructor(delimiter = '\r\n') {
+    constructor(delimiter = '\r\n', framing = PACKET_FRAMING_NIBBLE) {
         this.delimiter = delimiter;
         this.dataParser = new DataEndPusherExtractor(delimiter);
+        this.framing_caps = framing;
+        this.dataParser.setCompactFraming((framing & PACKET_FRAMING_COMPACT) != 0);
+    }
+
+    negotiateFraming() {
+        //tell the device what we can receive, it answers with what it can; old firmware ignores it
+        if (this.framing_caps != PACKET_FRAMING_NIBBLE) this.println(`${FRAMING_REQUEST_CMD}=${this.framing_caps}`);
+    }
+
+    getFraming() {
+        return this.tx_framing;
+    }
+
+    framingCommand(data) {
+        //"#FR=<caps>" / "#FA=<caps>" handshake packets are consumed here, true if data was one
+        if (this.framing_caps == PACKET_FRAMING_NIBBLE || data.length < 5) return false;
+        let command = data.subarray(0, 4).toString();
+        let request = command == `${FRAMING_REQUEST_CMD}=`;
+        if (!request && command != `${FRAMING_ACCEPT_CMD}=`) return false;
+
+        let peer_caps = (data[4] >= 0x30 && data[4] <= 0x39) ? data[4] - 0x30 : 0;
+        if (peer_caps & this.framing_caps & PACKET_FRAMING_COMPACT) this.tx_framing = PACKET_FRAMING_COMPACT;
+
+        if (request) this.println(`${FRAMING_ACCEPT_CMD}=${this.framing_caps}`);
+        return true;
     }
 
     open(serial_dev) {
@@ -372,8 +429,8 @@ module.exports = class PacketDevice {
         else throw new Error('Device is not opened!');
     }
 
-    writePacket(param, data) {
-        let packet = this.dataPacket(param, data, false);
+    writePacket(param, data, channel = 0, sequence = null) {
+        let packet = this.dataPacket(param, data, false, channel, sequence);
         if (packet === null) throw new Error('Invalid data!');
         return this.write(packet);
     }
@@ -423,6 +480,174 @@ module.exports = class PacketDevice {
         return status;
     }
 
+    static batchRecordLength(buff, offset) {
+        //length of one text/params/array record inside a batch frame, 0 if it is malformed
+        let left = buff.length - offset;
+        if (left < TRANSFER_DATA_TEXT_HEADER_LEN || buff[offset] != TRANSFER_DATA_BUFFER_SIG) return 0;
+
+        let record_len = 0;
+        if (buff[offset + 1] == BUFFER_TEXT_RESPNOSE) {
+            record_len = TRANSFER_DATA_TEXT_HEADER_LEN + (((buff[offset + 2] << 8) | buff[offset + 3]) & 0xFFFF);
+        }
+        else if (buff[offset + 1] == BUFFER_PARAM_RESPNOSE && left >= TRANSFER_DATA_PARAMS_HEADER_LEN) {
+            record_len = TRANSFER_DATA_PARAMS_HEADER_LEN + buff[offset + 3] + (((buff[offset + 4] << 8) | buff[offset + 5]) & 0xFFFF);
+        }
+        else if (buff[offset + 1] == BUFFER_ARRY_RESPNOSE && left >= TRANSFER_DATA_ARRAY_HEADER_LEN) {
+            record_len = TRANSFER_DATA_ARRAY_HEADER_LEN + buff[offset + 4] + buff[offset + 3] * (((buff[offset + 5] << 8) | buff[offset + 6]) & 0xFFFF);
+        }
+        else if (buff[offset + 1] == BUFFER_DELTA_ARRY_RESPNOSE && left >= TRANSFER_DATA_DELTA_HEADER_LEN) {
+            record_len = TRANSFER_DATA_DELTA_HEADER_LEN + buff[offset + 4] + (((buff[offset + 9] << 8) | buff[offset + 10]) & 0xFFFF);
+        }
+
+        return record_len <= left ? record_len : 0;
+    }
+
+    static batchSplit(buff) {
+        //a batch frame (CRC already removed) carries many records, every record is handed out as its own packet
+        if (buff.length < TRANSFER_DATA_BATCH_HEADER_LEN || buff[0] != TRANSFER_DATA_BUFFER_SIG || buff[1] != BUFFER_BATCH_RESPNOSE) return [buff];
+
+        let record_count = ((buff[2] << 8) | buff[3]) & 0xFFFF;
+        let records = [];
+        let offset = TRANSFER_DATA_BATCH_HEADER_LEN;
+        for (let i = 0; i < record_count && offset < buff.length; i++) {
+            let record_len = PacketDevice.batchRecordLength(buff, offset);
+            if (record_len == 0) break; //malformed, the following records cannot be located
+            records.push(buff.subarray(offset, offset + record_len));
+            offset += record_len;
+        }
+        return records;
+    }
+
+    static channelSplit(buff) {
+        //strips the channel and sequence prefixes, the records of a frame with the channel they belong to
+        //and the sequence id of the request they answer (null without one)
+        let channel = 0;
+        let sequence = null;
+        if (buff.length > TRANSFER_DATA_CHANNEL_HEADER_LEN && buff[0] == TRANSFER_DATA_BUFFER_SIG && buff[1] == BUFFER_CHANNEL_RESPNOSE) {
+            channel = buff[2];
+            buff = buff.subarray(TRANSFER_DATA_CHANNEL_HEADER_LEN);
+        }
+        if (buff.length > TRANSFER_DATA_SEQUENCE_HEADER_LEN && buff[0] == TRANSFER_DATA_BUFFER_SIG && buff[1] == BUFFER_SEQUENCE_RESPNOSE) {
+            sequence = (buff[2] << 8) | buff[3];
+            buff = buff.subarray(TRANSFER_DATA_SEQUENCE_HEADER_LEN);
+        }
+        return PacketDevice.batchSplit(buff).map(data => ({ channel, sequence, data }));
+    }
+
+    static deltaCodec(data_type, type_size) {
+        //same choice as deltaCodec() in Packet_Delta.h
+        if (![1, 2, 4, 8].includes(type_size)) return 0;
+        if (data_type == DATA_TYPE_FLOAT || data_type == DATA_TYPE_DOUBLE) return type_size >= 4 ? 1 : 0;
+        if (data_type == DATA_TYPE_VOID || data_type == DATA_TYPE_STRING || data_type == DATA_TYPE_NULL) return 0;
+        return 2;
+    }
+
+    static deltaDecode(codec, type_size, values, count, payload) {
+        //applies an encoded frame on the previous values (little-endian, like the device), false when it is malformed
+        const width = BigInt(type_size * 8);
+        const mask = (1n << width) - 1n;
+        const load = (i) => {
+            let v = 0n;
+            for (let b = type_size - 1; b >= 0; b--) v = (v << 8n) | BigInt(values[i * type_size + b]);
+            return v;
+        };
+        const store = (i, v) => {
+            for (let b = 0; b < type_size; b++, v >>= 8n) values[i * type_size + b] = Number(v & 0xFFn);
+        };
+
+        if (codec == 2) {
+            let pos = 0;
+            for (let i = 0; i < count; i++) {
+                let zigzag = 0n;
+                for (let shift = 0n; ; shift += 7n) {
+                    if (pos >= payload.length || shift > 63n) return false;
+                    let part = payload[pos++];
+                    zigzag |= BigInt(part & 0x7F) << shift;
+                    if ((part & 0x80) == 0) break;
+                }
+                let delta = (zigzag & 1n) ? ~(zigzag >> 1n) : (zigzag >> 1n);
+                store(i, (load(i) + delta) & mask);
+            }
+            return pos == payload.length;
+        }
+
+        //XOR: '0' same, '10'+bits previous window, '11'+lead(5)+len-1(6)+bits new window, MSB first
+        let bit_pos = 0;
+        let underflow = false;
+        const get = (n) => {
+            let v = 0n;
+            for (; n > 0; n--, bit_pos++) {
+                if ((bit_pos >> 3) >= payload.length) {
+                    underflow = true;
+                    return 0n;
+                }
+                v = (v << 1n) | BigInt((payload[bit_pos >> 3] >> (7 - (bit_pos & 7))) & 1);
+            }
+            return v;
+        };
+        let window_lead = -1, window_trail = 0;
+        for (let i = 0; i < count; i++) {
+            let x = 0n;
+            if (get(1)) {
+                if (get(1) == 0n) {
+                    if (window_lead < 0) return false;
+                    x = get(Number(width) - window_lead - window_trail) << BigInt(window_trail);
+                }
+                else {
+                    let lead = Number(get(5));
+                    let significant = Number(get(6)) + 1;
+                    if (lead + significant > Number(width)) return false;
+                    window_lead = lead;
+                    window_trail = Number(width) - lead - significant;
+                    x = get(significant) << BigInt(window_trail);
+                }
+            }
+            if (underflow) return false;
+            store(i, load(i) ^ x);
+        }
+        return true;
+    }
+
+    deltaExpand(buff, channel = 0) {
+        //a delta coded array record is rebuilt into the plain array record it stands for, null until a keyframe arrives
+        if (buff.length < TRANSFER_DATA_DELTA_HEADER_LEN || buff[0] != TRANSFER_DATA_BUFFER_SIG || buff[1] != BUFFER_DELTA_ARRY_RESPNOSE) return buff;
+
+        let [data_type, type_size, pram_len] = [buff[2], buff[3], buff[4]];
+        let count = ((buff[5] << 8) | buff[6]) & 0xFFFF;
+        let [flags, sequence] = [buff[7], buff[8]];
+        let payload_len = ((buff[9] << 8) | buff[10]) & 0xFFFF;
+        if (buff.length < TRANSFER_DATA_DELTA_HEADER_LEN + pram_len + payload_len) return null;
+
+        let name = buff.subarray(TRANSFER_DATA_DELTA_HEADER_LEN, TRANSFER_DATA_DELTA_HEADER_LEN + pram_len);
+        let payload = buff.subarray(TRANSFER_DATA_DELTA_HEADER_LEN + pram_len, TRANSFER_DATA_DELTA_HEADER_LEN + pram_len + payload_len);
+        let data_len = type_size * count;
+
+        let key = channel ? channel + ':' + name.toString('latin1') : name.toString('latin1'); //every channel has its own properties
+        let state = this.delta_states.get(key);
+        if (!state || state.data_type != data_type || state.type_size != type_size || state.count != count) {
+            state = { data_type, type_size, count, values: Buffer.alloc(data_len), sequence: 0, synced: false };
+            this.delta_states.set(key, state);
+        }
+
+        if (flags & DELTA_FLAG_KEYFRAME) {
+            if (payload_len != data_len) return null;
+            payload.copy(state.values);
+            state.synced = true;
+        }
+        else {
+            //a lost or reordered frame leaves the state behind, wait for the next keyframe
+            if (!state.synced || state.sequence != sequence) {
+                state.synced = false;
+                return null;
+            }
+            state.synced = PacketDevice.deltaDecode(PacketDevice.deltaCodec(data_type, type_size), type_size, state.values, count, payload);
+            if (!state.synced) return null;
+        }
+        state.sequence = (sequence + 1) & 0xFF;
+
+        return Buffer.concat([Buffer.from([TRANSFER_DATA_BUFFER_SIG, BUFFER_ARRY_RESPNOSE, data_type, type_size, pram_len, buff[5], buff[6]]), name, state.values]);
+    }
+
     static jsonParse(buff) {
         return JSON.parse(buff.toString());
     }
@@ -467,9 +692,17 @@ module.exports = class PacketDevice {
         return null;
     }
 
-    dataPacket(param, data, ending = false) {
+    dataPacket(param, data, ending = false, channel = 0, sequence = null) {
         let buff = PacketDevice.bufferGenerate(param, data);
         if (buff === null) return null;
+        if (sequence !== null && !ending && buff[0] == TRANSFER_DATA_BUFFER_SIG) {
+            //request, the device echoes the id in its reply (device.reply())
+            buff = Buffer.concat([Buffer.from([TRANSFER_DATA_BUFFER_SIG, BUFFER_SEQUENCE_RESPNOSE, sequence >> 8 & 0xFF, sequence & 0xFF]), buff]);
+        }
+        if (channel && !ending && buff[0] == TRANSFER_DATA_BUFFER_SIG) {
+            //record for the handlers of another channel (device.channel(id).onReceive)
+            buff = Buffer.concat([Buffer.from([TRANSFER_DATA_BUFFER_SIG, BUFFER_CHANNEL_RESPNOSE, channel]), buff]);
+        }
         let crc = PacketDevice.getDataCrc(buff);
 
         if (ending) {
@@ -486,7 +719,7 @@ module.exports = class PacketDevice {
         else {
             //transfer with buffer
             return Buffer.concat([
-                this.dataParser.updatePacketLength(buff.length + 2),
+                this.tx_framing == PACKET_FRAMING_COMPACT ? this.dataParser.compactPacketLength(buff.length + 2) : this.dataParser.updatePacketLength(buff.length + 2),
                 buff,
                 Buffer.from([
                     crc >> 8 & 0xFF,
@@ -513,7 +746,7 @@ module.exports = class PacketDevice {
         return buff_packets.map(buff => {
             //console.log('Checking packet length:', buff.length);
             return PacketDevice.checkCrcValidity(buff);
-        }).filter(t => t);
+        }).filter(t => t).flatMap(data => PacketDevice.channelSplit(data));
     }
 
     dataReceiveHandel(err, data) {
@@ -545,9 +778,14 @@ module.exports = class PacketDevice {
 
             if (data_packets.length == 0) return this.dataReceiveHandel(new Error('CRC validity error detected.'));
 
-            for (let data of data_packets) {
+            for (let { channel, sequence, data } of data_packets) {
                 //console.log('Processing packet length:', data.length);
-                this.dataReceiveHandel(null, data);
+                if (channel == 0 && this.framingCommand(data)) continue;
+                data = this.deltaExpand(data, channel);
+                if (data === null) continue;
+                if (sequence !== null && this.replyReceived(sequence, data)) continue;
+                if (channel == 0) this.dataReceiveHandel(null, data);
+                else for (let cb of this.channelCb.get(channel) || []) cb(null, data);
             }
         }
         catch (err) {
@@ -569,6 +807,57 @@ module.exports = class PacketDevice {
         }
     }
 
+    onChannel(channel, callback) {
+        //frames the device sent through channel(id), they never reach onData or the waiters
+        if (typeof callback != 'function') return;
+        if (!this.channelCb.has(channel)) this.channelCb.set(channel, []);
+        this.channelCb.get(channel).push(callback);
+    }
+
+    removeOnChannel(channel, callback = null) {
+        if (callback === null) return this.channelCb.delete(channel);
+        let callbacks = this.channelCb.get(channel) || [];
+        let f = callbacks.indexOf(callback);
+        if (f != -1) callbacks.splice(f, 1); //delete
+    }
+
+    request(param, data = null, timeout = 1500, channel = 0) {
+        //sends param/data with a new sequence id and resolves with the parsed reply carrying the same
+        //id; any number of requests can be in flight, replies are matched in whatever order they come
+        let sequence = this.next_sequence;
+        this.next_sequence = (this.next_sequence + 1) & 0xFFFF;
+        return new Promise((accept, reject) => {
+            let timeout_handeler = setTimeout(() => {
+                this.pending_requests.delete(sequence);
+                reject(new Error(`No reply to request ${sequence} within ${timeout}ms.`));
+            }, timeout);
+            this.pending_requests.set(sequence, { accept, reject, timeout_handeler });
+            try {
+                this.writePacket(param, data, channel, sequence);
+            }
+            catch (err) {
+                clearTimeout(timeout_handeler);
+                this.pending_requests.delete(sequence);
+                reject(err);
+            }
+        });
+    }
+
+    replyReceived(sequence, data) {
+        //true when the record answered a pending request(), it then never reaches onData or the waiters
+        let pending = this.pending_requests.get(sequence);
+        if (!pending) return false;
+        this.pending_requests.delete(sequence);
+        clearTimeout(pending.timeout_handeler);
+        try {
+            pending.accept(PacketDevice.dataParse(data));
+        }
+        catch (err) {
+            pending.reject(new Error("Data parsing error because: " + data));
+        }
+        return true;
+    }
+
     waitToReceiveData(timeout = 1500, block_flow = true) {
         return new Promise((accept, reject) => {
             let cb = (err, data) => {
@@ -0,0 +1,1795 @@
+/*
+ *  Packet_Device host micro-benchmark
+ *  ----------------------------------
+ *  Measures the hot paths of DevicePacket<R, N> on the host build:
+ *    - crc       : every CRC engine over a flat buffer (checked against the table loop)
+ *    - transmit  : restRawOut of a payload into a sink Stream (CRC + framing + write)
+ *    - telemetry : restOut of a single float, the small-message transmit case, into memory
+ *                  and into /dev/null (one write syscall per Stream::write, like a tty)
+ *    - async     : the same restOut with enableAsyncTx(), time spent by the producer only
+ *                  (the wire bytes are checked against synchronous transmit first, JSON arrays
+ *                  longer than the ring included)
+ *    - delta     : restArrayOut of 256 slowly changing floats, plain and with setDeltaMode(),
+ *                  wire bytes per frame; a receiver rebuilds every frame and compares it
+ *    - json      : restOut / restArrayOut of 256 floats in JSON text mode (setBufferMode(false))
+ *    - publish   : 8 properties produced much faster than a paced link can carry them, queued
+ *                  restOut through the async TX ring vs conflating publish(), age of the
+ *                  values when they reach a receiver on the other end
+ *    - channels  : control values every ms while a bulk producer keeps the async TX ring full,
+ *                  both on channel 0 vs bulk on a channel of its own (addChannel), age of the
+ *                  control values at the receiver; delimited text commands that start like a
+ *                  prefix ("*c...") still reach their text handlers
+ *    - receive   : command turnaround (write to dispatch) and CPU time of the receiving side,
+ *                  polling every 20 ms vs enableEventReceive() vs PacketReactor over a pipe
+ *    - backpressure: feedBytes() against a dispatch thread that falls behind, for every
+ *                  setRxBackpressure() policy: longest call, frames dropped (never corrupted)
+ *    - stats     : counters after good, corrupted and unknown frames, read back through the
+ *                  "stats" property, and the cost of one poll
+ *    - trace     : parse + dispatch with and without enableTrace(), and the traced wait /
+ *                  handler / total time of commands read by a task polling every 20 ms
+ *    - pipeline  : requests over a link with 1 ms delay each way, stop-and-wait vs a window of
+ *                  sequenced requests in flight, replies matched by id (some out of order)
+ *    - arq       : 64 byte blocks over a 500 KB/s link with 1 ms delay and 0% / 1% of the frames
+ *                  corrupted, without and with enableReliable(): goodput, in order exactly once;
+ *                  full batch frames still fit with the prefix, a frame too long for it is streamed
+ *                  unprotected and counted in tx_unreliable
+ *    - bind      : 64 byte setpoints dispatched into a handler that copies them out under a
+ *                  mutex vs bind() into a PacketBound, while another thread keeps reading
+ *                  them; dispatch time, and no read may see a torn value; a record of the
+ *                  bound type that is shorter than it must not be stored
+ *    - batch     : the same restOut packed by beginBatch() into N sized frames, then parsed
+ *                  and dispatched by a receiver (every record has to arrive)
+ *    - parse     : feedBytes / readSerialCommand of pre-encoded frames until queued
+ *    - dispatch  : processingQueueCommands of the queued frames (lookup + handler)
+ *    - text      : "XXX:P=VAL" text commands, parse + dispatch
+ *    - stream    : frames bigger than N received through onStream() in N sized chunks
+ *                  (reassembled payload and commit/abort are checked)
+ *    - threaded  : receive thread and processing thread running concurrently, with fixed
+ *                  slots and with the receive arena (enableRxArena)
+ *    - rx queue  : small frames queued before backpressure, slots vs an arena of the same RAM
+ *    - framing   : parse + dispatch and wire bytes of small frames, 9 byte signeture vs the
+ *                  negotiated compact header
+ *
+ *  Usage: packet_bench [min_ms_per_case]
+ */
+
+#include "../../src/Packet_Device.h"
+#include "../../src/Packet_Device.cpp"
+#include "MemoryStream.h"
+#include "FdStream.h"
+#include "PacketReactor.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fcntl.h>
+#include <mutex>
+#include <random>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+#define BENCH_QUEUE_LEN 5
+
+static double min_case_seconds = 0.2;
+static volatile uint32_t handled_packets = 0;
+
+template <size_t S>
+struct Blob
+{
+  uint8_t data[S];
+};
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double secondsSince(bench_clock::time_point start)
+{
+  return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static void report(const char *name, uint16_t n, size_t payload, double seconds, uint64_t packets, uint64_t bytes)
+{
+  double ns_per_packet = packets ? (seconds * 1e9) / (double)packets : 0.0;
+  double mb_per_sec = seconds > 0 ? ((double)bytes / seconds) / 1e6 : 0.0;
+  printf("%-20s %6u %8zu %12.1f %12.2f\n", name, (unsigned)n, payload, ns_per_packet, mb_per_sec);
+}
+
+typedef uint16_t (*crc_engine_t)(const uint8_t *, size_t, uint16_t);
+
+static void benchCRC(const char *name, crc_engine_t engine, size_t size)
+{
+  std::vector<uint8_t> buff(size);
+  for (size_t i = 0; i < size; i++)
+    buff[i] = (uint8_t)(i * 31 + 7);
+
+  // every engine has to agree with the reference table loop, for every length and seed
+  for (size_t len = 0; len <= size; len += (len < 64 ? 1 : 61))
+  {
+    if (engine(buff.data(), len, 0x1D0F) != crc16CCITTTable(buff.data(), len, 0x1D0F))
+      printf("!! %s: mismatch at length %zu\n", name, len);
+  }
+
+  uint64_t rounds = 0;
+  uint16_t sink = 0;
+  bench_clock::time_point start = bench_clock::now();
+  double elapsed = 0;
+  do
+  {
+    for (int i = 0; i < 64; i++)
+      sink ^= engine(buff.data(), size, sink);
+    rounds += 64;
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds);
+
+  if (sink == 0x1234)
+    printf(" ");
+  report(name, 0, size, elapsed, rounds, rounds * size);
+}
+
+static void benchCRCEngines()
+{
+  // CRC-16 with poly 0x1021 and a zero register: "123456789" -> 0x31C3
+  if (DevicePacket<char, MAX_COMMAND_DEFAULT_LEN>::getCRC<char>((char *)"123456789", 9) != 0x31C3)
+    printf("!! getCRC: check value mismatch\n");
+
+  const size_t crc_sizes[] = {16, 64, 256, 1024, 4096};
+  for (size_t size : crc_sizes)
+  {
+    benchCRC("crc (table)", crc16CCITTTable, size);
+    benchCRC("crc (slice4)", crc16CCITTSlice4, size);
+    benchCRC("crc (slice8)", crc16CCITTSlice8, size);
+#if PACKET_CRC_HAS_CLMUL
+    benchCRC("crc (clmul)", crc16CCITTClmul, size);
+#endif
+  }
+}
+
+template <uint16_t N, size_t S>
+static void benchTransmit()
+{
+  MemoryStream sink(false);
+  DevicePacket<char, N> device(&sink, BENCH_QUEUE_LEN, {'\r', '\n'});
+  Blob<S> blob;
+  memset(blob.data, 0xA5, S);
+
+  // wire size of one frame
+  sink.setCapture(true);
+  device.template restRawOut<Blob<S>>("blob", &blob);
+  size_t frame_size = sink.tx().size();
+  sink.setCapture(false);
+  if (frame_size <= PACKET_TX_STAGING_LEN && sink.writeCalls() != 1)
+    printf("!! transmit N=%u S=%zu: %zu writes for one frame\n", (unsigned)N, S, sink.writeCalls());
+
+  uint64_t packets = 0;
+  bench_clock::time_point start = bench_clock::now();
+  double elapsed = 0;
+  do
+  {
+    for (int i = 0; i < 64; i++)
+      device.template restRawOut<Blob<S>>("blob", &blob);
+    packets += 64;
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds);
+
+  report("transmit", N, S, elapsed, packets, packets * frame_size);
+}
+
+// Stream over a file descriptor, every write() is a syscall
+
+static void benchTelemetry(bool syscall)
+{
+  MemoryStream sink(false);
+  sink.setCapture(true);
+  {
+    DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> probe(&sink, BENCH_QUEUE_LEN, {'\r', '\n'});
+    probe.restOut("amp", 1.5f);
+  }
+  size_t frame_size = sink.tx().size();
+  if (sink.writeCalls() != 1)
+    printf("!! telemetry: %zu writes for one frame\n", sink.writeCalls());
+  sink.setCapture(false);
+
+  int null_fd = syscall ? open("/dev/null", O_WRONLY) : -1;
+  FdStream null_port(null_fd);
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(syscall ? (Stream *)&null_port : (Stream *)&sink, BENCH_QUEUE_LEN, {'\r', '\n'});
+
+  uint64_t packets = 0;
+  float value = 0;
+  bench_clock::time_point start = bench_clock::now();
+  double elapsed = 0;
+  do
+  {
+    for (int i = 0; i < 64; i++)
+      device.restOut("amp", value += 0.25f);
+    packets += 64;
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds);
+
+  if (null_fd >= 0)
+    close(null_fd);
+
+  report(syscall ? "telemetry (fd)" : "telemetry", MAX_COMMAND_DEFAULT_LEN, sizeof(float), elapsed, packets, packets * frame_size);
+}
+
+// the same traffic, synchronous and through the async TX ring, has to give the same bytes
+static void checkAsyncTx(uint32_t ring_size, bool writer_task)
+{
+  MemoryStream sync_port, async_port;
+  DevicePacket<char, 2048> sync_device(&sync_port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  DevicePacket<char, 2048> async_device(&async_port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  if (!async_device.enableAsyncTx(ring_size, 8, TX_QUEUE_BLOCK, writer_task))
+  {
+    printf("!! async: enableAsyncTx(%u) failed\n", (unsigned)ring_size);
+    return;
+  }
+
+  Blob<100> small;
+  Blob<400> large; // bigger than PACKET_TX_CHUNK_LEN, leaves the ring in pieces
+  memset(small.data, 0x11, sizeof(small.data));
+  memset(large.data, 0x22, sizeof(large.data));
+  static float samples[12000]; // as JSON longer than any ring (and than 0xFFFF bytes): written in order from the caller
+  for (int i = 0; i < 12000; i++)
+    samples[i] = i * 0.25f;
+  for (int mode = 0; mode < 2; mode++)
+  {
+    sync_device.setBufferMode(mode == 0);
+    async_device.setBufferMode(mode == 0);
+    for (int i = 0; i < 200; i++)
+    {
+      DevicePacket<char, 2048> *devices[2] = {&sync_device, &async_device};
+      for (DevicePacket<char, 2048> *device : devices)
+      {
+        device->restOut("amp", (float)i);
+        device->template restRawOut<Blob<100>>("small", &small);
+        if (i % 7 == 0)
+          device->template restRawOut<Blob<400>>("large", &large);
+        if (mode == 1 && i % 50 == 0)
+          device->restArrayOut("samples", samples, i == 0 ? 12000 : 1000);
+      }
+    }
+  }
+  async_device.flushTx();
+
+  if (async_port.tx() != sync_port.tx())
+    printf("!! async: ring %u %s: %zu bytes, expected %zu\n", (unsigned)ring_size, writer_task ? "task" : "inline", async_port.tx().size(), sync_port.tx().size());
+  if (async_device.txDropped() != 0)
+    printf("!! async: %u frames dropped with TX_QUEUE_BLOCK\n", (unsigned)async_device.txDropped());
+}
+
+// restOut("amp", float): signeture + params header + "amp" + float + crc
+#define TRANSFER_TELEMETRY_FRAME_LEN (PACKET_SIGNETURE_LEN + TRANSFER_DATA_PARAMS_HEADER_LEN + 3 + sizeof(float) + CRC_BYTE_LEN)
+
+static void benchAsyncTelemetry()
+{
+  checkAsyncTx(300, true);
+  checkAsyncTx(300, false);
+  checkAsyncTx(4096, true);
+
+  int null_fd = open("/dev/null", O_WRONLY);
+  FdStream null_port(null_fd);
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&null_port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.enableAsyncTx(64 * 1024, 2048, TX_QUEUE_DROP_OLDEST);
+
+  uint64_t packets = 0;
+  float value = 0;
+  double elapsed = 0;
+  do
+  {
+    bench_clock::time_point start = bench_clock::now();
+    for (int i = 0; i < 64; i++)
+      device.restOut("amp", value += 0.25f);
+    elapsed += secondsSince(start);
+    packets += 64;
+    if ((packets & 1023) == 0)
+      std::this_thread::yield(); // let the writer run on a single core box
+  } while (elapsed < min_case_seconds);
+  device.flushTx();
+  device.disableAsyncTx();
+  close(null_fd);
+
+  report("telemetry (async)", MAX_COMMAND_DEFAULT_LEN, sizeof(float), elapsed, packets, packets * TRANSFER_TELEMETRY_FRAME_LEN);
+}
+
+// a link of limited speed: a write() returns once its bytes have left at LINK_NS_PER_BYTE,
+// the frames are parsed and dispatched by a receiver on the other end right away
+#define LINK_NS_PER_BYTE 4000
+#define PUBLISH_PROPERTIES 8
+
+class PacedLink : public Stream
+{
+private:
+  bench_clock::time_point free_at = bench_clock::now();
+
+public:
+  using Print::write;
+
+  MemoryStream rx_port;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> receiver{&rx_port, BENCH_QUEUE_LEN, {'\r', '\n'}};
+  size_t wire = 0;
+
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+  size_t write(uint8_t byte) override { return write(&byte, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    bench_clock::time_point now = bench_clock::now();
+    free_at = (free_at > now ? free_at : now) + std::chrono::nanoseconds((uint64_t)size * LINK_NS_PER_BYTE);
+    while (bench_clock::now() < free_at)
+      ;
+    wire += size;
+    rx_port.feed(buffer, size);
+    do
+    {
+      receiver.readSerialCommand();
+      receiver.processingQueueCommands();
+    } while (rx_port.available() > 0); // a write can carry more frames than the receive queue holds
+    return size;
+  }
+};
+
+static uint64_t publish_age_sum, publish_age_max, publish_received;
+
+static void benchPublish(bool conflate)
+{
+  PacedLink link;
+  String names[PUBLISH_PROPERTIES];
+  publish_age_sum = publish_age_max = publish_received = 0;
+  for (int i = 0; i < PUBLISH_PROPERTIES; i++)
+  {
+    names[i] = "p" + String(i);
+    // the value is the micros() it was produced at
+    link.receiver.template onReceive<double>(names[i], std::function<void(double *)>([](double *produced_at)
+                                                                                      {
+      uint64_t age = micros() - (uint64_t)*produced_at;
+      publish_age_sum += age;
+      publish_age_max = age > publish_age_max ? age : publish_age_max;
+      publish_received++; }));
+  }
+
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&link, BENCH_QUEUE_LEN, {'\r', '\n'});
+  if (conflate)
+    device.enablePublish(5);
+  else
+    device.enableAsyncTx(16 * 1024, 1024, TX_QUEUE_BLOCK);
+
+  uint64_t produced = 0;
+  double elapsed = 0;
+  bench_clock::time_point start = bench_clock::now();
+  do
+  {
+    for (int i = 0; i < PUBLISH_PROPERTIES; i++)
+    {
+      if (conflate)
+        device.publish(names[i], (double)micros());
+      else
+        device.restOut(names[i], (double)micros());
+    }
+    produced += PUBLISH_PROPERTIES;
+    std::this_thread::sleep_for(std::chrono::microseconds(50)); // producers far faster than the link
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds * 2);
+
+  if (conflate)
+    device.disablePublish();
+  else
+    device.flushTx();
+
+  if (publish_received == 0)
+  {
+    printf("!! publish: nothing received\n");
+    return;
+  }
+  printf("%-20s %6u %8zu %12.1f %12s   %llu of %llu values sent, max age %.1f ms\n", conflate ? "publish (conflated)" : "publish (queued)", (unsigned)MAX_COMMAND_DEFAULT_LEN, sizeof(double),
+         (double)publish_age_sum / publish_received / 1000.0, "ms age", (unsigned long long)publish_received, (unsigned long long)produced, publish_age_max / 1000.0);
+}
+
+static uint32_t prefix_text_received;
+
+// prefixes are only read from length framed frames: a delimited text command that starts with
+// the same bytes is text, it must not be taken for a prefix (and counted as a CRC error)
+static void checkTextPrefixes()
+{
+  MemoryStream port;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.addChannel(1);
+  device.enableReliable(8);
+  prefix_text_received = 0;
+  const char *commands[] = {"*c1abcdef", "*d12abcdef", "*e123abcdef", "*f123abcdef"};
+  const uint8_t count = sizeof(commands) / sizeof(commands[0]);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    device.onReceive(commands[i], []() { prefix_text_received++; });
+    String line = String(commands[i]) + "\r\n";
+    device.feedBytes((char *)line.c_str(), line.length());
+    device.processingQueueCommands();
+  }
+  PacketStats_t stats = device.getStats();
+  if (prefix_text_received != count || stats.rx_crc_errors != 0 || stats.rx_unhandled != 0)
+    printf("!! text prefixes: %u of %u text commands handled, %u CRC errors, %u unhandled\n", prefix_text_received, count,
+           stats.rx_crc_errors, stats.rx_unhandled);
+}
+
+static uint64_t control_age_sum, control_age_max, control_received, bulk_received;
+
+static void benchChannels(bool channels)
+{
+  PacedLink link;
+  control_age_sum = control_age_max = control_received = bulk_received = 0;
+  link.receiver.template onReceive<double>("ctl", [](double *produced_at)
+                                           {
+    uint64_t age = micros() - (uint64_t)*produced_at;
+    control_age_sum += age;
+    control_age_max = age > control_age_max ? age : control_age_max;
+    control_received++; });
+  if (channels)
+  {
+    link.receiver.addChannel(1, 1, BENCH_QUEUE_LEN);
+    link.receiver.channel(1).template onReceive<Blob<100>>("fw", [](Blob<100> *) { bulk_received++; });
+  }
+  else
+    link.receiver.template onReceive<Blob<100>>("fw", [](Blob<100> *) { bulk_received++; });
+
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&link, BENCH_QUEUE_LEN, {'\r', '\n'});
+  if (channels)
+    device.addChannel(1); // its own TX ring, served round robin with channel 0
+  device.enableAsyncTx(16 * 1024, 1024, TX_QUEUE_BLOCK);
+
+  std::atomic<bool> running{true};
+  std::thread bulk([&]()
+                   {
+    Blob<100> block;
+    memset(block.data, 0x5A, sizeof(block.data));
+    PacketChannel<char, MAX_COMMAND_DEFAULT_LEN> firmware = device.channel(channels ? 1 : 0);
+    while (running)
+      firmware.template restRawOut<Blob<100>>("fw", &block); });
+
+  uint64_t produced = 0;
+  bench_clock::time_point start = bench_clock::now();
+  do
+  {
+    device.restOut("ctl", (double)micros());
+    produced++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  } while (secondsSince(start) < min_case_seconds * 2);
+  running = false;
+  bulk.join();
+  device.flushTx();
+
+  if (control_received != produced || bulk_received == 0)
+  {
+    printf("!! channels: %llu of %llu control values, %llu bulk blocks received\n", (unsigned long long)control_received, (unsigned long long)produced, (unsigned long long)bulk_received);
+    return;
+  }
+  printf("%-20s %6u %8zu %12.1f %12s   %llu bulk blocks, max age %.1f ms\n", channels ? "channels (split)" : "channels (shared)", (unsigned)MAX_COMMAND_DEFAULT_LEN, sizeof(double),
+         (double)control_age_sum / control_received / 1000.0, "ms age", (unsigned long long)bulk_received, control_age_max / 1000.0);
+}
+
+static uint64_t turnaround_sum, turnaround_max, turnaround_received;
+
+static double cpuSeconds()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+// mode 0: a task polling readSerialCommand() every 20 ms (the documented pattern), 1: feedBytes()
+// from a UART event thread waking the enableEventReceive() task, 2: PacketReactor over a pipe
+static void benchEventReceive(int mode)
+{
+  static const char *names[3] = {"receive (poll 20ms)", "receive (event)", "receive (reactor)"};
+  int fds[2];
+  if (pipe(fds) != 0)
+    return;
+  FdStream port(fds[0], -1);
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  turnaround_sum = turnaround_max = turnaround_received = 0;
+  device.template onReceive<double>("cmd", [](double *sent_at)
+                                    {
+    uint64_t age = micros() - (uint64_t)*sent_at;
+    turnaround_sum += age;
+    turnaround_max = age > turnaround_max ? age : turnaround_max;
+    turnaround_received++; });
+
+  std::atomic<bool> running{true};
+  PacketReactor reactor;
+  std::thread receiver;
+  if (mode == 0)
+    receiver = std::thread([&]()
+                           {
+      while (running)
+      {
+        device.readSerialCommand();
+        device.processingQueueCommands();
+        vTaskDelay(20);
+      } });
+  else if (mode == 1)
+    device.enableEventReceive();
+  else
+  {
+    reactor.add(&port, &device);
+    receiver = std::thread([&]()
+                           { reactor.run(); });
+  }
+
+  MemoryStream encoded;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> sender(&encoded, BENCH_QUEUE_LEN, {'\r', '\n'});
+  uint64_t sent = 0;
+  double cpu_start = cpuSeconds();
+  bench_clock::time_point start = bench_clock::now();
+  do
+  {
+    encoded.clearTx();
+    sender.restOut("cmd", (double)micros());
+    if (mode == 1)
+      device.feedBytes((char *)encoded.tx().data(), encoded.tx().size()); // what a UART event callback does
+    else if (::write(fds[1], encoded.tx().data(), encoded.tx().size()) < 0)
+      break;
+    sent++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5)); // commands come and go, the receiver is mostly idle
+  } while (secondsSince(start) < min_case_seconds * 2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(mode == 0 ? 40 : 5));
+  double cpu = cpuSeconds() - cpu_start;
+
+  running = false;
+  if (mode == 1)
+    device.disableEventReceive();
+  else if (mode == 2)
+    reactor.stop();
+  if (receiver.joinable())
+    receiver.join();
+  close(fds[0]);
+  close(fds[1]);
+
+  if (turnaround_received != sent)
+  {
+    printf("!! %s: %llu of %llu commands dispatched\n", names[mode], (unsigned long long)turnaround_received, (unsigned long long)sent);
+    return;
+  }
+  printf("%-20s %6u %8zu %12.1f %12s   max %.1f us, %.1f ms CPU per s\n", names[mode], (unsigned)MAX_COMMAND_DEFAULT_LEN, sizeof(double),
+         (double)turnaround_sum / turnaround_received, "us latency", (double)turnaround_max, cpu * 1000.0 / secondsSince(start));
+}
+
+static std::atomic<uint32_t> backpressure_next{0};
+static uint64_t backpressure_received, backpressure_out_of_order;
+
+// a receiver feeding frames as fast as they come while every dispatch takes 20 us, so the queue
+// stays full: longest feedBytes() call, frames delivered / dropped, none may arrive corrupted
+static void benchBackpressure(uint8_t policy)
+{
+  static const char *names[3] = {"backpressure (ret)", "backpressure (drop)", "backpressure (blk)"};
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(nullptr, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.setRxBackpressure(policy, 2);
+  backpressure_next = 0;
+  backpressure_received = backpressure_out_of_order = 0;
+  device.template onReceive<uint32_t>("bp", [](uint32_t *seq)
+                                      {
+    if (*seq < backpressure_next.load(std::memory_order_relaxed))
+      backpressure_out_of_order++;
+    backpressure_next = *seq + 1;
+    backpressure_received++;
+    bench_clock::time_point busy = bench_clock::now();
+    while (secondsSince(busy) < 20e-6)
+      ; });
+
+  std::atomic<bool> running{true};
+  std::thread processor([&]()
+                        {
+    while (running)
+    {
+      device.processingQueueCommands();
+      std::this_thread::yield();
+    }
+    device.processingQueueCommands(); });
+
+  MemoryStream encoded;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> sender(&encoded, BENCH_QUEUE_LEN, {'\r', '\n'});
+  uint32_t sent = 0;
+  double longest = 0;
+  bench_clock::time_point start = bench_clock::now();
+  do
+  {
+    encoded.clearTx();
+    sender.restOut("bp", sent);
+    char *frame = (char *)encoded.tx().data();
+    size_t len = encoded.tx().size(), taken = 0;
+    while (taken < len) // the caller keeps what was not taken and offers it again
+    {
+      bench_clock::time_point call = bench_clock::now();
+      taken += device.feedBytes(frame + taken, len - taken);
+      longest = std::max(longest, secondsSince(call));
+      if (taken < len)
+        std::this_thread::yield();
+    }
+    sent++;
+  } while (secondsSince(start) < min_case_seconds);
+  double elapsed = secondsSince(start);
+
+  running = false;
+  processor.join();
+
+  PacketStats_t stats = device.getStats();
+  if (backpressure_out_of_order != 0 || backpressure_received + device.rxDropped() != sent || stats.rx_frames != backpressure_received ||
+      stats.rx_dispatched != backpressure_received || stats.rx_queue_peak > BENCH_QUEUE_LEN)
+  {
+    printf("!! %s: %llu of %u frames, %u dropped, %llu out of order\n", names[policy], (unsigned long long)backpressure_received, sent,
+           device.rxDropped(), (unsigned long long)backpressure_out_of_order);
+    return;
+  }
+  printf("%-20s %6u %8zu %12.1f %12s   max call %.1f us, %u dropped of %u\n", names[policy], (unsigned)MAX_COMMAND_DEFAULT_LEN, sizeof(uint32_t),
+         elapsed * 1e9 / sent, "ns/frame", longest * 1e6, device.rxDropped(), sent);
+}
+
+static PacketStats_t stats_reply;
+static uint64_t stats_replies;
+
+// link statistics: a known mix of good, corrupted and unknown frames, then the host polls the
+// "stats" property and decodes the reply; cost of one poll (command in, restRawOut reply out)
+static void benchStats()
+{
+  MemoryStream link;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&link, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.enableStatsProperty();
+  device.template onReceive<float>("ok", [](float *) {});
+
+  MemoryStream encoded;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> host(&encoded, BENCH_QUEUE_LEN, {'\r', '\n'});
+  stats_replies = 0;
+  host.template onReceive<PacketStats_t>(PACKET_STATS_PROPERTY, [](PacketStats_t *stats)
+                                         {
+    stats_reply = *stats;
+    stats_replies++; });
+
+  host.restOut("ok", 1.0f);
+  host.restOut("none", 1.0f); // no handler
+  std::vector<uint8_t> good = encoded.tx();
+  encoded.clearTx();
+  host.restOut("ok", 2.0f);
+  std::vector<uint8_t> bad = encoded.tx();
+  bad[bad.size() - 1] ^= 0x01; // CRC mismatch
+  const char poll[] = PACKET_STATS_PROPERTY "\r\n";
+
+  device.feedBytes((char *)good.data(), good.size());
+  device.feedBytes((char *)bad.data(), bad.size());
+  device.processingQueueCommands();
+  device.feedBytes((char *)poll, sizeof(poll) - 1);
+  device.processingQueueCommands();
+  host.feedBytes((char *)link.tx().data(), link.tx().size());
+  host.processingQueueCommands();
+
+  if (stats_replies != 1 || stats_reply.rx_frames != 4 || stats_reply.rx_crc_errors != 1 || stats_reply.rx_unhandled != 1 ||
+      stats_reply.rx_bytes != good.size() + bad.size() + sizeof(poll) - 1 || stats_reply.tx_frames != 0)
+  {
+    printf("!! stats: %llu replies, %u frames, %u CRC errors, %u unhandled\n", (unsigned long long)stats_replies, stats_reply.rx_frames,
+           stats_reply.rx_crc_errors, stats_reply.rx_unhandled);
+    return;
+  }
+
+  uint64_t polls = 0;
+  bench_clock::time_point start = bench_clock::now();
+  double elapsed = 0;
+  do
+  {
+    for (int i = 0; i < 64; i++)
+    {
+      link.clearTx();
+      device.feedBytes((char *)poll, sizeof(poll) - 1);
+      device.processingQueueCommands();
+    }
+    polls += 64;
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds);
+  report("stats (poll)", MAX_COMMAND_DEFAULT_LEN, sizeof(PacketStats_t), elapsed, polls, polls * link.tx().size());
+}
+
+// latency tracing: parse + dispatch of small frames with enableTrace() vs without (every call has
+// to reach the histogram, also through the arena), then commands every 5 ms read by a task polling
+// every 20 ms: the records show where the time goes
+static void benchTrace(bool poll)
+{
+  MemoryStream encoder;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> sender(&encoder, BENCH_QUEUE_LEN, {'\r', '\n'});
+  if (!poll)
+  {
+    for (int i = 0; i < BENCH_QUEUE_LEN; i++)
+      sender.restOut("cmd", 1.0f);
+    std::vector<uint8_t> wire = encoder.tx();
+
+    for (int traced = 0; traced < 2; traced++)
+    {
+      MemoryStream port;
+      port.feed(wire);
+      DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+      device.enableBulkRead(true);
+      if (traced)
+        device.enableTrace(64);
+      device.template onReceive<float>("cmd", [](float *) {});
+
+      uint64_t rounds = 0;
+      bench_clock::time_point start = bench_clock::now();
+      double elapsed = 0;
+      do
+      {
+        port.rewind();
+        device.readSerialCommand();
+        device.processingQueueCommands();
+        rounds++;
+        elapsed = secondsSince(start);
+      } while (elapsed < min_case_seconds);
+
+      uint32_t calls = 0;
+      device.forEachTrace([&](const char *, uint8_t, const TraceHistogram_t *histogram)
+                          { calls += histogram->count; });
+      if (traced && calls != rounds * BENCH_QUEUE_LEN)
+        printf("!! trace: %u of %llu handler calls traced\n", calls, (unsigned long long)(rounds * BENCH_QUEUE_LEN));
+      report(traced ? "trace (on)" : "trace (off)", MAX_COMMAND_DEFAULT_LEN, sizeof(float), elapsed, rounds * BENCH_QUEUE_LEN, rounds * wire.size());
+    }
+
+    // the arena stores the timestamps behind each record
+    MemoryStream port;
+    port.feed(wire);
+    DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+    device.enableTrace(8);
+    device.enableRxArena(512);
+    device.template onReceive<float>("cmd", [](float *) {});
+    device.readSerialCommand();
+    device.processingQueueCommands();
+    TraceRecord_t records[8];
+    uint16_t kept = device.traceRecords(records, 8);
+    if (kept != BENCH_QUEUE_LEN || strcmp(records[0].name, "cmd") != 0 || records[kept - 1].handler_end < records[kept - 1].first_byte)
+      printf("!! trace (arena): %u records\n", kept);
+    return;
+  }
+
+  int fds[2];
+  if (pipe(fds) != 0)
+    return;
+  FdStream port(fds[0], -1);
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.enableTrace(256);
+  device.template onReceive<float>("cmd", [](float *) {});
+
+  std::atomic<bool> running{true};
+  std::thread receiver([&]()
+                       {
+    while (running)
+    {
+      device.readSerialCommand();
+      device.processingQueueCommands();
+      vTaskDelay(20);
+    } });
+
+  uint32_t sent = 0;
+  bench_clock::time_point start = bench_clock::now();
+  do
+  {
+    encoder.clearTx();
+    sender.restOut("cmd", 1.0f);
+    if (::write(fds[1], encoder.tx().data(), encoder.tx().size()) < 0)
+      break;
+    sent++;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  } while (secondsSince(start) < min_case_seconds * 2);
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  running = false;
+  receiver.join();
+  close(fds[0]);
+  close(fds[1]);
+
+  TraceRecord_t records[256];
+  uint16_t kept = device.traceRecords(records, 256);
+  double receive = 0, wait = 0, handler = 0, total = 0;
+  for (uint16_t i = 0; i < kept; i++)
+  {
+    receive += records[i].complete - records[i].first_byte;
+    wait += records[i].dispatch - records[i].complete;
+    handler += records[i].handler_end - records[i].handler;
+    total += records[i].handler_end - records[i].first_byte;
+  }
+  if (kept == 0 || kept != (sent < 256 ? sent : 256))
+  {
+    printf("!! trace (poll 20ms): %u records of %u commands\n", kept, sent);
+    return;
+  }
+  printf("%-20s %6u %8zu %12.1f %12s   receive %.1f us, wait %.1f us, handler %.2f us\n", "trace (poll 20ms)", (unsigned)MAX_COMMAND_DEFAULT_LEN,
+         sizeof(float), total / kept, "us total", receive / kept, wait / kept, handler / kept);
+}
+
+// one end of a link with a fixed one-way delay: bytes written become readable at the peer end
+// LINK_DELAY_US later
+#define LINK_DELAY_US 1000
+#define PIPELINE_WINDOW 16
+#define PIPELINE_SLOW_US 3000
+
+class DelayLink : public Stream
+{
+private:
+  std::vector<std::pair<uint64_t, uint8_t>> bytes; // due time, byte
+  size_t pos = 0;
+
+public:
+  using Print::write;
+
+  DelayLink *peer = nullptr;
+
+  int available() override
+  {
+    uint64_t now = micros();
+    size_t due = pos;
+    while (due < bytes.size() && bytes[due].first <= now)
+      due++;
+    return (int)(due - pos);
+  }
+  int read() override
+  {
+    if (available() == 0)
+      return -1;
+    uint8_t byte = bytes[pos++].second;
+    if (pos == bytes.size())
+    {
+      bytes.clear();
+      pos = 0;
+    }
+    return byte;
+  }
+  int peek() override { return available() ? bytes[pos].second : -1; }
+  size_t write(uint8_t byte) override { return write(&byte, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    uint64_t due = micros() + LINK_DELAY_US;
+    for (size_t i = 0; i < size; i++)
+      peer->bytes.push_back({due, buffer[i]});
+    return size;
+  }
+};
+
+struct PendingReply
+{
+  PacketReply<char, MAX_COMMAND_DEFAULT_LEN> reply;
+  uint32_t value;
+  uint64_t due;
+};
+
+static uint32_t pipeline_expected[65536]; // request value + 1 by sequence id, 0: not in flight
+static uint64_t pipeline_answered, pipeline_out_of_order, pipeline_wrong, pipeline_last;
+static uint32_t pipeline_in_flight;
+
+// request / reply over a link with 1 ms of delay each way, every 4th request takes the device
+// 3 ms: stop-and-wait (one request in flight) vs PIPELINE_WINDOW requests in flight, every reply
+// matched by its sequence id (out of order behind the slow ones), some of them on channel 1
+static void benchPipeline(bool pipelined)
+{
+  DelayLink device_end, host_end;
+  device_end.peer = &host_end;
+  host_end.peer = &device_end;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&device_end, BENCH_QUEUE_LEN, {'\r', '\n'});
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> host(&host_end, BENCH_QUEUE_LEN, {'\r', '\n'});
+
+  std::vector<PendingReply> slow;
+  auto serve = [&](uint32_t *value)
+  {
+    PacketReply<char, MAX_COMMAND_DEFAULT_LEN> reply = device.reply();
+    if (*value % 4 == 0)
+      slow.push_back({reply, *value, micros() + PIPELINE_SLOW_US}); // answered later from the loop
+    else
+      reply.template restOut<uint32_t>("ans", *value * 3);
+  };
+  device.addChannel(1);
+  device.template onReceive<uint32_t>("req", serve);
+  device.channel(1).template onReceive<uint32_t>("req", serve);
+
+  memset(pipeline_expected, 0, sizeof(pipeline_expected));
+  pipeline_answered = pipeline_out_of_order = pipeline_wrong = pipeline_last = 0;
+  pipeline_in_flight = 0;
+  auto answer = [&](uint32_t *value)
+  {
+    uint16_t sequence;
+    if (!host.rxSequence(&sequence) || pipeline_expected[sequence] == 0 || (pipeline_expected[sequence] - 1) * 3 != *value)
+    {
+      pipeline_wrong++;
+      return;
+    }
+    if (sequence < pipeline_last)
+      pipeline_out_of_order++;
+    pipeline_last = sequence;
+    pipeline_expected[sequence] = 0;
+    pipeline_in_flight--;
+    pipeline_answered++;
+  };
+  host.addChannel(1);
+  host.template onReceive<uint32_t>("ans", answer);
+  host.channel(1).template onReceive<uint32_t>("ans", answer);
+
+  uint32_t window = pipelined ? PIPELINE_WINDOW : 1;
+  uint32_t value = 0;
+  bench_clock::time_point start = bench_clock::now();
+  double elapsed = 0;
+  do
+  {
+    while (pipeline_in_flight < window)
+    {
+      uint16_t sequence = host.nextSequence();
+      pipeline_expected[sequence] = value + 1;
+      host.sequenced(sequence, value % 8 == 7 ? 1 : 0).template restOut<uint32_t>("req", value);
+      pipeline_in_flight++;
+      value++;
+    }
+
+    // both ends polled from this thread, the device answers the slow requests once they are done
+    device.readSerialCommand();
+    device.processingQueueCommands();
+    uint64_t now = micros();
+    for (size_t i = 0; i < slow.size();)
+    {
+      if (slow[i].due <= now)
+      {
+        slow[i].reply.template restOut<uint32_t>("ans", slow[i].value * 3);
+        slow.erase(slow.begin() + i);
+      }
+      else
+        i++;
+    }
+    host.readSerialCommand();
+    host.processingQueueCommands();
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds * 2);
+
+  if (pipeline_answered == 0 || pipeline_wrong != 0 || (pipelined ? pipeline_out_of_order == 0 : pipeline_out_of_order != 0))
+  {
+    printf("!! %s: %llu answered, %llu unmatched, %llu out of order\n", pipelined ? "pipeline (window)" : "pipeline (stop-wait)", (unsigned long long)pipeline_answered,
+           (unsigned long long)pipeline_wrong, (unsigned long long)pipeline_out_of_order);
+    return;
+  }
+  printf("%-20s %6u %8zu %12.1f %12s   %.0f requests/s, %llu answered out of order\n", pipelined ? "pipeline (window)" : "pipeline (stop-wait)", (unsigned)MAX_COMMAND_DEFAULT_LEN,
+         sizeof(uint32_t), elapsed * 1e6 / pipeline_answered, "us/request", pipeline_answered / elapsed, (unsigned long long)pipeline_out_of_order);
+}
+
+// one end of a lossy paced link: writes take the wire for LOSSY_NS_PER_BYTE per byte, reach the
+// peer LINK_DELAY_US after they left it, and a write (one frame) gets a bit flipped with
+// probability loss; like a UART driver, a write only blocks (sleeping, the other threads of the
+// bench may share one core) while more than LOSSY_TX_BUFFER bytes wait for the wire
+#define LOSSY_NS_PER_BYTE 2000
+#define LOSSY_TX_BUFFER 256
+#define ARQ_PAYLOAD 64
+
+class LossyLink : public Stream
+{
+private:
+  std::mutex rx_lock;
+  std::deque<std::pair<uint64_t, uint8_t>> incoming; // due micros(), byte
+  std::mutex wire; // writers of this direction take turns
+  bench_clock::time_point free_at = bench_clock::now();
+  std::mt19937 random{12345};
+
+public:
+  using Print::write;
+
+  LossyLink *peer = nullptr;
+  double loss = 0;
+  uint64_t corrupted = 0;
+
+  int available() override
+  {
+    std::lock_guard<std::mutex> guard(rx_lock);
+    uint64_t now = micros();
+    int due = 0;
+    for (auto it = incoming.begin(); it != incoming.end() && it->first <= now && due < 256; ++it)
+      due++;
+    return due;
+  }
+  int read() override
+  {
+    std::lock_guard<std::mutex> guard(rx_lock);
+    if (incoming.empty() || incoming.front().first > micros())
+      return -1;
+    uint8_t byte = incoming.front().second;
+    incoming.pop_front();
+    return byte;
+  }
+  int peek() override
+  {
+    std::lock_guard<std::mutex> guard(rx_lock);
+    return incoming.empty() || incoming.front().first > micros() ? -1 : incoming.front().second;
+  }
+  size_t write(uint8_t byte) override { return write(&byte, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    std::unique_lock<std::mutex> guard(wire);
+    bench_clock::time_point now = bench_clock::now();
+    free_at = (free_at > now ? free_at : now) + std::chrono::nanoseconds((uint64_t)size * LOSSY_NS_PER_BYTE);
+    std::vector<uint8_t> bytes(buffer, buffer + size);
+    if (size > 0 && std::uniform_real_distribution<double>(0, 1)(random) < loss)
+    {
+      bytes[random() % size] ^= (uint8_t)(1 << (random() % 8));
+      corrupted++;
+    }
+    uint64_t due = micros() + std::chrono::duration_cast<std::chrono::microseconds>(free_at - now).count() + LINK_DELAY_US;
+    {
+      std::lock_guard<std::mutex> rx_guard(peer->rx_lock);
+      for (uint8_t byte : bytes)
+        peer->incoming.push_back({due, byte});
+    }
+    bench_clock::time_point drained = free_at - std::chrono::nanoseconds((uint64_t)LOSSY_TX_BUFFER * LOSSY_NS_PER_BYTE);
+    guard.unlock();
+    std::this_thread::sleep_until(drained);
+    return size;
+  }
+};
+
+static uint32_t arq_expected, arq_received, arq_out_of_order;
+
+static uint32_t arq_batched, arq_streamed, arq_stream_commits;
+
+// reliable delivery and frame limits: records batched up to the receiver's N still get the prefix
+// and arrive, an array too long for a slot with the prefix reaches the peer's onStream() without it
+// and is counted in tx_unreliable
+static void checkReliableLimits()
+{
+  MemoryStream sender_end, receiver_end;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> sender(&sender_end, BENCH_QUEUE_LEN, {'\r', '\n'});
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> receiver(&receiver_end, BENCH_QUEUE_LEN, {'\r', '\n'});
+  sender.enableReliable(8);
+  receiver.enableReliable(8);
+  arq_batched = arq_streamed = arq_stream_commits = 0;
+  receiver.onReceive<float>("x", [](float *) { arq_batched++; });
+  receiver.onStream("big", [](char *, uint16_t len, uint32_t) { arq_streamed += len; }, [](bool commit)
+                    { arq_stream_commits += commit; });
+
+  sender.beginBatch(MAX_COMMAND_DEFAULT_LEN);
+  for (int i = 0; i < 40; i++)
+    sender.restOut("x", (float)i);
+  sender.endBatch();
+  float big[MAX_COMMAND_DEFAULT_LEN / sizeof(float)] = {};
+  sender.restArrayOut("big", big, sizeof(big) / sizeof(float));
+
+  std::vector<uint8_t> wire = sender_end.tx();
+  for (size_t at = 0; at < wire.size(); at += 16)
+  {
+    receiver.feedBytes((char *)wire.data() + at, std::min<size_t>(16, wire.size() - at));
+    receiver.processingQueueCommands();
+  }
+  PacketStats_t tx = sender.getStats(), rx = receiver.getStats();
+  if (arq_batched != 40 || arq_stream_commits != 1 || arq_streamed != sizeof(big) || tx.tx_unreliable != 1 || tx.tx_dropped != 0 ||
+      rx.rx_oversize != 0)
+    printf("!! arq limits: %u of 40 batched records, %u streamed arrays (%u bytes), %u unreliable, %u dropped, %u oversize at the receiver\n",
+           arq_batched, arq_stream_commits, arq_streamed, tx.tx_unreliable, tx.tx_dropped, rx.rx_oversize);
+}
+
+// reliable delivery: 64 byte blocks as fast as a 500 KB/s link with 1 ms delay each way takes
+// them, without and with enableReliable(), on a clean link and with 1% of the frames corrupted;
+// goodput, and every block has to arrive exactly once and in order with reliable delivery on
+static void benchReliable(bool reliable, double loss)
+{
+  LossyLink sender_end, receiver_end;
+  sender_end.peer = &receiver_end;
+  receiver_end.peer = &sender_end;
+  sender_end.loss = receiver_end.loss = loss;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> sender(&sender_end, BENCH_QUEUE_LEN, {'\r', '\n'});
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> receiver(&receiver_end, BENCH_QUEUE_LEN, {'\r', '\n'});
+  if (reliable)
+  {
+    sender.enableReliable(32, 1000);
+    receiver.enableReliable(32);
+  }
+  arq_expected = arq_received = arq_out_of_order = 0;
+  receiver.template onReceive<Blob<ARQ_PAYLOAD>>("blk", [](Blob<ARQ_PAYLOAD> *block)
+                                                 {
+    uint32_t index;
+    memcpy(&index, block->data, sizeof(index));
+    if (index != arq_expected)
+      arq_out_of_order++;
+    arq_expected = index + 1;
+    arq_received++; });
+
+  std::atomic<bool> running{true};
+  auto poll = [&](DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> *device)
+  {
+    while (running)
+    {
+      device->readSerialCommand();
+      device->processingQueueCommands();
+      std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+  };
+  std::thread sender_rx(poll, &sender), receiver_rx(poll, &receiver);
+
+  Blob<ARQ_PAYLOAD> block;
+  memset(block.data, 0x5A, sizeof(block.data));
+  uint32_t sent = 0;
+  bench_clock::time_point start = bench_clock::now();
+  do
+  {
+    memcpy(block.data, &sent, sizeof(sent));
+    sender.template restRawOut<Blob<ARQ_PAYLOAD>>("blk", &block);
+    sent++;
+  } while (secondsSince(start) < min_case_seconds * 2);
+  while (reliable && sender.reliablePending() != 0 && secondsSince(start) < min_case_seconds * 2 + 2)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  std::this_thread::sleep_for(std::chrono::milliseconds(5)); // the last frames are on the wire
+  double elapsed = secondsSince(start);
+  running = false;
+  sender_rx.join();
+  receiver_rx.join();
+
+  PacketStats_t rx = receiver.getStats(), tx = sender.getStats();
+  uint32_t delivered = arq_received;
+  char name[32];
+  snprintf(name, sizeof(name), "arq (%s, %.0f%%)", reliable ? "on" : "off", loss * 100);
+  if (reliable && (delivered != sent || arq_expected != sent || arq_out_of_order != 0 || tx.tx_dropped != 0))
+  {
+    printf("!! %s: %u of %u delivered, %u out of order, %u dropped, %u pending, %u retransmitted, %u duplicates, %u crc\n", name, delivered, sent, arq_out_of_order, tx.tx_dropped,
+           sender.reliablePending(), tx.tx_retransmits, rx.rx_duplicates, rx.rx_crc_errors);
+    return;
+  }
+  double line_rate = 1e9 / LOSSY_NS_PER_BYTE;
+  printf("%-20s %6u %8u %12.1f %12.2f   %.0f%% of the line, %u of %u delivered, %u retransmitted\n", name, (unsigned)MAX_COMMAND_DEFAULT_LEN,
+         (unsigned)ARQ_PAYLOAD, elapsed * 1e9 / delivered, delivered * (double)ARQ_PAYLOAD / elapsed / 1e6,
+         delivered * (double)ARQ_PAYLOAD / elapsed / line_rate * 100, delivered, sent, tx.tx_retransmits);
+}
+
+#define DELTA_CHANNELS 256
+
+struct Setpoint
+{
+  uint32_t words[16]; // all the same value, a torn copy mixes two
+};
+
+static std::mutex setpoint_lock;
+static Setpoint setpoint_copy;
+
+static bool setpointTorn(const Setpoint &setpoint)
+{
+  for (uint8_t i = 1; i < 16; i++)
+    if (setpoint.words[i] != setpoint.words[0])
+      return true;
+  return false;
+}
+
+// a double record cut to 2 bytes (a uint16_t record with its type id patched, CRC fixed up) must
+// not reach a bound double, the next whole one has to
+static void checkBindShortRecord()
+{
+  MemoryStream encoder;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> sender(&encoder, BENCH_QUEUE_LEN, {'\r', '\n'});
+  uint16_t half = 0xBEEF;
+  sender.restRawOut<uint16_t>("D", &half);
+  std::vector<uint8_t> wire = encoder.tx();
+  uint16_t body_len = TRANSFER_DATA_PARAMS_HEADER_LEN + 1 + sizeof(half);
+  uint8_t *body = wire.data() + wire.size() - CRC_BYTE_LEN - body_len;
+  body[2] = DATA_TYPE_DOUBLE;
+  uint16_t crc = DevicePacket<char, MAX_COMMAND_DEFAULT_LEN>::getCRC<uint8_t>(body, body_len);
+  body[body_len] = (uint8_t)(crc >> 8);
+  body[body_len + 1] = (uint8_t)crc;
+  encoder.clearTx();
+  double whole = 2.5;
+  sender.restRawOut<double>("D", &whole);
+  std::vector<uint8_t> good = encoder.tx();
+
+  MemoryStream port;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  PacketBound<double> target;
+  device.bind<double>("D", &target);
+  device.feedBytes((char *)wire.data(), wire.size());
+  device.processingQueueCommands();
+  uint32_t after_short = target.getVersion();
+  device.feedBytes((char *)good.data(), good.size());
+  device.processingQueueCommands();
+  double value = 0;
+  uint32_t after_whole = target.load(&value);
+  if (after_short != 0 || after_whole != 1 || value != whole || device.getStats().rx_crc_errors != 0)
+    printf("!! bind short record: version %u after it, %u after a whole one (value %g)\n", after_short, after_whole, value);
+}
+
+// high-rate setpoints: a handler copying each one out under a mutex vs bind() into a PacketBound,
+// with a second thread reading the latest value all the time; dispatch cost per frame and how
+// many of the reads were torn (has to be none)
+static void benchBind(bool bound)
+{
+  MemoryStream encoder;
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> sender(&encoder, BENCH_QUEUE_LEN, {'\r', '\n'});
+  for (uint32_t i = 0; i < BENCH_QUEUE_LEN; i++)
+  {
+    Setpoint setpoint;
+    for (uint8_t w = 0; w < 16; w++)
+      setpoint.words[w] = i + 1;
+    sender.restRawOut<Setpoint>("SET", &setpoint);
+  }
+  std::vector<uint8_t> wire = encoder.tx();
+
+  MemoryStream port;
+  port.feed(wire);
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  PacketBound<Setpoint> target;
+  if (bound)
+    device.bind<Setpoint>("SET", &target);
+  else
+    device.onReceive<Setpoint>("SET", [](Setpoint *setpoint)
+                               {
+                                 std::lock_guard<std::mutex> guard(setpoint_lock);
+                                 memcpy(&setpoint_copy, setpoint, sizeof(Setpoint)); });
+
+  std::atomic<bool> running{true};
+  uint64_t reads = 0, torn = 0;
+  std::thread reader([&]
+                     {
+                       Setpoint seen;
+                       while (running.load(std::memory_order_relaxed))
+                       {
+                         if (bound)
+                           target.load(&seen);
+                         else
+                         {
+                           std::lock_guard<std::mutex> guard(setpoint_lock);
+                           seen = setpoint_copy;
+                         }
+                         reads++;
+                         if (setpointTorn(seen))
+                           torn++;
+                       } });
+
+  uint64_t rounds = 0;
+  double dispatch_time = 0;
+  while (dispatch_time < min_case_seconds)
+  {
+    port.rewind();
+    device.readSerialCommand();
+    bench_clock::time_point start = bench_clock::now();
+    device.processingQueueCommands();
+    dispatch_time += secondsSince(start);
+    rounds++;
+  }
+  running = false;
+  reader.join();
+
+  uint32_t last = bound ? target.load().words[0] : setpoint_copy.words[0];
+  if (torn != 0 || last != BENCH_QUEUE_LEN)
+    printf("!! bind %s: %llu torn reads, last value %u\n", bound ? "on" : "off", (unsigned long long)torn, last);
+
+  uint64_t packets = rounds * BENCH_QUEUE_LEN;
+  printf("%-20s %6u %8zu %12.1f %12.2f   %llu reads, %llu torn\n", bound ? "bind (PacketBound)" : "bind (handler)",
+         (unsigned)MAX_COMMAND_DEFAULT_LEN, sizeof(Setpoint), dispatch_time * 1e9 / packets,
+         rounds * wire.size() / dispatch_time / 1e6, (unsigned long long)reads, (unsigned long long)torn);
+}
+
+static void benchJson(bool array)
+{
+  MemoryStream sink(false);
+  DevicePacket<char, MAX_COMMAND_DEFAULT_LEN> device(&sink, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.setBufferMode(false);
+
+  static float channels[DELTA_CHANNELS];
+  for (int i = 0; i < DELTA_CHANNELS; i++)
+    channels[i] = -300.0f + i * 2.71828f;
+
+  sink.setCapture(true);
+  if (array)
+    device.restArrayOut<float>("env", channels, DELTA_CHANNELS);
+  else
+    device.restOut("amp", channels[7]);
+  size_t frame_size = sink.tx().size();
+  sink.setCapture(false);
+
+  uint64_t packets = 0;
+  bench_clock::time_point start = bench_clock::now();
+  double elapsed = 0;
+  do
+  {
+    for (int i = 0; i < 16; i++)
+    {
+      if (array)
+        device.restArrayOut<float>("env", channels, DELTA_CHANNELS);
+      else
+        device.restOut("amp", channels[i]);
+    }
+    packets += 16;
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds);
+
+  report(array ? "json array" : "json restOut", MAX_COMMAND_DEFAULT_LEN, array ? sizeof(channels) : sizeof(float), elapsed, packets, packets * frame_size);
+}
+
+static void benchDeltaTelemetry(bool delta)
+{
+  const uint16_t N = 2048; // the receiver has to take a keyframe (the whole array)
+  const int frames = 200;
+
+  MemoryStream port;
+  DevicePacket<char, N> sender(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  sender.setDeltaMode(delta);
+
+  MemoryStream rx_port;
+  DevicePacket<char, N> receiver(&rx_port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  receiver.enableBulkRead(true);
+  static float channels[DELTA_CHANNELS];
+  static uint32_t matched;
+  matched = 0;
+  receiver.template onReceive<float>("env", std::function<void(float *, uint16_t)>([](float *values, uint16_t count)
+                                                                                    { matched += count == DELTA_CHANNELS && memcmp(values, channels, sizeof(channels)) == 0; }));
+
+  // every frame about one channel in ten moves a little
+  uint32_t seed = 1;
+  for (int i = 0; i < DELTA_CHANNELS; i++)
+    channels[i] = 20.0f + i * 0.125f;
+
+  size_t wire = 0;
+  uint64_t packets = 0;
+  double elapsed = 0;
+  do
+  {
+    for (int f = 0; f < frames; f++)
+    {
+      for (int i = 0; i < DELTA_CHANNELS; i++)
+      {
+        seed = seed * 1103515245u + 12345u;
+        if ((seed >> 16) % 10 == 0)
+          channels[i] += (float)((int)((seed >> 8) & 0xFF) - 128) * 0.0005f;
+      }
+
+      port.clearTx();
+      bench_clock::time_point start = bench_clock::now();
+      sender.restArrayOut<float>("env", channels, DELTA_CHANNELS);
+      elapsed += secondsSince(start);
+      packets++;
+      wire += port.tx().size();
+
+      rx_port.feed(port.tx());
+      receiver.readSerialCommand();
+      receiver.processingQueueCommands();
+    }
+  } while (elapsed < min_case_seconds);
+
+  if (matched != packets)
+    printf("!! delta: %u of %llu frames rebuilt\n", (unsigned)matched, (unsigned long long)packets);
+
+  report(delta ? "telemetry (delta)" : "telemetry (array)", N, sizeof(channels), elapsed, packets, wire);
+  printf("%-20s %6u %8zu %12.1f %12s\n", "  wire B/frame", (unsigned)N, sizeof(channels), (double)wire / packets, "");
+}
+
+template <uint16_t N>
+static void benchBatchTelemetry()
+{
+  const int records = 200;
+
+  MemoryStream port;
+  DevicePacket<char, N> sender(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  sender.beginBatch(N);
+
+  uint64_t packets = 0;
+  float value = 0;
+  bench_clock::time_point start = bench_clock::now();
+  double elapsed = 0;
+  do
+  {
+    port.clearTx();
+    for (int i = 0; i < records; i++)
+      sender.restOut("amp", value += 0.25f);
+    sender.flushBatch();
+    packets += records;
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds);
+
+  // the last round trips through a receiver
+  std::vector<uint8_t> wire = port.tx();
+  MemoryStream rx_port;
+  rx_port.feed(wire);
+  DevicePacket<char, N> receiver(&rx_port, 250, {'\r', '\n'});
+  receiver.enableBulkRead(true);
+  static uint32_t received = 0;
+  received = 0;
+  receiver.template onReceive<float>("amp", [](float *)
+                                     { received++; });
+  receiver.readSerialCommand();
+  receiver.processingQueueCommands();
+  if (received != (uint32_t)records)
+    printf("!! batch N=%u: dispatched %u of %d records\n", (unsigned)N, (unsigned)received, records);
+
+  report("telemetry (batch)", N, sizeof(float), elapsed, packets, (packets / records) * wire.size());
+  printf("%-20s %6u %8zu %12.1f %12s\n", "  wire B/record", (unsigned)N, sizeof(float), (double)wire.size() / records, "");
+}
+
+template <uint16_t N, size_t S>
+static void benchReceive(bool bulk)
+{
+  // encode one queue worth of frames
+  MemoryStream encoder;
+  DevicePacket<char, N> sender(&encoder, BENCH_QUEUE_LEN, {'\r', '\n'});
+  Blob<S> blob;
+  memset(blob.data, 0x5A, S);
+  for (int i = 0; i < BENCH_QUEUE_LEN; i++)
+    sender.template restRawOut<Blob<S>>("blob", &blob);
+  std::vector<uint8_t> wire = encoder.tx();
+
+  MemoryStream port;
+  port.feed(wire);
+  DevicePacket<char, N> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.enableBulkRead(bulk);
+  device.template onReceive<Blob<S>>("blob", [](Blob<S> *)
+                                     { handled_packets = handled_packets + 1; });
+
+  uint64_t rounds = 0;
+  double parse_time = 0, dispatch_time = 0;
+  uint32_t handled_before = handled_packets;
+  do
+  {
+    port.rewind();
+    bench_clock::time_point start = bench_clock::now();
+    device.readSerialCommand();
+    bench_clock::time_point mid = bench_clock::now();
+    device.processingQueueCommands();
+    bench_clock::time_point end = bench_clock::now();
+
+    parse_time += std::chrono::duration<double>(mid - start).count();
+    dispatch_time += std::chrono::duration<double>(end - mid).count();
+    rounds++;
+  } while (parse_time + dispatch_time < min_case_seconds);
+
+  uint64_t packets = rounds * BENCH_QUEUE_LEN;
+  if (handled_packets - handled_before != packets)
+    printf("!! %s N=%u S=%zu: dispatched %u of %llu packets\n", bulk ? "bulk" : "byte", (unsigned)N, S, (unsigned)(handled_packets - handled_before), (unsigned long long)packets);
+
+  report(bulk ? "parse (bulk)" : "parse (byte)", N, S, parse_time, packets, rounds * wire.size());
+  report(bulk ? "dispatch (bulk)" : "dispatch (byte)", N, S, dispatch_time, packets, rounds * wire.size());
+}
+
+// bytes of the default slot queue, the arena cases get the same budget
+template <uint16_t N>
+static uint32_t slotQueueBytes()
+{
+  return (BENCH_QUEUE_LEN + 1) * sizeof(Command_t<char, N>);
+}
+
+template <uint16_t N, size_t S>
+static void benchThreaded(bool arena)
+{
+  MemoryStream encoder;
+  DevicePacket<char, N> sender(&encoder, BENCH_QUEUE_LEN, {'\r', '\n'});
+  Blob<S> blob;
+  memset(blob.data, 0x3C, S);
+  sender.template restRawOut<Blob<S>>("blob", &blob);
+  std::vector<uint8_t> frame = encoder.tx();
+
+  const uint32_t frames_per_feed = 64;
+  std::vector<uint8_t> wire;
+  for (uint32_t i = 0; i < frames_per_feed; i++)
+    wire.insert(wire.end(), frame.begin(), frame.end());
+
+  MemoryStream port;
+  port.feed(wire);
+  DevicePacket<char, N> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.enableBulkRead(false);
+  if (arena && !device.enableRxArena(slotQueueBytes<N>() - sizeof(Command_t<char, N>)))
+    printf("!! threaded N=%u: enableRxArena failed\n", (unsigned)N);
+
+  static std::atomic<uint32_t> received{0};
+  received = 0;
+  device.template onReceive<Blob<S>>("blob", [](Blob<S> *)
+                                     { received.fetch_add(1, std::memory_order_relaxed); });
+
+  std::atomic<bool> running{true};
+  uint64_t feeds = 0;
+
+  bench_clock::time_point start = bench_clock::now();
+  std::thread consumer([&]()
+                       {
+    while (running.load(std::memory_order_relaxed))
+    {
+      device.processingQueueCommands();
+      std::this_thread::yield();
+    }
+    device.processingQueueCommands(); });
+
+  double elapsed = 0;
+  do
+  {
+    port.rewind();
+    while (port.available() > 0)
+    {
+      device.readSerialCommand(); // returns early while the queue is full
+      if (port.available() > 0)
+        std::this_thread::yield();
+    }
+    feeds++;
+    elapsed = secondsSince(start);
+  } while (elapsed < min_case_seconds);
+
+  uint64_t packets = feeds * frames_per_feed;
+  while (received.load() < packets && secondsSince(start) < elapsed + 1.0)
+    std::this_thread::yield();
+  running = false;
+  consumer.join();
+  elapsed = secondsSince(start);
+
+  if (received.load() != packets)
+    printf("!! threaded%s N=%u S=%zu: dispatched %u of %llu packets\n", arena ? " (arena)" : "", (unsigned)N, S, (unsigned)received.load(), (unsigned long long)packets);
+
+  report(arena ? "threaded (arena)" : "threaded", N, S, elapsed, packets, feeds * wire.size());
+}
+
+// how many small frames wait in the queue before the receiver stops reading, for the same RAM
+template <uint16_t N>
+static uint32_t queuedBeforeFull(bool arena)
+{
+  MemoryStream encoder;
+  DevicePacket<char, N> sender(&encoder, BENCH_QUEUE_LEN, {'\r', '\n'});
+  for (int i = 0; i < 1000; i++)
+    sender.restOut("amp", (float)i);
+
+  MemoryStream port;
+  port.feed(encoder.tx());
+  DevicePacket<char, N> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.enableBulkRead(false); // stops at the first byte that finds the queue full
+  if (arena && !device.enableRxArena(slotQueueBytes<N>() - sizeof(Command_t<char, N>)))
+    printf("!! rx queue N=%u: enableRxArena failed\n", (unsigned)N);
+
+  static uint32_t received;
+  static float expected;
+  received = 0;
+  expected = 0;
+  device.template onReceive<float>("amp", [](float *value)
+                                   { received += *value == expected; expected += 1; });
+
+  device.readSerialCommand();
+  device.processingQueueCommands();
+  uint32_t queued = received;
+
+  while (port.available() > 0)
+  {
+    device.readSerialCommand();
+    device.processingQueueCommands();
+  }
+  if (received != 1000)
+    printf("!! rx queue%s N=%u: %u of 1000 frames in order\n", arena ? " (arena)" : "", (unsigned)N, (unsigned)received);
+  return queued;
+}
+
+template <uint16_t N>
+static void benchRxQueue()
+{
+  printf("%-20s %6u %8zu %12u %12s\n", "rx queue (slots)", (unsigned)N, sizeof(float), (unsigned)queuedBeforeFull<N>(false), "frames");
+  printf("%-20s %6u %8zu %12u %12s\n", "rx queue (arena)", (unsigned)N, sizeof(float), (unsigned)queuedBeforeFull<N>(true), "frames");
+}
+
+static std::vector<uint8_t> streamed;
+static uint32_t stream_commits = 0, stream_aborts = 0;
+
+template <uint16_t N, size_t S>
+static void benchStream()
+{
+  // frames are encoded by a device big enough to send them
+  MemoryStream encoder;
+  DevicePacket<char, 2048> sender(&encoder, BENCH_QUEUE_LEN, {'\r', '\n'});
+  Blob<S> blob;
+  for (size_t i = 0; i < S; i++)
+    blob.data[i] = (uint8_t)(i * 13 + 1);
+  for (int i = 0; i < BENCH_QUEUE_LEN; i++)
+    sender.template restRawOut<Blob<S>>("blob", &blob);
+  std::vector<uint8_t> wire = encoder.tx();
+
+  MemoryStream port;
+  port.feed(wire);
+  DevicePacket<char, N> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.enableBulkRead(true);
+  device.onStream("blob", [](char *chunk, uint16_t len, uint32_t offset)
+                  {
+                    if (streamed.size() < offset + len)
+                      streamed.resize(offset + len);
+                    memcpy(streamed.data() + offset, chunk, len); }, [](bool commit)
+                  { commit ? stream_commits++ : stream_aborts++; });
+
+  // one pass checked: the payload is rebuilt from the chunks, then a corrupted frame aborts
+  streamed.clear();
+  stream_commits = stream_aborts = 0;
+  device.readSerialCommand();
+  if (stream_commits != BENCH_QUEUE_LEN || stream_aborts != 0 || streamed.size() != S || memcmp(streamed.data(), blob.data, S) != 0)
+    printf("!! stream N=%u S=%zu: %u commits, %u aborts, %zu bytes\n", (unsigned)N, S, stream_commits, stream_aborts, streamed.size());
+
+  std::vector<uint8_t> corrupted(wire.begin(), wire.begin() + wire.size() / BENCH_QUEUE_LEN);
+  corrupted[corrupted.size() / 2] ^= 0x40;
+  MemoryStream bad_port;
+  bad_port.feed(corrupted);
+  device.setDevicePort(&bad_port);
+  stream_commits = stream_aborts = 0;
+  device.readSerialCommand();
+  if (stream_commits != 0 || stream_aborts != 1)
+    printf("!! stream N=%u S=%zu: corrupted frame gave %u commits, %u aborts\n", (unsigned)N, S, stream_commits, stream_aborts);
+  device.setDevicePort(&port);
+
+  uint64_t rounds = 0;
+  double elapsed = 0;
+  do
+  {
+    port.rewind();
+    bench_clock::time_point start = bench_clock::now();
+    device.readSerialCommand();
+    elapsed += secondsSince(start);
+    rounds++;
+  } while (elapsed < min_case_seconds);
+
+  report("stream", N, S, elapsed, rounds * BENCH_QUEUE_LEN, rounds * wire.size());
+}
+
+template <uint16_t N>
+static void benchText(bool views)
+{
+  static const char commands[] = "SET:P=1234\r\nGAN=12\r\nCHN:A\r\nVNR\r\nSET:Q=5678\r\n";
+  const size_t commands_len = sizeof(commands) - 1;
+
+  MemoryStream port;
+  port.feed((const uint8_t *)commands, commands_len);
+  DevicePacket<char, N> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'});
+  device.enableBulkRead(true);
+  if (views)
+  {
+    device.onReceive("SET", [](TextView_t, TextView_t value)
+                     { handled_packets = handled_packets + (value.toInt() != 0); });
+    device.onReceive("GAN", [](TextView_t value)
+                     { handled_packets = handled_packets + (value.toInt() != 0); });
+    device.onReceive("CHN", [](TextView_t)
+                     { handled_packets = handled_packets + 1; }, true);
+  }
+  else
+  {
+    device.onReceive("SET", [](String, String value)
+                     { handled_packets = handled_packets + (value.toInt() != 0); });
+    device.onReceive("GAN", [](String value)
+                     { handled_packets = handled_packets + (value.toInt() != 0); });
+    device.onReceive("CHN", [](String)
+                     { handled_packets = handled_packets + 1; }, true);
+  }
+  device.onReceive("VNR", []()
+                   { handled_packets = handled_packets + 1; });
+
+  uint64_t rounds = 0;
+  double elapsed = 0;
+  do
+  {
+    port.rewind();
+    bench_clock::time_point start = bench_clock::now();
+    device.readSerialCommand();
+    device.processingQueueCommands();
+    elapsed += secondsSince(start);
+    rounds++;
+  } while (elapsed < min_case_seconds);
+
+  report(views ? "text (views)" : "text (String)", N, 0, elapsed, rounds * BENCH_QUEUE_LEN, rounds * commands_len);
+}
+
+template <uint16_t N, size_t S>
+static void benchPayload()
+{
+  // frame = params header(6) + "blob"(4) + payload + crc(2), must fit in N
+  if constexpr (S + TRANSFER_DATA_PARAMS_HEADER_LEN + 4 + CRC_BYTE_LEN < N)
+  {
+    benchTransmit<N, S>();
+    benchReceive<N, S>(false);
+    benchReceive<N, S>(true);
+    benchThreaded<N, S>(false);
+    benchThreaded<N, S>(true);
+  }
+  else
+  {
+    benchStream<N, S>(); // does not fit a slot
+  }
+}
+
+// the receiver side of the framing handshake, as if the peer had answered our "#FR"
+template <uint16_t N>
+static void acceptCompact(DevicePacket<char, N> &device, MemoryStream &port)
+{
+  static const char accept[] = FRAMING_ACCEPT_CMD "=1\r\n";
+  MemoryStream handshake;
+  handshake.feed((const uint8_t *)accept, sizeof(accept) - 1);
+  device.setDevicePort(&handshake);
+  device.readSerialCommand();
+  device.processingQueueCommands();
+  device.setDevicePort(&port);
+}
+
+template <uint16_t N>
+static void benchFraming(bool compact)
+{
+  uint8_t framing = compact ? PACKET_FRAMING_COMPACT : PACKET_FRAMING_NIBBLE;
+  MemoryStream encoder;
+  DevicePacket<char, N> sender(&encoder, BENCH_QUEUE_LEN, {'\r', '\n'}, framing);
+  if (compact)
+  {
+    acceptCompact<N>(sender, encoder);
+    if (sender.getFraming() != PACKET_FRAMING_COMPACT)
+      printf("!! framing N=%u: handshake did not switch to compact\n", (unsigned)N);
+  }
+  for (int i = 0; i < BENCH_QUEUE_LEN; i++)
+    sender.restOut("amp", (float)i);
+  std::vector<uint8_t> wire = encoder.tx();
+
+  MemoryStream port;
+  port.feed(wire);
+  DevicePacket<char, N> device(&port, BENCH_QUEUE_LEN, {'\r', '\n'}, framing);
+  device.enableBulkRead(true);
+  device.template onReceive<float>("amp", [](float *)
+                                   { handled_packets = handled_packets + 1; });
+
+  uint64_t rounds = 0;
+  double elapsed = 0;
+  uint32_t handled_before = handled_packets;
+  do
+  {
+    port.rewind();
+    bench_clock::time_point start = bench_clock::now();
+    device.readSerialCommand();
+    device.processingQueueCommands();
+    elapsed += secondsSince(start);
+    rounds++;
+  } while (elapsed < min_case_seconds);
+
+  uint64_t packets = rounds * BENCH_QUEUE_LEN;
+  if (handled_packets - handled_before != packets)
+    printf("!! framing N=%u: dispatched %u of %llu packets\n", (unsigned)N, (unsigned)(handled_packets - handled_before), (unsigned long long)packets);
+
+  report(compact ? "framing (compact)" : "framing (nibble)", N, sizeof(float), elapsed, packets, rounds * wire.size());
+  printf("%-20s %6u %8zu %12.1f %12s\n", "  wire B/frame", (unsigned)N, sizeof(float), (double)wire.size() / BENCH_QUEUE_LEN, "");
+}
+
+template <uint16_t N>
+static void benchSize()
+{
+  benchPayload<N, 4>();
+  benchPayload<N, 32>();
+  benchPayload<N, 100>();
+  benchPayload<N, 400>();
+  benchPayload<N, 1500>();
+  benchText<N>(false);
+  benchText<N>(true);
+  benchBatchTelemetry<N>();
+  benchRxQueue<N>();
+  benchFraming<N>(false);
+  benchFraming<N>(true);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1)
+    min_case_seconds = atof(argv[1]) / 1000.0;
+
+  printf("%-20s %6s %8s %12s %12s\n", "case", "N", "payload", "ns/packet", "MB/s");
+
+  benchCRCEngines();
+  benchTelemetry(false);
+  benchTelemetry(true);
+  benchAsyncTelemetry();
+  benchDeltaTelemetry(false);
+  benchDeltaTelemetry(true);
+  benchJson(false);
+  benchJson(true);
+  benchPublish(false);
+  benchPublish(true);
+  checkTextPrefixes();
+  benchChannels(false);
+  benchChannels(true);
+  benchEventReceive(0);
+  benchEventReceive(1);
+  benchEventReceive(2);
+  benchBackpressure(RX_QUEUE_RETURN);
+  benchBackpressure(RX_QUEUE_DROP);
+  benchBackpressure(RX_QUEUE_BLOCK);
+  benchStats();
+  benchTrace(false);
+  benchTrace(true);
+  benchPipeline(false);
+  benchPipeline(true);
+  checkReliableLimits();
+  benchReliable(false, 0.0);
+  benchReliable(false, 0.01);
+  benchReliable(true, 0.0);
+  benchReliable(true, 0.01);
+  checkBindShortRecord();
+  benchBind(false);
+  benchBind(true);
+
+  benchSize<128>();
+  benchSize<512>();
+  benchSize<2048>();
+
+  return 0;
+}
@@ -0,0 +1,366 @@
+/*
+ *  Host portability layer for Packet_Device
+ *  ----------------------------------------
+ *  Minimal stand-ins for the parts of the Arduino core and the FreeRTOS
+ *  API that Packet_Device uses, so the library can be compiled and
+ *  benchmarked natively on Linux (see CMakeLists.txt at the repo root).
+ *
+ *  Only what the library and the host tools need is provided:
+ *    - String   : std::string backed, Arduino-compatible number formatting
+ *    - Print / Stream
+ *    - millis(), micros(), delay()
+ *    - FreeRTOS tick, delay, task, mutex and binary semaphore primitives
+ *      backed by std::thread
+ *
+ *  This folder lives under extras/ so the Arduino builder never sees it.
+ */
+
+#ifndef __PACKET_DEVICE_HOST_ARDUINO__
+#define __PACKET_DEVICE_HOST_ARDUINO__
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath> // the Arduino core pulls in math.h
+#include <string>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#define PACKET_DEVICE_HOST 1
+
+// ---------------------------------------------------------------------------
+// Time
+// ---------------------------------------------------------------------------
+
+inline std::chrono::steady_clock::time_point __host_boot_time()
+{
+  static const std::chrono::steady_clock::time_point boot = std::chrono::steady_clock::now();
+  return boot;
+}
+
+inline unsigned long millis()
+{
+  return (unsigned long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - __host_boot_time()).count();
+}
+
+inline unsigned long micros()
+{
+  return (unsigned long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - __host_boot_time()).count();
+}
+
+inline void delay(unsigned long ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// ---------------------------------------------------------------------------
+// FreeRTOS subset (tick, delay, tasks, mutex, binary semaphore)
+// ---------------------------------------------------------------------------
+
+// the library guards its FreeRTOS usage behind this config macro, the host
+// layer emulates the same API on top of std::mutex / std::this_thread
+#ifndef configUSE_PREEMPTION
+#define configUSE_PREEMPTION 1
+#endif
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+typedef void *TaskHandle_t;
+
+// one handle type for both FreeRTOS flavours the library uses: mutexes map to
+// std::mutex, binary semaphores to a flag + condition variable
+struct __host_semaphore
+{
+  bool is_mutex;
+  std::mutex lock;
+  std::condition_variable signal;
+  bool given = false;
+
+  __host_semaphore(bool mutex) : is_mutex(mutex) {}
+};
+typedef __host_semaphore *SemaphoreHandle_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xFFFFFFFFUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+inline TickType_t xTaskGetTickCount()
+{
+  return (TickType_t)millis();
+}
+
+inline void vTaskDelay(TickType_t ticks)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+// tasks run on detached threads; a task ends by returning after vTaskDelete(NULL)
+inline BaseType_t xTaskCreate(TaskFunction_t task, const char *, uint32_t, void *param, UBaseType_t, TaskHandle_t *handle)
+{
+  std::thread worker(task, param);
+  if (handle != nullptr)
+    *handle = nullptr;
+  worker.detach();
+  return pdPASS;
+}
+
+inline void vTaskDelete(TaskHandle_t)
+{
+  // only self deletion (NULL) is used, the thread exits when the task function returns
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  return new __host_semaphore(true);
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+  return new __host_semaphore(false); // created empty, like FreeRTOS
+}
+
+inline void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+  delete sem;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, unsigned long wait_ticks)
+{
+  if (sem == nullptr)
+    return pdFALSE;
+
+  if (sem->is_mutex)
+  {
+    if (wait_ticks == portMAX_DELAY)
+    {
+      sem->lock.lock();
+      return pdTRUE;
+    }
+    return sem->lock.try_lock() ? pdTRUE : pdFALSE;
+  }
+
+  std::unique_lock<std::mutex> guard(sem->lock);
+  if (wait_ticks == portMAX_DELAY)
+    sem->signal.wait(guard, [sem]()
+                     { return sem->given; });
+  else
+    sem->signal.wait_for(guard, std::chrono::milliseconds(wait_ticks * portTICK_PERIOD_MS), [sem]()
+                         { return sem->given; });
+
+  if (!sem->given)
+    return pdFALSE;
+  sem->given = false;
+  return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+  if (sem == nullptr)
+    return pdFALSE;
+
+  if (sem->is_mutex)
+  {
+    sem->lock.unlock();
+    return pdTRUE;
+  }
+
+  // notified under the lock, so a waiter that deletes the semaphore right after waking
+  // cannot race with this call
+  std::lock_guard<std::mutex> guard(sem->lock);
+  sem->given = true;
+  sem->signal.notify_one();
+  return pdTRUE;
+}
+
+// there are no interrupts on the host, the ISR variants are the plain calls
+inline BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *higher_priority_task_woken)
+{
+  if (higher_priority_task_woken != nullptr)
+    *higher_priority_task_woken = pdFALSE;
+  return xSemaphoreGive(sem);
+}
+
+#define portYIELD_FROM_ISR(woken) ((void)(woken))
+
+// ---------------------------------------------------------------------------
+// String
+// ---------------------------------------------------------------------------
+
+class String
+{
+private:
+  std::string buffer;
+
+  static std::string fromUnsigned(unsigned long long value, unsigned char base)
+  {
+    if (base < 2 || base > 36)
+      base = 10;
+    char tmp[66];
+    char *p = tmp + sizeof(tmp) - 1;
+    *p = '\0';
+    do
+    {
+      unsigned digit = value % base;
+      *--p = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+      value /= base;
+    } while (value != 0);
+    return std::string(p);
+  }
+
+  static std::string fromSigned(long long value, unsigned char base)
+  {
+    if (value < 0 && base == 10)
+      return "-" + fromUnsigned((unsigned long long)(-(value + 1)) + 1, base);
+    return fromUnsigned((unsigned long long)value, base);
+  }
+
+  static std::string fromDouble(double value, unsigned int decimal_places)
+  {
+    char tmp[64];
+    snprintf(tmp, sizeof(tmp), "%.*f", (int)decimal_places, value);
+    return std::string(tmp);
+  }
+
+public:
+  String() {}
+  String(const char *cstr) : buffer(cstr ? cstr : "") {}
+  String(const char *cstr, unsigned int length) : buffer(cstr ? cstr : "", cstr ? length : 0) {}
+  String(const std::string &str) : buffer(str) {}
+  String(const String &str) = default;
+  String(String &&str) = default;
+  explicit String(char c) : buffer(1, c) {}
+  explicit String(unsigned char value, unsigned char base = 10) : buffer(fromUnsigned(value, base)) {}
+  explicit String(int value, unsigned char base = 10) : buffer(fromSigned(value, base)) {}
+  explicit String(unsigned int value, unsigned char base = 10) : buffer(fromUnsigned(value, base)) {}
+  explicit String(long value, unsigned char base = 10) : buffer(fromSigned(value, base)) {}
+  explicit String(unsigned long value, unsigned char base = 10) : buffer(fromUnsigned(value, base)) {}
+  explicit String(long long value, unsigned char base = 10) : buffer(fromSigned(value, base)) {}
+  explicit String(unsigned long long value, unsigned char base = 10) : buffer(fromUnsigned(value, base)) {}
+  explicit String(float value, unsigned int decimal_places = 2) : buffer(fromDouble(value, decimal_places)) {}
+  explicit String(double value, unsigned int decimal_places = 2) : buffer(fromDouble(value, decimal_places)) {}
+
+  String &operator=(const String &rhs) = default;
+  String &operator=(String &&rhs) = default;
+
+  unsigned int length() const { return (unsigned int)buffer.length(); }
+  const char *c_str() const { return buffer.c_str(); }
+  bool reserve(unsigned int size)
+  {
+    buffer.reserve(size);
+    return true;
+  }
+
+  char operator[](unsigned int index) const { return index < buffer.length() ? buffer[index] : '\0'; }
+  char &operator[](unsigned int index) { return buffer[index]; }
+  char charAt(unsigned int index) const { return operator[](index); }
+
+  String substring(unsigned int begin) const { return substring(begin, length()); }
+  String substring(unsigned int begin, unsigned int end) const
+  {
+    if (begin > end)
+      std::swap(begin, end);
+    if (begin >= buffer.length())
+      return String();
+    if (end > buffer.length())
+      end = buffer.length();
+    return String(buffer.substr(begin, end - begin));
+  }
+
+  int indexOf(char ch, unsigned int from = 0) const
+  {
+    size_t found = buffer.find(ch, from);
+    return found == std::string::npos ? -1 : (int)found;
+  }
+
+  long toInt() const { return strtol(buffer.c_str(), nullptr, 10); }
+  float toFloat() const { return strtof(buffer.c_str(), nullptr); }
+
+  String &operator+=(const String &rhs)
+  {
+    buffer += rhs.buffer;
+    return *this;
+  }
+  String &operator+=(const char *rhs)
+  {
+    buffer += rhs;
+    return *this;
+  }
+  String &operator+=(char rhs)
+  {
+    buffer += rhs;
+    return *this;
+  }
+
+  bool operator==(const String &rhs) const { return buffer == rhs.buffer; }
+  bool operator==(const char *rhs) const { return buffer == rhs; }
+  bool operator!=(const String &rhs) const { return buffer != rhs.buffer; }
+  bool operator<(const String &rhs) const { return buffer < rhs.buffer; }
+
+  friend String operator+(const String &lhs, const String &rhs) { return String(lhs.buffer + rhs.buffer); }
+  friend String operator+(const String &lhs, const char *rhs) { return String(lhs.buffer + rhs); }
+  friend String operator+(const char *lhs, const String &rhs) { return String(lhs + rhs.buffer); }
+};
+
+// ---------------------------------------------------------------------------
+// Print / Stream
+// ---------------------------------------------------------------------------
+
+class Print
+{
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t byte) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size--)
+    {
+      if (write(*buffer++))
+        n++;
+      else
+        break;
+    }
+    return n;
+  }
+  size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+  size_t print(const String &str) { return write((const uint8_t *)str.c_str(), str.length()); }
+  size_t println(const String &str) { return print(str) + write((const uint8_t *)"\r\n", 2); }
+
+  virtual void flush() {}
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  virtual size_t readBytes(char *buffer, size_t length)
+  {
+    size_t count = 0;
+    while (count < length)
+    {
+      int c = read();
+      if (c < 0)
+        break;
+      *buffer++ = (char)c;
+      count++;
+    }
+    return count;
+  }
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+};
+
+#endif
@@ -0,0 +1,8 @@
+// Host stand-in: BluetoothSerial is an ESP32-only transport, Packet_Device
+// only needs the Stream interface it derives from.
+#ifndef __PACKET_DEVICE_HOST_BLUETOOTH_SERIAL__
+#define __PACKET_DEVICE_HOST_BLUETOOTH_SERIAL__
+
+#include "Arduino.h"
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ *  File descriptor Stream for host builds
+ *  --------------------------------------
+ *  A Stream over POSIX descriptors: a pty, a pipe, a socket or a tty. Reads
+ *  go through a small buffer refilled with one read() call, so the per-byte
+ *  Stream::read() of the library costs no syscall per byte; available()
+ *  reports the buffered bytes plus what the kernel holds (FIONREAD) and
+ *  never blocks. Writes go straight to the descriptor, one write() per call.
+ */
+
+#ifndef __PACKET_DEVICE_HOST_FD_STREAM__
+#define __PACKET_DEVICE_HOST_FD_STREAM__
+
+#include "Arduino.h"
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#ifndef FD_STREAM_BUFFER_LEN
+#define FD_STREAM_BUFFER_LEN 4096
+#endif
+
+class FdStream : public Stream
+{
+private:
+  int read_fd;
+  int write_fd;
+  uint8_t rx_buff[FD_STREAM_BUFFER_LEN];
+  size_t rx_pos = 0;
+  size_t rx_len = 0;
+
+  // refills the buffer with what the kernel already holds, false when there is nothing
+  bool fill()
+  {
+    if (rx_pos < rx_len)
+      return true;
+    if (read_fd < 0 || pending() <= 0)
+      return false;
+    ssize_t got = ::read(read_fd, rx_buff, sizeof(rx_buff));
+    rx_pos = 0;
+    rx_len = got > 0 ? (size_t)got : 0;
+    return rx_len > 0;
+  }
+
+  int pending()
+  {
+    int bytes = 0;
+    return ioctl(read_fd, FIONREAD, &bytes) == 0 ? bytes : 0;
+  }
+
+public:
+  using Print::write;
+
+  FdStream(int fd) : read_fd(fd), write_fd(fd) {}
+  FdStream(int read_fd, int write_fd) : read_fd(read_fd), write_fd(write_fd) {} // a pipe pair, -1: that direction unused
+
+  int readFd() { return read_fd; }
+  int writeFd() { return write_fd; }
+
+  int available() override
+  {
+    size_t buffered = rx_len - rx_pos;
+    return read_fd < 0 ? (int)buffered : (int)buffered + pending();
+  }
+
+  int read() override
+  {
+    return fill() ? rx_buff[rx_pos++] : -1;
+  }
+
+  int peek() override
+  {
+    return fill() ? rx_buff[rx_pos] : -1;
+  }
+
+  size_t readBytes(char *buffer, size_t length) override
+  {
+    size_t count = 0;
+    while (count < length && fill())
+    {
+      size_t take = std::min(length - count, rx_len - rx_pos);
+      memcpy(buffer + count, rx_buff + rx_pos, take);
+      rx_pos += take;
+      count += take;
+    }
+    return count;
+  }
+
+  size_t write(uint8_t byte) override { return write(&byte, 1); }
+
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    size_t sent = 0;
+    while (write_fd >= 0 && sent < size)
+    {
+      ssize_t n = ::write(write_fd, buffer + sent, size - sent);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      sent += (size_t)n;
+    }
+    return sent;
+  }
+};
+
+#endif
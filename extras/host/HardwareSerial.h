@@ -0,0 +1,8 @@
+// Host stand-in: HardwareSerial is a board UART, Packet_Device only needs
+// the Stream interface it derives from.
+#ifndef __PACKET_DEVICE_HOST_HARDWARE_SERIAL__
+#define __PACKET_DEVICE_HOST_HARDWARE_SERIAL__
+
+#include "Arduino.h"
+
+#endif
@@ -0,0 +1,118 @@
+/*
+ *  In-memory Stream for host builds
+ *  --------------------------------
+ *  Bytes pushed with feed() are what the library reads (available/read/
+ *  readBytes), everything the library writes is appended to tx() so it can
+ *  be inspected or looped back into another DevicePacket.
+ */
+
+#ifndef __PACKET_DEVICE_HOST_MEMORY_STREAM__
+#define __PACKET_DEVICE_HOST_MEMORY_STREAM__
+
+#include "Arduino.h"
+#include <vector>
+#include <algorithm>
+
+class MemoryStream : public Stream
+{
+private:
+  std::vector<uint8_t> rx_buff;
+  size_t rx_pos = 0;
+  std::vector<uint8_t> tx_buff;
+  bool capture_tx = true;
+  size_t write_calls = 0;
+
+public:
+  using Print::write;
+
+  MemoryStream(bool capture = true) : capture_tx(capture) {}
+
+  // data for the library to read
+  void feed(const uint8_t *data, size_t len)
+  {
+    if (rx_pos == rx_buff.size())
+    {
+      rx_buff.clear();
+      rx_pos = 0;
+    }
+    rx_buff.insert(rx_buff.end(), data, data + len);
+  }
+
+  void feed(const std::vector<uint8_t> &data)
+  {
+    feed(data.data(), data.size());
+  }
+
+  // rewind the already fed data so it can be read again (benchmark loops)
+  void rewind()
+  {
+    rx_pos = 0;
+  }
+
+  std::vector<uint8_t> &tx()
+  {
+    return tx_buff;
+  }
+
+  void clearTx()
+  {
+    tx_buff.clear();
+  }
+
+  // number of write() calls so far, one per transfer on a real port
+  size_t writeCalls()
+  {
+    return write_calls;
+  }
+
+  // when disabled written bytes are counted but dropped (transmit benchmark sink)
+  void setCapture(bool state)
+  {
+    capture_tx = state;
+  }
+
+  int available() override
+  {
+    return (int)(rx_buff.size() - rx_pos);
+  }
+
+  int read() override
+  {
+    if (rx_pos >= rx_buff.size())
+      return -1;
+    return rx_buff[rx_pos++];
+  }
+
+  int peek() override
+  {
+    if (rx_pos >= rx_buff.size())
+      return -1;
+    return rx_buff[rx_pos];
+  }
+
+  size_t readBytes(char *buffer, size_t length) override
+  {
+    size_t count = std::min(length, rx_buff.size() - rx_pos);
+    memcpy(buffer, rx_buff.data() + rx_pos, count);
+    rx_pos += count;
+    return count;
+  }
+
+  size_t write(uint8_t byte) override
+  {
+    write_calls++;
+    if (capture_tx)
+      tx_buff.push_back(byte);
+    return 1;
+  }
+
+  size_t write(const uint8_t *buffer, size_t size) override
+  {
+    write_calls++;
+    if (capture_tx)
+      tx_buff.insert(tx_buff.end(), buffer, buffer + size);
+    return size;
+  }
+};
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ *  poll() reactor for host builds
+ *  ------------------------------
+ *  Sleeps in poll() on the descriptors of FdStreams (pty, pipe, socket) and
+ *  runs a DevicePacket's serviceReceive() only when its descriptor is
+ *  readable: a command is dispatched as soon as its bytes arrive, and an idle
+ *  receiver costs no CPU at all. poll() instead of epoll: a host tool watches
+ *  a handful of ports, and poll() also works on macOS.
+ *
+ *    PacketReactor reactor;
+ *    reactor.add(&port, &device); // port: FdStream, device: DevicePacket<R, N>
+ *    reactor.run();               // until reactor.stop() from any thread
+ */
+
+#ifndef __PACKET_DEVICE_HOST_PACKET_REACTOR__
+#define __PACKET_DEVICE_HOST_PACKET_REACTOR__
+
+#include "FdStream.h"
+#include <atomic>
+#include <fcntl.h>
+#include <functional>
+#include <poll.h>
+#include <vector>
+
+class PacketReactor
+{
+private:
+  struct watch_t
+  {
+    int fd;
+    std::function<void()> ready;
+  };
+
+  std::vector<watch_t> watches;
+  std::vector<pollfd> poll_fds; // [0] is the wake pipe, then one per watch
+  int wake_fds[2] = {-1, -1};
+  std::atomic<bool> running{false};
+
+public:
+  PacketReactor()
+  {
+    if (pipe(wake_fds) == 0)
+    {
+      fcntl(wake_fds[0], F_SETFL, O_NONBLOCK);
+      fcntl(wake_fds[1], F_SETFL, O_NONBLOCK);
+    }
+  }
+
+  ~PacketReactor()
+  {
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+  }
+
+  // ready() runs on the reactor thread whenever fd is readable; not while run() is active
+  void add(int fd, std::function<void()> ready)
+  {
+    watches.push_back({fd, std::move(ready)});
+  }
+
+  template <typename D>
+  void add(FdStream *stream, D *device)
+  {
+    add(stream->readFd(), [device]()
+        { device->serviceReceive(); });
+  }
+
+  // one poll() of at most timeout_ms (-1: no limit), the ready handlers run before it returns;
+  // returns the number of readable descriptors, -1 on error. A descriptor that hung up is dropped.
+  int runOnce(int timeout_ms)
+  {
+    poll_fds.resize(watches.size() + 1);
+    poll_fds[0] = {wake_fds[0], POLLIN, 0};
+    for (size_t i = 0; i < watches.size(); i++)
+      poll_fds[i + 1] = {watches[i].fd, POLLIN, 0};
+
+    int ready = poll(poll_fds.data(), poll_fds.size(), timeout_ms);
+    if (ready <= 0)
+      return ready < 0 && errno != EINTR ? -1 : 0;
+
+    if (poll_fds[0].revents & POLLIN)
+    {
+      uint8_t drain[16];
+      while (::read(wake_fds[0], drain, sizeof(drain)) > 0)
+        ;
+      ready--;
+    }
+
+    for (size_t i = watches.size(); i > 0; i--)
+    {
+      short events = poll_fds[i].revents;
+      if (events & POLLIN)
+        watches[i - 1].ready(); // the bytes that came with a hang up are still read
+      else if (events & (POLLHUP | POLLERR | POLLNVAL))
+        watches.erase(watches.begin() + (i - 1)); // closed by the other end, poll() would return at once forever
+    }
+    return ready;
+  }
+
+  void run()
+  {
+    running = true;
+    while (running && !watches.empty())
+    {
+      if (runOnce(-1) < 0)
+        break;
+    }
+    running = false;
+  }
+
+  // from any thread: run() returns after the handlers that are running now
+  void stop()
+  {
+    running = false;
+    wake();
+  }
+
+  void wake()
+  {
+    uint8_t byte = 1;
+    ssize_t sent = ::write(wake_fds[1], &byte, 1);
+    (void)sent; // a full pipe already wakes poll()
+  }
+};
+
+#endif
@@ -0,0 +1,87 @@
+/*
+ *  Bound receive targets for Packet_Device (bind<T>)
+ *  -------------------------------------------------
+ *  A PacketBound<T> is a user-owned value the dispatching task writes the
+ *  payload of a record into, without a handler in between. Any other task
+ *  or core reads it without a lock and always gets one whole value.
+ *
+ *  Double buffer with a sequence lock: version v lives in values[v & 1].
+ *  The writer fills the other buffer and then publishes it, so the buffer
+ *  of the published version is only overwritten by the write after next.
+ *  A reader copies the published buffer and retries only when two writes
+ *  started meanwhile. The writer never waits for readers.
+ *
+ *  There must be one writer, the task that runs processingQueueCommands().
+ */
+
+#ifndef __PACKET_BOUND__
+#define __PACKET_BOUND__
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+template <typename T>
+class PacketBound
+{
+  static_assert(std::is_trivially_copyable<T>::value, "PacketBound<T> needs a trivially copyable T, it is copied byte-wise from the frame");
+
+private:
+  T values[2];
+  std::atomic<uint32_t> version{0}; // the published value is values[version & 1]
+  std::atomic<uint32_t> writing{0}; // version being written, a copy of an older one than writing - 1 may be torn
+
+public:
+  PacketBound() : values{} {}
+  explicit PacketBound(const T &initial) : values{initial, initial} {}
+
+  PacketBound(const PacketBound &) = delete;
+  PacketBound &operator=(const PacketBound &) = delete;
+
+  // writer: the payload as it came in the frame (any alignment), sizeof(T) bytes
+  void store(const void *payload)
+  {
+    uint32_t next = version.load(std::memory_order_relaxed) + 1;
+    writing.store(next, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release); // readers that see the new bytes see writing first
+    memcpy(&values[next & 1], payload, sizeof(T));
+    version.store(next, std::memory_order_release);
+  }
+
+  void store(const T &value) { store((const void *)&value); }
+
+  // any task: a consistent copy of the latest value, returns its version (0: nothing received yet)
+  uint32_t load(T *out) const
+  {
+    for (;;)
+    {
+      uint32_t seen = version.load(std::memory_order_acquire);
+      memcpy(out, &values[seen & 1], sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if ((uint32_t)(writing.load(std::memory_order_relaxed) - seen) < 2)
+        return seen;
+    }
+  }
+
+  T load() const
+  {
+    T value;
+    load(&value);
+    return value;
+  }
+
+  // counts every received value, a reader compares it to the one it saw last
+  uint32_t getVersion() const { return version.load(std::memory_order_acquire); }
+
+  // copies the value only when it changed since *seen, and updates *seen
+  bool loadIfNew(T *out, uint32_t *seen) const
+  {
+    if (version.load(std::memory_order_acquire) == *seen)
+      return false;
+    *seen = load(out);
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ *  CRC-16/CCITT-FALSE engines for Packet_Device
+ *  --------------------------------------------
+ *  poly 0x1021, init 0x0000 (as used by the protocol), no reflection, xorout 0x0000.
+ *
+ *  Engines (all bit-exact, chosen at compile time with PACKET_CRC_ENGINE):
+ *    PACKET_CRC_ENGINE_TABLE  : one 256-entry table lookup per byte (512 B of tables)
+ *    PACKET_CRC_ENGINE_SLICE4 : slicing-by-4, 4 bytes per step (2 KB of tables)
+ *    PACKET_CRC_ENGINE_SLICE8 : slicing-by-8, 8 bytes per step (4 KB of tables)
+ *    PACKET_CRC_ENGINE_CLMUL  : carry-less multiply folding, 16 bytes per step (x86 with PCLMUL + SSSE3)
+ *
+ *  Default: CLMUL when the compiler targets it, slicing-by-4 on Arduino boards, slicing-by-8 otherwise.
+ */
+
+#ifndef __PACKET_CRC__
+#define __PACKET_CRC__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKET_CRC_ENGINE_TABLE 0
+#define PACKET_CRC_ENGINE_SLICE4 1
+#define PACKET_CRC_ENGINE_SLICE8 2
+#define PACKET_CRC_ENGINE_CLMUL 3
+
+#if defined(__PCLMUL__) && defined(__SSSE3__) && (defined(__x86_64__) || defined(__i386__))
+#define PACKET_CRC_HAS_CLMUL 1
+#include <immintrin.h>
+#else
+#define PACKET_CRC_HAS_CLMUL 0
+#endif
+
+#ifndef PACKET_CRC_ENGINE
+#if PACKET_CRC_HAS_CLMUL
+#define PACKET_CRC_ENGINE PACKET_CRC_ENGINE_CLMUL
+#elif defined(ARDUINO)
+#define PACKET_CRC_ENGINE PACKET_CRC_ENGINE_SLICE4
+#else
+#define PACKET_CRC_ENGINE PACKET_CRC_ENGINE_SLICE8
+#endif
+#endif
+
+#if PACKET_CRC_ENGINE == PACKET_CRC_ENGINE_CLMUL && !PACKET_CRC_HAS_CLMUL
+#error "PACKET_CRC_ENGINE_CLMUL needs an x86 target with PCLMUL and SSSE3 (-mpclmul -mssse3)"
+#endif
+
+#define CRC16_CCITT_POLY 0x1021
+
+// CRC 256-entry lookup table for CRC-16/CCITT-FALSE
+static const uint16_t crc16_ccitt_tbl[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0};
+
+// slice tables: crc16_ccitt_slices.tbl[k][b] is the CRC contribution of byte b followed by k zero bytes
+struct crc16_slice_tables
+{
+  uint16_t tbl[8][256];
+};
+
+constexpr crc16_slice_tables makeCRC16SliceTables()
+{
+  crc16_slice_tables slices = {};
+  for (uint16_t b = 0; b < 256; b++)
+  {
+    uint16_t crc = (uint16_t)(b << 8);
+    for (uint8_t bit = 0; bit < 8; bit++)
+      crc = (uint16_t)((crc & 0x8000) ? ((crc << 1) ^ CRC16_CCITT_POLY) : (crc << 1));
+    slices.tbl[0][b] = crc;
+  }
+  for (uint8_t k = 1; k < 8; k++)
+  {
+    for (uint16_t b = 0; b < 256; b++)
+    {
+      uint16_t prev = slices.tbl[k - 1][b];
+      slices.tbl[k][b] = (uint16_t)((prev << 8) ^ slices.tbl[0][prev >> 8]);
+    }
+  }
+  return slices;
+}
+
+static constexpr crc16_slice_tables crc16_ccitt_slices = makeCRC16SliceTables();
+
+static_assert(crc16_ccitt_slices.tbl[0][1] == 0x1021 && crc16_ccitt_slices.tbl[0][255] == 0x1EF0, "CRC slice table does not match crc16_ccitt_tbl");
+
+inline uint16_t crc16CCITTTable(const uint8_t *data, size_t len, uint16_t crc)
+{
+  for (size_t i = 0; i < len; ++i)
+  {
+    uint8_t idx = (uint8_t)((crc >> 8) ^ data[i]);
+    crc = (uint16_t)((crc << 8) ^ crc16_ccitt_tbl[idx]);
+  }
+  return crc;
+}
+
+inline uint16_t crc16CCITTSlice4(const uint8_t *data, size_t len, uint16_t crc)
+{
+  const uint16_t(*t)[256] = crc16_ccitt_slices.tbl;
+  while (len >= 4)
+  {
+    // the running crc folds into the first two bytes of the step
+    crc = (uint16_t)(t[3][(uint8_t)(data[0] ^ (crc >> 8))] ^ t[2][(uint8_t)(data[1] ^ crc)] ^
+                     t[1][data[2]] ^ t[0][data[3]]);
+    data += 4;
+    len -= 4;
+  }
+  return crc16CCITTTable(data, len, crc);
+}
+
+inline uint16_t crc16CCITTSlice8(const uint8_t *data, size_t len, uint16_t crc)
+{
+  const uint16_t(*t)[256] = crc16_ccitt_slices.tbl;
+  while (len >= 8)
+  {
+    crc = (uint16_t)(t[7][(uint8_t)(data[0] ^ (crc >> 8))] ^ t[6][(uint8_t)(data[1] ^ crc)] ^
+                     t[5][data[2]] ^ t[4][data[3]] ^ t[3][data[4]] ^ t[2][data[5]] ^
+                     t[1][data[6]] ^ t[0][data[7]]);
+    data += 8;
+    len -= 8;
+  }
+  return crc16CCITTTable(data, len, crc);
+}
+
+// x^n mod P, the folding constants of the carry-less multiply engine
+constexpr uint16_t crc16XPowMod(uint16_t n)
+{
+  uint32_t r = 1;
+  for (uint16_t i = 0; i < n; i++)
+  {
+    r <<= 1;
+    if (r & 0x10000)
+      r ^= 0x10000 | CRC16_CCITT_POLY;
+  }
+  return (uint16_t)r;
+}
+
+#if PACKET_CRC_HAS_CLMUL
+inline uint16_t crc16CCITTClmul(const uint8_t *data, size_t len, uint16_t crc)
+{
+  if (len < 32)
+    return crc16CCITTSlice8(data, len, crc);
+
+  // the data is MSB first: byte swap every 16-byte block so bit i holds the coefficient of x^i
+  const __m128i swap = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  // A * x^128 = A_hi * x^192 + A_lo * x^128, both reduced mod P so products stay below 80 bits
+  const __m128i fold = _mm_set_epi64x(crc16XPowMod(192), crc16XPowMod(128));
+
+  __m128i acc = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), swap);
+  acc = _mm_xor_si128(acc, _mm_set_epi64x((long long)((uint64_t)crc << 48), 0)); // initial crc into the first two bytes
+  data += 16;
+  len -= 16;
+
+  while (len >= 16)
+  {
+    __m128i block = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)data), swap);
+    __m128i hi = _mm_clmulepi64_si128(acc, fold, 0x11);
+    __m128i lo = _mm_clmulepi64_si128(acc, fold, 0x00);
+    acc = _mm_xor_si128(_mm_xor_si128(hi, lo), block);
+    data += 16;
+    len -= 16;
+  }
+
+  // acc is congruent to the message so far: its CRC with a zero register is the running crc
+  uint8_t folded[16];
+  _mm_storeu_si128((__m128i *)folded, _mm_shuffle_epi8(acc, swap));
+  crc = crc16CCITTSlice8(folded, sizeof(folded), 0x0000);
+  return crc16CCITTSlice8(data, len, crc);
+}
+#endif
+
+// CRC-16/CCITT-FALSE with the engine selected by PACKET_CRC_ENGINE
+inline uint16_t crc16CCITT(const uint8_t *data, size_t len, uint16_t crc = 0x0000)
+{
+#if PACKET_CRC_ENGINE == PACKET_CRC_ENGINE_CLMUL
+  return crc16CCITTClmul(data, len, crc);
+#elif PACKET_CRC_ENGINE == PACKET_CRC_ENGINE_SLICE8
+  return crc16CCITTSlice8(data, len, crc);
+#elif PACKET_CRC_ENGINE == PACKET_CRC_ENGINE_SLICE4
+  return crc16CCITTSlice4(data, len, crc);
+#else
+  return crc16CCITTTable(data, len, crc);
+#endif
+}
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ *  Delta codecs for periodic array telemetry (Packet_Device)
+ *  ---------------------------------------------------------
+ *  Every delta frame is encoded against the previous frame of the same
+ *  property, element by element:
+ *    DELTA_CODEC_XOR    : float/double, Gorilla style XOR of the raw bits
+ *                         '0'                        same value
+ *                         '10' + bits                inside the previous leading/trailing zero window
+ *                         '11' + lead(5) + len-1(6) + bits   new window
+ *    DELTA_CODEC_VARINT : integers, zig-zag of (value - previous) as a
+ *                         little-endian base-128 varint
+ *  Bits are packed MSB first. Values are read and written in the native
+ *  byte order, the same bytes a plain array record would carry.
+ */
+
+#ifndef __PACKET_DELTA__
+#define __PACKET_DELTA__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "./communication_flags.h"
+
+#define DELTA_CODEC_NONE 0
+#define DELTA_CODEC_XOR 1
+#define DELTA_CODEC_VARINT 2
+
+// codec used for an element type, DELTA_CODEC_NONE: always sent as a keyframe
+static inline uint8_t deltaCodec(uint8_t data_type, uint8_t type_size)
+{
+  if (type_size != 1 && type_size != 2 && type_size != 4 && type_size != 8)
+    return DELTA_CODEC_NONE;
+  if (data_type == DATA_TYPE_FLOAT || data_type == DATA_TYPE_DOUBLE)
+    return type_size >= 4 ? DELTA_CODEC_XOR : DELTA_CODEC_NONE;
+  if (data_type == DATA_TYPE_VOID || data_type == DATA_TYPE_STRING || data_type == DATA_TYPE_NULL)
+    return DELTA_CODEC_NONE;
+  return DELTA_CODEC_VARINT;
+}
+
+// fixed size copies, so the compiler turns them into single loads/stores (little-endian targets)
+static inline uint64_t deltaLoad(const uint8_t *values, uint16_t index, uint8_t type_size)
+{
+  const uint8_t *at = values + (size_t)index * type_size;
+  uint64_t value = 0;
+  if (type_size == 8)
+    memcpy(&value, at, 8);
+  else if (type_size == 4)
+    memcpy(&value, at, 4);
+  else if (type_size == 2)
+    memcpy(&value, at, 2);
+  else
+    value = *at;
+  return value;
+}
+
+static inline void deltaStore(uint8_t *values, uint16_t index, uint8_t type_size, uint64_t value)
+{
+  uint8_t *at = values + (size_t)index * type_size;
+  if (type_size == 8)
+    memcpy(at, &value, 8);
+  else if (type_size == 4)
+    memcpy(at, &value, 4);
+  else if (type_size == 2)
+    memcpy(at, &value, 2);
+  else
+    *at = (uint8_t)value;
+}
+
+// x != 0 for both
+static inline uint8_t deltaLeadingZeros(uint64_t x, uint8_t width)
+{
+#if defined(__GNUC__)
+  return (uint8_t)(__builtin_clzll(x) - (64 - width));
+#else
+  uint8_t n = 0;
+  for (uint64_t bit = (uint64_t)1 << (width - 1); !(x & bit); bit >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+static inline uint8_t deltaTrailingZeros(uint64_t x)
+{
+#if defined(__GNUC__)
+  return (uint8_t)__builtin_ctzll(x);
+#else
+  uint8_t n = 0;
+  for (; !(x & 1); x >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+struct DeltaBitWriter_t
+{
+  uint8_t *out;
+  uint16_t cap;
+  uint16_t len = 0;
+  uint64_t pending = 0;     // bits not written out yet, the newest in the low end
+  uint8_t pending_bits = 0; // always < 8 between calls
+  bool overflow = false;
+
+  void put(uint64_t value, uint8_t count)
+  {
+    if (count > 32)
+    {
+      put(value >> 32, count - 32);
+      count = 32;
+    }
+    pending = (pending << count) | (value & (((uint64_t)1 << count) - 1));
+    pending_bits += count;
+    while (pending_bits >= 8)
+    {
+      if (len >= cap)
+      {
+        overflow = true;
+        return;
+      }
+      pending_bits -= 8;
+      out[len++] = (uint8_t)(pending >> pending_bits);
+    }
+  }
+
+  // bytes used, the last one padded with zero bits; 0 on overflow
+  uint16_t finish()
+  {
+    if (pending_bits > 0 && !overflow)
+    {
+      if (len >= cap)
+        return 0;
+      out[len++] = (uint8_t)(pending << (8 - pending_bits));
+      pending_bits = 0;
+    }
+    return overflow ? 0 : len;
+  }
+};
+
+struct DeltaBitReader_t
+{
+  const uint8_t *in;
+  uint16_t len;
+  uint32_t bits = 0;
+  bool underflow = false;
+
+  uint64_t get(uint8_t count)
+  {
+    uint64_t value = 0;
+    while (count > 0)
+    {
+      uint32_t byte = bits >> 3;
+      if (byte >= len)
+      {
+        underflow = true;
+        return 0;
+      }
+      uint8_t room = 8 - (bits & 7);
+      uint8_t take = count < room ? count : room;
+      value = (value << take) | ((in[byte] >> (room - take)) & ((1u << take) - 1));
+      bits += take;
+      count -= take;
+    }
+    return value;
+  }
+};
+
+// encodes cur against prev into out, returns the encoded length or 0 when it needs more than cap bytes
+static inline uint16_t deltaEncode(uint8_t codec, uint8_t type_size, const uint8_t *prev, const uint8_t *cur, uint16_t count, uint8_t *out, uint16_t cap)
+{
+  uint8_t width = type_size * 8;
+  uint64_t mask = width == 64 ? ~(uint64_t)0 : (((uint64_t)1 << width) - 1);
+
+  if (codec == DELTA_CODEC_VARINT)
+  {
+    uint16_t len = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+      // the difference as a signed number of the element width, then zig-zag
+      uint64_t diff = (deltaLoad(cur, i, type_size) - deltaLoad(prev, i, type_size)) & mask;
+      int64_t delta = (int64_t)(diff << (64 - width)) >> (64 - width);
+      uint64_t zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+      do
+      {
+        if (len >= cap)
+          return 0;
+        uint8_t part = zigzag & 0x7F;
+        zigzag >>= 7;
+        out[len++] = zigzag ? (part | 0x80) : part;
+      } while (zigzag);
+    }
+    return len;
+  }
+
+  if (codec == DELTA_CODEC_XOR)
+  {
+    DeltaBitWriter_t writer = {out, cap};
+    uint8_t window_lead = 0xFF, window_trail = 0; // no window until the first '11'
+    for (uint16_t i = 0; i < count && !writer.overflow; i++)
+    {
+      uint64_t x = deltaLoad(cur, i, type_size) ^ deltaLoad(prev, i, type_size);
+      if (x == 0)
+      {
+        writer.put(0, 1);
+        continue;
+      }
+
+      uint8_t lead = deltaLeadingZeros(x, width);
+      uint8_t trail = deltaTrailingZeros(x);
+      if (window_lead != 0xFF && lead >= window_lead && trail >= window_trail)
+      {
+        writer.put(2, 2);
+        writer.put(x >> window_trail, width - window_lead - window_trail);
+        continue;
+      }
+
+      lead = lead > 31 ? 31 : lead;
+      uint8_t significant = width - lead - trail;
+      writer.put(3, 2);
+      writer.put(lead, 5);
+      writer.put(significant - 1, 6);
+      writer.put(x >> trail, significant);
+      window_lead = lead;
+      window_trail = trail;
+    }
+    return writer.finish();
+  }
+
+  return 0;
+}
+
+// applies an encoded frame to values (the previous frame in, the new one out); false when it is malformed
+static inline bool deltaDecode(uint8_t codec, uint8_t type_size, uint8_t *values, uint16_t count, const uint8_t *in, uint16_t in_len)
+{
+  uint8_t width = type_size * 8;
+
+  if (codec == DELTA_CODEC_VARINT)
+  {
+    uint16_t pos = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+      uint64_t zigzag = 0;
+      for (uint8_t shift = 0;; shift += 7)
+      {
+        if (pos >= in_len || shift > 63)
+          return false;
+        uint8_t part = in[pos++];
+        zigzag |= (uint64_t)(part & 0x7F) << shift;
+        if ((part & 0x80) == 0)
+          break;
+      }
+      int64_t delta = (int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1);
+      deltaStore(values, i, type_size, deltaLoad(values, i, type_size) + (uint64_t)delta);
+    }
+    return pos == in_len;
+  }
+
+  if (codec == DELTA_CODEC_XOR)
+  {
+    DeltaBitReader_t reader = {in, in_len};
+    uint8_t window_lead = 0xFF, window_trail = 0;
+    for (uint16_t i = 0; i < count; i++)
+    {
+      uint64_t x = 0;
+      if (reader.get(1) != 0)
+      {
+        if (reader.get(1) == 0)
+        {
+          if (window_lead == 0xFF)
+            return false; // '10' before any window
+          x = reader.get(width - window_lead - window_trail) << window_trail;
+        }
+        else
+        {
+          uint8_t lead = (uint8_t)reader.get(5);
+          uint8_t significant = (uint8_t)reader.get(6) + 1;
+          if (lead + significant > width)
+            return false;
+          window_lead = lead;
+          window_trail = width - lead - significant;
+          x = reader.get(significant) << window_trail;
+        }
+      }
+      if (reader.underflow)
+        return false;
+      deltaStore(values, i, type_size, deltaLoad(values, i, type_size) ^ x);
+    }
+    return true;
+  }
+
+  return false;
+}
+
+#endif
@@ -5,250 +5,525 @@
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::enableBulkRead(bool state)
 {
+  // setup-time call
   bulk_read_enabled = state;
+  if (state && rx_bulk == nullptr)
+    rx_bulk = new R[N];
+}
+
+template <typename R, uint16_t N>
+Handler_t<R> *DevicePacket<R, N>::addHandler(uint8_t kind, const String &name)
+{
+  // nullptr when the registry is full (raise PACKET_HANDLER_CAPACITY / PACKET_HANDLER_NAME_POOL)
+  return handlers.insert(channelKind(kind, handler_channel), name.c_str(), name.length());
+}
+
+template <typename R, uint16_t N>
+uint8_t DevicePacket<R, N>::channelKind(uint8_t kind, uint8_t channel)
+{
+  // every channel is a namespace of its own in the one registry
+  return kind | (channel << HANDLER_CHANNEL_SHIFT);
+}
+
+template <typename R, uint16_t N>
+uint8_t DevicePacket<R, N>::frameChannel(const R *data, uint16_t len, bool framed)
+{
+  // channel of a received frame from its prefix, 0 without one (not CRC checked yet); a
+  // delimited frame is a text command, even one that starts with the prefix bytes
+  if (framed && len > TRANSFER_DATA_CHANNEL_HEADER_LEN && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_CHANNEL_RESPNOSE)
+    return (uint8_t)data[2];
+  return 0;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::addChannel(uint8_t channel, uint8_t weight, uint8_t receiver_size)
+{
+  // setup-time call: no thread may be receiving or processing while a receive queue is added
+  if (channel >= PACKET_CHANNELS || weight == 0 || (channel == 0 && receiver_size > 0))
+    return false; // channel 0 already has commands_holder / the arena
+
+  channel_weights[channel] = weight;
+  if (channel > 0 && receiver_size > 0)
+  {
+    RxChannel_t<R, N> *queue = &rx_channels[channel];
+    delete[] queue->slots;
+    queue->size = (uint16_t)receiver_size + 1; // one slot stays free, head == tail is empty
+    queue->slots = new Command_t<R, N>[queue->size];
+    queue->head = queue->tail = 0;
+    rx_channel_queues = true;
+  }
+
+  this->tx_lock();
+  channel_mask |= (uint32_t)1 << channel;
+  bool queued = tx_queues[0].ring == nullptr || txAllocQueue(&tx_queues[channel]); // async TX already on: its own ring now
+  this->tx_unlock();
+  return queued;
+}
+
+template <typename R, uint16_t N>
+PacketChannel<R, N> DevicePacket<R, N>::channel(uint8_t channel)
+{
+  return PacketChannel<R, N>(this, channel < PACKET_CHANNELS ? channel : 0);
+}
+
+template <typename R, uint16_t N>
+PacketReply<R, N> DevicePacket<R, N>::reply()
+{
+  // inside a handler: answers go back on the channel of the frame being dispatched, with its id
+  return PacketReply<R, N>(this, rx_reply_channel, rx_sequence);
+}
+
+template <typename R, uint16_t N>
+PacketReply<R, N> DevicePacket<R, N>::sequenced(uint16_t sequence, uint8_t channel)
+{
+  return PacketReply<R, N>(this, channel < PACKET_CHANNELS ? channel : 0, sequence);
+}
+
+template <typename R, uint16_t N>
+uint16_t DevicePacket<R, N>::nextSequence()
+{
+  // ids for the requests of any thread, wrapping after 65536 requests in flight
+  return tx_sequence.fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::rxSequence(uint16_t *sequence)
+{
+  // inside a handler: the id of the frame being dispatched, false when it had none
+  if (rx_sequence == PACKET_NO_SEQUENCE)
+    return false;
+  *sequence = (uint16_t)rx_sequence;
+  return true;
 }
 
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::setReceiver(std::map<String, void (*)(String, String)> receivers)
 {
-  insert_pram_data_cmnds = receivers;
+  handlers.clear(HANDLER_TEXT_PRAM_DATA);
+  for (auto &receiver : receivers)
+    onReceive(receiver.first, receiver.second);
 }
 
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::setReceiver(std::map<String, void (*)(String)> receivers, bool prams)
 {
-  if (prams)
-    get_pram_cmnds = receivers;
-  else
-    insert_data_cmnds = receivers;
+  handlers.clear(prams ? HANDLER_TEXT_PRAM : HANDLER_TEXT_DATA);
+  for (auto &receiver : receivers)
+    onReceive(receiver.first, receiver.second, prams);
 }
 
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::setReceiver(std::map<String, void (*)()> receivers)
 {
-  get_process_cmnds = receivers;
+  handlers.clear(HANDLER_PROCESS);
+  for (auto &receiver : receivers)
+    onReceive(receiver.first, receiver.second);
 }
 
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::setReceiver(std::map<String, void (*)(R *, uint8_t, uint16_t, uint16_t)> receivers)
 {
-  get_response_buff = receivers;
+  handlers.clear(HANDLER_BUFFER);
+  for (auto &receiver : receivers)
+    onReceive(receiver.first, receiver.second);
 }
 
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::onReceive(String name, void (*fun)(String, String))
 {
-  insert_pram_data_cmnds[name] = fun;
+  Handler_t<R> *handler = addHandler(HANDLER_TEXT_PRAM_DATA, name);
+  if (handler)
+  {
+    handler->pram_data = fun;
+    handler->text_views = false;
+  }
 }
 
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::onReceive(String name, void (*fun)(String), bool prams)
 {
-  if (prams)
-    get_pram_cmnds[name] = fun;
-  else
-    insert_data_cmnds[name] = fun;
+  Handler_t<R> *handler = addHandler(prams ? HANDLER_TEXT_PRAM : HANDLER_TEXT_DATA, name);
+  if (handler)
+  {
+    handler->data = fun;
+    handler->text_views = false;
+  }
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::onReceive(String name, void (*fun)(TextView_t, TextView_t))
+{
+  Handler_t<R> *handler = addHandler(HANDLER_TEXT_PRAM_DATA, name);
+  if (handler)
+  {
+    handler->pram_data_view = fun;
+    handler->text_views = true;
+  }
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::onReceive(String name, void (*fun)(TextView_t), bool prams)
+{
+  Handler_t<R> *handler = addHandler(prams ? HANDLER_TEXT_PRAM : HANDLER_TEXT_DATA, name);
+  if (handler)
+  {
+    handler->data_view = fun;
+    handler->text_views = true;
+  }
 }
 
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::onReceive(String name, void (*fun)())
 {
-  get_process_cmnds[name] = fun;
+  Handler_t<R> *handler = addHandler(HANDLER_PROCESS, name);
+  if (handler)
+    handler->process = fun;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::onStream(String name, void (*chunk)(R *, uint16_t, uint32_t), void (*end)(bool), bool (*begin)(uint8_t, uint16_t, uint16_t))
+{
+  Handler_t<R> *handler = addHandler(HANDLER_STREAM, name);
+  if (handler == nullptr)
+    return;
+  handler->stream_begin = begin;
+  handler->stream_chunk = chunk;
+  handler->stream_end = end;
+  stream_enabled = true;
 }
 
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::onReceive(String name, void (*fun)(R *, uint8_t, uint16_t, uint16_t))
 {
-  get_response_buff[name] = fun;
+  Handler_t<R> *handler = addHandler(HANDLER_BUFFER, name);
+  if (handler)
+  {
+    handler->typed = nullptr;
+    handler->any = nullptr;
+    handler->buff = fun;
+  }
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::bufferDispatch(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t len)
+{
+  if (handler->typed)
+    handler->typed(handler, buffer, type, type_size, len);
+  else if (handler->any)
+    handler->any(buffer, type, type_size, len);
+  else if (handler->buff)
+    handler->buff(buffer, type, type_size, len); // Call the function if the key is found
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::commandProcess(R *data, uint16_t len)
+void DevicePacket<R, N>::commandProcess(R *data, uint16_t len, uint16_t crc_residue, bool framed)
 {
+  // crc_residue is the running CRC over the whole frame (CRC bytes included), computed while
+  // the bytes arrived: it is 0 exactly when the trailing CRC matches, same as verifyCRC();
+  // framed: it arrived behind a packet signeture, not up to a delimiter
 
   // Serial.println("Receive:" + String(len));
   // Serial.flush();
 
-  if (len >= 6 && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_TEXT_RESPNOSE)
+  uint8_t channel = frameChannel(data, len, framed);
+  if (channel != 0)
+  {
+    // channel prefix: the record after it is dispatched to that channel's handlers
+    if (channel >= PACKET_CHANNELS || crc_residue != 0)
+    {
+      statAdd(crc_residue != 0 ? stats.rx_crc_errors : stats.rx_unhandled);
+      return;
+    }
+    data += TRANSFER_DATA_CHANNEL_HEADER_LEN;
+    len -= TRANSFER_DATA_CHANNEL_HEADER_LEN;
+  }
+
+  rx_reply_channel = channel;
+  if (framed && len > TRANSFER_DATA_SEQUENCE_HEADER_LEN && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_SEQUENCE_RESPNOSE)
+  {
+    // sequence prefix: a request (or a reply) the peer matches by its id, reply() echoes it
+    if (crc_residue != 0)
+    {
+      statAdd(stats.rx_crc_errors);
+      return;
+    }
+    rx_sequence = (((uint8_t)data[2] << 8) | (uint8_t)data[3]) & 0xFFFF;
+    data += TRANSFER_DATA_SEQUENCE_HEADER_LEN;
+    len -= TRANSFER_DATA_SEQUENCE_HEADER_LEN;
+  }
+
+  if (len >= 6 && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_BATCH_RESPNOSE)
   {
-    // TRANSFER_DATA_TEXT_HEADER_LEN+CRC_SIZE(2 bytes)=6
-    // with crc
-    if (verifyCRC<uint8_t>((uint8_t *)data, len))
+    // TRANSFER_DATA_BATCH_HEADER_LEN+CRC_SIZE(2 bytes)=6
+    // one CRC for all the records packed in the frame
+    if (crc_residue == 0)
     {
       len -= 2; // reduce crc
-      uint8_t data_len_msb = data[2];
-      uint8_t data_len_lsb = data[3];
-      uint16_t data_len = ((data_len_msb << 8) | data_len_lsb) & 0xFFFF;
-      if (data_len + TRANSFER_DATA_TEXT_HEADER_LEN <= len)
+      uint16_t record_count = ((data[2] << 8) | data[3]) & 0xFFFF;
+      uint16_t offset = TRANSFER_DATA_BATCH_HEADER_LEN;
+      for (uint16_t i = 0; i < record_count && offset < len; i++)
       {
-        String text = String(data + TRANSFER_DATA_TEXT_HEADER_LEN, data_len);
-        if (get_process_cmnds.find(text) != get_process_cmnds.end())
-        {
-          // Call the function if the key is found
-          get_process_cmnds[text]();
-        }
+        uint16_t record_len = bufferRecordProcess(data + offset, len - offset, channel);
+        if (record_len == 0)
+          break; // malformed, the following records cannot be located
+        offset += record_len;
       }
     }
+    else
+      statAdd(stats.rx_crc_errors);
   }
-  else if (len >= 8 && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_PARAM_RESPNOSE)
+  else if ((len >= 6 && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_TEXT_RESPNOSE) ||
+           (len >= 8 && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_PARAM_RESPNOSE) ||
+           (len >= 9 && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_ARRY_RESPNOSE) ||
+           (len >= 13 && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_DELTA_ARRY_RESPNOSE))
   {
-    // TRANSFER_DATA_PARAMS_HEADER_LEN+CRC_SIZE(2 bytes)=8
-    //  Serial.println("Prams:"+String(len)+",type:"+String((uint8_t)data[4]));
-    if (verifyCRC<uint8_t>((uint8_t *)data, len))
+    // header + CRC_SIZE(2 bytes): text 6, params 8, array 9, delta array 13
+    if (crc_residue == 0)
+      bufferRecordProcess(data, len - 2, channel); // with crc reduced
+    else
+      statAdd(stats.rx_crc_errors);
+  }
+  else if (channel == 0)
+  {
+    textCommandProcess((char *)data, len); // text commands only exist on channel 0
+  }
+  rx_sequence = PACKET_NO_SEQUENCE;
+}
+
+template <typename R, uint16_t N>
+uint16_t DevicePacket<R, N>::bufferRecordProcess(R *data, uint16_t len, uint8_t channel)
+{
+  // one text/params/array record without its CRC, either a whole frame or one record of a
+  // batch frame; returns the record length, 0 when it is malformed
+  if (len < TRANSFER_DATA_TEXT_HEADER_LEN || data[0] != TRANSFER_DATA_BUFFER_SIG)
+    return 0;
+
+  if (data[1] == BUFFER_TEXT_RESPNOSE)
+  {
+    uint8_t data_len_msb = data[2];
+    uint8_t data_len_lsb = data[3];
+    uint16_t data_len = ((data_len_msb << 8) | data_len_lsb) & 0xFFFF;
+    if (data_len + TRANSFER_DATA_TEXT_HEADER_LEN > len)
+      return 0;
+
+    Handler_t<R> *handler = handlers.find(channelKind(HANDLER_PROCESS, channel), (const char *)(data + TRANSFER_DATA_TEXT_HEADER_LEN), data_len);
+    if (handler && handler->process)
     {
-      len -= 2; // reduce crc
-      uint8_t data_type = data[2];
-      uint8_t pram_len = data[3];
-      uint8_t data_len_msb = data[4];
-      uint8_t data_len_lsb = data[5];
-      uint16_t data_len = ((data_len_msb << 8) | data_len_lsb) & 0xFFFF;
+      // Call the function if the key is found
+      traceHandler((const char *)(data + TRANSFER_DATA_TEXT_HEADER_LEN), data_len);
+      handler->process();
+    }
+    else if (channel != 0 || !statsCommand((const char *)(data + TRANSFER_DATA_TEXT_HEADER_LEN), data_len))
+      statAdd(stats.rx_unhandled);
+    return TRANSFER_DATA_TEXT_HEADER_LEN + data_len;
+  }
+  else if (data[1] == BUFFER_PARAM_RESPNOSE && len >= TRANSFER_DATA_PARAMS_HEADER_LEN)
+  {
+    //  Serial.println("Prams:"+String(len)+",type:"+String((uint8_t)data[4]));
+    uint8_t data_type = data[2];
+    uint8_t pram_len = data[3];
+    uint8_t data_len_msb = data[4];
+    uint8_t data_len_lsb = data[5];
+    uint16_t data_len = ((data_len_msb << 8) | data_len_lsb) & 0xFFFF;
 
-      // Serial.println("data_type:"+String(data_type)+",pram_len:"+String(pram_len)+",data_len:"+String(data_len));
+    // Serial.println("data_type:"+String(data_type)+",pram_len:"+String(pram_len)+",data_len:"+String(data_len));
 
-      if (pram_len + data_len + TRANSFER_DATA_PARAMS_HEADER_LEN <= len)
-      {
-        String param = String(data + TRANSFER_DATA_PARAMS_HEADER_LEN, pram_len);
+    if (pram_len + data_len + TRANSFER_DATA_PARAMS_HEADER_LEN > len)
+      return 0;
 
-        // Serial.println("Data Pram-->"+param);
+    // single lookup, the param name is read in place from the frame
+    Handler_t<R> *handler = handlers.find(channelKind(HANDLER_BUFFER, channel), (const char *)(data + TRANSFER_DATA_PARAMS_HEADER_LEN), pram_len);
 
-        // for(uint8_t i=5 + pram_len;i<len;i++){
-        //   Serial.print(" "+String(data[i],HEX));
-        // }
-        // Serial.println();
+    // for(uint8_t i=5 + pram_len;i<len;i++){
+    //   Serial.print(" "+String(data[i],HEX));
+    // }
+    // Serial.println();
 
-        if (any_response_buff.find(param) != any_response_buff.end())
-        {
-          any_response_buff[param](data + (TRANSFER_DATA_PARAMS_HEADER_LEN + pram_len), data_type, data_len, 1); // single data
-        }
-        else if (get_response_buff.find(param) != get_response_buff.end())
-        {
-          // Call the function if the key is found
-          get_response_buff[param](data + (TRANSFER_DATA_PARAMS_HEADER_LEN + pram_len), data_type, data_len, 1); // single data
-        }
-      }
+    if (handler)
+    {
+      traceHandler((const char *)(data + TRANSFER_DATA_PARAMS_HEADER_LEN), pram_len);
+      bufferDispatch(handler, data + (TRANSFER_DATA_PARAMS_HEADER_LEN + pram_len), data_type, data_len, 1); // single data
     }
+    else
+      statAdd(stats.rx_unhandled);
+    return TRANSFER_DATA_PARAMS_HEADER_LEN + pram_len + data_len;
   }
-  else if (len >= 9 && data[0] == TRANSFER_DATA_BUFFER_SIG && data[1] == BUFFER_ARRY_RESPNOSE)
+  else if (data[1] == BUFFER_ARRY_RESPNOSE && len >= TRANSFER_DATA_ARRAY_HEADER_LEN)
   {
-    // TRANSFER_DATA_ARRAY_HEADER_LEN+CRC_SIZE(2 bytes)=9
     //  Serial.println("Array:"+String(len));
-    if (verifyCRC<uint8_t>((uint8_t *)data, len))
+    uint8_t data_type = data[2];
+    uint8_t type_size = data[3];
+    uint8_t pram_len = data[4];
+    uint8_t data_size_msb = data[5];
+    uint8_t data_size_lsb = data[6];
+    uint16_t data_size = ((data_size_msb << 8) | data_size_lsb) & 0xFFFF;
+    uint32_t data_len = (uint32_t)type_size * data_size;
+    if (pram_len + data_len + TRANSFER_DATA_ARRAY_HEADER_LEN > len)
+      return 0;
+
+    Handler_t<R> *handler = handlers.find(channelKind(HANDLER_BUFFER, channel), (const char *)(data + TRANSFER_DATA_ARRAY_HEADER_LEN), pram_len);
+    if (handler)
     {
-      len -= 2; // reduce crc
-      uint8_t data_type = data[2];
-      uint8_t type_size = data[3];
-      uint8_t pram_len = data[4];
-      uint8_t data_size_msb = data[5];
-      uint8_t data_size_lsb = data[6];
-      uint16_t data_size = ((data_size_msb << 8) | data_size_lsb) & 0xFFFF;
-      uint16_t data_len = type_size * data_size;
-      if (pram_len + data_len + TRANSFER_DATA_ARRAY_HEADER_LEN <= len)
-      {
-        String param = String(data + TRANSFER_DATA_ARRAY_HEADER_LEN, pram_len);
-        // Serial.println(param);
-        // Serial.println(get_response_buff.size());
-        if (any_response_buff.find(param) != any_response_buff.end())
-        {
-          any_response_buff[param](data + (TRANSFER_DATA_ARRAY_HEADER_LEN + pram_len), data_type, type_size, data_size);
-        }
-        else if (get_response_buff.find(param) != get_response_buff.end())
-        {
-          // Call the function if the key is found
-          get_response_buff[param](data + (TRANSFER_DATA_ARRAY_HEADER_LEN + pram_len), data_type, type_size, data_size);
-        }
-      }
+      traceHandler((const char *)(data + TRANSFER_DATA_ARRAY_HEADER_LEN), pram_len);
+      bufferDispatch(handler, data + (TRANSFER_DATA_ARRAY_HEADER_LEN + pram_len), data_type, type_size, data_size);
     }
+    else
+      statAdd(stats.rx_unhandled);
+    return TRANSFER_DATA_ARRAY_HEADER_LEN + pram_len + data_len;
   }
-  else
+  else if (data[1] == BUFFER_DELTA_ARRY_RESPNOSE && len >= TRANSFER_DATA_DELTA_HEADER_LEN)
   {
-    String cmd = String(data, len);
-    uint16_t cmd_len = cmd.length();
-
-    // Serial.println(cmd);
-    // Serial.flush();
+    // an array coded against the previous frame of the same property, handlers get the whole array
+    uint8_t data_type = data[2];
+    uint8_t type_size = data[3];
+    uint8_t pram_len = data[4];
+    uint16_t data_size = (((uint8_t)data[5] << 8) | (uint8_t)data[6]) & 0xFFFF;
+    uint8_t flags = data[7];
+    uint8_t sequence = data[8];
+    uint16_t payload_len = (((uint8_t)data[9] << 8) | (uint8_t)data[10]) & 0xFFFF;
+    if (pram_len + payload_len + TRANSFER_DATA_DELTA_HEADER_LEN > len)
+      return 0;
 
-    if (cmd_len > 6 && cmd[3] == ':' && cmd[5] == '=')
+    const char *name = (const char *)(data + TRANSFER_DATA_DELTA_HEADER_LEN);
+    Handler_t<R> *handler = handlers.find(channelKind(HANDLER_BUFFER, channel), name, pram_len);
+    if (handler && (handler->typed || handler->any || handler->buff))
     {
-      // for COMMAND:PRAM=DATA
-      // if value setting command happen
-      String f_cmd = cmd.substring(0, 3);
-      // Check if the key exists in the map
-      if (insert_pram_data_cmnds.find(f_cmd) != insert_pram_data_cmnds.end())
-      {
+      // the frame is only decoded (and the state kept) for properties someone listens to
+      traceHandler(name, pram_len); // decoding the delta counts as handler time
+      R *values = (R *)deltaReceive(channel, name, pram_len, data_type, type_size, data_size, flags, sequence, (const uint8_t *)(name + pram_len), payload_len);
+      if (values)
+        bufferDispatch(handler, values, data_type, type_size, data_size);
+    }
+    else
+      statAdd(stats.rx_unhandled);
+    return TRANSFER_DATA_DELTA_HEADER_LEN + pram_len + payload_len;
+  }
+  return 0;
+}
 
-        String m_cmd = cmd.substring(4, 5);
-        String s_cmd = cmd.substring(6);
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::textCommandProcess(char *cmd, uint16_t cmd_len)
+{
+  // zero-copy parser: tokens are views into the frame, NUL terminated in place
+  // (cmd[cmd_len] is always inside the slot: it held the delimiter or is below N)
 
-        // Call the function if the key is found
-        insert_pram_data_cmnds[f_cmd](m_cmd, s_cmd);
-      }
-    }
-    else if (cmd_len > 4 && cmd[3] == '=')
-    {
-      // for COMMAND=DATA
-      // if value setting command happen
-      String f_cmd = cmd.substring(0, 3);
+  // Serial.println(cmd);
+  // Serial.flush();
 
-      if (insert_data_cmnds.find(f_cmd) != insert_data_cmnds.end())
-      {
+  if (framing_caps != PACKET_FRAMING_NIBBLE && cmd[0] == '#' && framingCommand(cmd, cmd_len))
+    return; // handshake, never reaches the handlers
 
-        String s_cmd = cmd.substring(4);
-        // Call the function if the key is found
-        insert_data_cmnds[f_cmd](s_cmd);
-      }
+  if (cmd_len > 6 && cmd[3] == ':' && cmd[5] == '=')
+  {
+    // for COMMAND:PRAM=DATA
+    // if value setting command happen
+    // Check if the key exists in the registry
+    Handler_t<R> *handler = handlers.find(HANDLER_TEXT_PRAM_DATA, cmd, 3);
+    if (handler && handler->pram_data)
+    {
+      traceHandler(cmd, 3);
+      cmd[5] = '\0';
+      cmd[cmd_len] = '\0';
+      TextView_t m_cmd = {cmd + 4, 1};
+      TextView_t s_cmd = {cmd + 6, (uint16_t)(cmd_len - 6)};
+
+      // Call the function if the key is found
+      if (handler->text_views)
+        handler->pram_data_view(m_cmd, s_cmd);
+      else
+        handler->pram_data(m_cmd.toString(), s_cmd.toString()); // String signature adapter
     }
-    else if (cmd_len > 4 && cmd[3] == ':')
+    else
+      statAdd(stats.rx_unhandled);
+  }
+  else if (cmd_len > 4 && (cmd[3] == '=' || cmd[3] == ':'))
+  {
+    // for COMMAND=DATA or COMMAND:PRAM
+    // if value setting command happen
+    Handler_t<R> *handler = handlers.find(cmd[3] == '=' ? HANDLER_TEXT_DATA : HANDLER_TEXT_PRAM, cmd, 3);
+    if (handler && handler->data)
     {
-      // for COMMAND:PRAM
-      // if value setting command happen
-      String f_cmd = cmd.substring(0, 3);
-
-      if (get_pram_cmnds.find(f_cmd) != get_pram_cmnds.end())
-      {
-        String s_cmd = cmd.substring(4);
-        // Call the function if the key is found
-        get_pram_cmnds[f_cmd](s_cmd);
-      }
+      traceHandler(cmd, 3);
+      cmd[cmd_len] = '\0';
+      TextView_t s_cmd = {cmd + 4, (uint16_t)(cmd_len - 4)};
+
+      // Call the function if the key is found
+      if (handler->text_views)
+        handler->data_view(s_cmd);
+      else
+        handler->data(s_cmd.toString()); // String signature adapter
     }
     else
+      statAdd(stats.rx_unhandled);
+  }
+  else
+  {
+    Handler_t<R> *handler = handlers.find(HANDLER_PROCESS, cmd, cmd_len);
+    if (handler && handler->process)
     {
-      if (get_process_cmnds.find(cmd) != get_process_cmnds.end())
-      {
-        // Call the function if the key is found
-        get_process_cmnds[cmd]();
-      }
+      // Call the function if the key is found
+      traceHandler(cmd, cmd_len);
+      handler->process();
     }
+    else if (!statsCommand(cmd, cmd_len))
+      statAdd(stats.rx_unhandled);
   }
 }
 
 template <typename R, uint16_t N>
-bool DevicePacket<R, N>::queueCheck()
+uint16_t DevicePacket<R, N>::nextSlot(uint16_t index)
 {
-  if (commpleted_cmd_read)
+  index++;
+  return index >= commands_holder_size ? 0 : index;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::queueFull()
+{
+  // the next frame may be for any channel: stop receiving while one of the queues is full
+  if (rx_channel_queues)
+  {
+    for (uint8_t i = 1; i < PACKET_CHANNELS; i++)
+    {
+      RxChannel_t<R, N> *queue = &rx_channels[i];
+      if (queue->slots && (queue->head.load(std::memory_order_relaxed) + 1) % queue->size == queue->tail.load(std::memory_order_acquire))
+        return true;
+    }
+  }
+
+  if (rx_arena)
   {
-    this->receiver_lock();
-    current_commands_length = 0; // it is restriction to write a variable from two different thread
-    commpleted_cmd_read = false;
-    packet_length = 0;
-    this->receiver_unlock();
+    uint32_t at;
+    return !arenaFit(arenaRecordSize(N - 1), &at); // the next frame may be as long as a slot
   }
 
-  // if the queue is full then we will not process any receving buffer untill the queue read
-  if (current_commands_length >= max_command_queue_length)
+  // acquire: the processing thread must be done with a slot before it is reused
+  return nextSlot(rx_head.load(std::memory_order_relaxed)) == rx_tail.load(std::memory_order_acquire);
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::queueCheck()
+{
+  // if the queue is full then we will not process any receving buffer untill a slot is released,
+  // RX_QUEUE_DROP keeps receiving and discards the frames that find no room instead
+  if (rx_policy != RX_QUEUE_DROP && queueFull())
     return false;
 
   // full packet receive timeout check
-  if (packet_timeout_at != 0 && packet_length != 0 && millis() > packet_timeout_at)
+  if (packet_timeout_at != 0 && stream_length != 0 && millis() > packet_timeout_at)
   {
-
-    Command_t<R, N> *cmd = &(commands_holder[current_commands_length]);
-
-    this->receiver_lock();
-    // Serial.println("timeout:"+String(cmd->len)+",t:"+String( millis()-packet_timeout_at));
-    cmd->len = 0;
+    statAdd(stats.rx_timeouts);
+    streamEnd(false); // the rest of a streamed frame never came
+  }
+  else if (packet_timeout_at != 0 && packet_length != 0 && millis() > packet_timeout_at)
+  {
+    // Serial.println("timeout:"+String(rx_frame->len)+",t:"+String( millis()-packet_timeout_at));
+    statAdd(stats.rx_timeouts);
+    rx_frame->len = 0;
+    rx_trace_open = false;
+    resetRxCRC();
     packet_length = 0;     // reset packet receiveing
     packet_timeout_at = 0; // reset the time checker, and
-    this->receiver_unlock();
   }
 
   return true;
@@ -260,22 +535,36 @@ bool DevicePacket<R, N>::processEachData(R inchar)
   // TODO: remove debug print
   // Serial.printf("%c: %d or %02X \r\n",inchar, inchar,inchar);
 
-  Command_t<R, N> *cmd = &(commands_holder[current_commands_length]);
+  if (stream_length != 0)
+  {
+    processStreamBytes(&inchar, 1);
+    return true;
+  }
+  if (trace_enabled && !rx_trace_open)
+    traceFirst();
+
+  // the in-flight slot is owned by the receiving thread until it is published
+  Command_t<R, N> *cmd = rx_frame;
 
   // store data
-  this->receiver_lock();
   cmd->data[cmd->len] = inchar;
   cmd->len++;
 
   if (cmd->len >= N)
   {
+    statAdd(stats.rx_oversize); // no delimiter within N bytes
     cmd->len = 0;
+    resetRxCRC();
+    rx_trace_open = false;
   }
-  this->receiver_unlock();
 
   if (packet_length != 0)
   {
-    // packet receiving mode
+    // packet receiving mode: every byte of the packet is covered by its CRC,
+    // fed in small batches so the fast CRC engine is used, the rest is added on publish
+    if (cmd->len - rx_crc_len >= PACKET_RX_CRC_BATCH)
+      updateRxCRC(cmd, cmd->len);
+
     if (cmd->len == packet_length)
     {
       // Serial.println("Data:"+String(cmd->data[0],HEX));
@@ -285,46 +574,31 @@ bool DevicePacket<R, N>::processEachData(R inchar)
       // packet is ready for process
       packet_timeout_at = 0; // reset timeout
 
-      this->receiver_lock();
-      cmd->completed = true;     // mark it as completed
-      current_commands_length++; // store for the next
-      this->receiver_unlock();
-
-      if (current_commands_length >= max_command_queue_length)
-      {
-        return false; // if the queue if full then not process any more receive
-      }
+      return publishFrame(true);
     }
   }
   else
   {
-    // non macket mode
+    // non macket mode: the CRC trails delimeter_len bytes behind, they may turn out to be the delimiter
+    if (cmd->len >= rx_crc_len + delimeter_len + PACKET_RX_CRC_BATCH)
+      updateRxCRC(cmd, cmd->len - delimeter_len);
+
+    uint16_t packet_size = 0;
     if (cmd->len >= PACKET_SIGNETURE_LEN)
     {
       size_t offset = cmd->len - PACKET_SIGNETURE_LEN;
 
       // Serial.println("offset:"+String(offset)+",len:"+String(cmd->len)+",l:"+String(PACKET_SIGNETURE_LEN));
-      uint16_t packet_size = getPacketLength((uint8_t *)(cmd->data + offset));
-
-      if (packet_size != 0)
-      {
-        // valid match
-        this->receiver_lock();
-        cmd->len = 0; // reset buffer index for making ready to receive actual buffer
-        this->receiver_unlock();
-
-        if (packet_size < N)
-        {
-          // Serial.println("Received:"+String(packet_size)+",l:"+String(current_commands_length));
-          // packet size is valid
-          packet_length = packet_size; // update packet size
-          // register current time to register timeout of receving data
-          packet_timeout_at = millis() + (packet_size * 2) + 100;
-          // minimum baud rate could 4800bps that mean 600bytes for second, considering 2ms for each of byte, and some extra delay (100ms)
-        }
+      packet_size = getPacketLength((uint8_t *)(cmd->data + offset));
+    }
+    if (packet_size == 0 && framing_caps != PACKET_FRAMING_NIBBLE)
+      packet_size = getCompactPacketLength((uint8_t *)cmd->data, cmd->len); // a compact header may end here too
 
-        return true; // no more process until next byte receive
-      }
+    if (packet_size != 0)
+    {
+      // valid match
+      packetStart(packet_size);
+      return true; // no more process until next byte receive
     }
 
     if (cmd->len >= delimeter_len)
@@ -335,19 +609,11 @@ bool DevicePacket<R, N>::processEachData(R inchar)
 
       if (memcmp(cmd->data + offset, delimeters, delimeter_len) == 0)
       {
-        this->receiver_lock();
         // reset the packet receive
         packet_length = 0;
 
         cmd->len = offset; // orginal data length
-        cmd->completed = true;
-        current_commands_length++; // store for the next
-        this->receiver_unlock();
-
-        if (current_commands_length >= max_command_queue_length)
-        {
-          return false; // if the queue if full then not process any more receive
-        }
+        return publishFrame(false);
       }
     }
   }
@@ -356,232 +622,2729 @@ bool DevicePacket<R, N>::processEachData(R inchar)
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::processBytes(R *all_bytes, size_t len)
+void DevicePacket<R, N>::packetStart(uint16_t packet_size)
 {
-  for (size_t x = 0; x < len; x++)
+  rx_frame->len = 0; // reset buffer index for making ready to receive actual buffer
+  resetRxCRC();
+
+  if (packet_size < N)
   {
-    if (current_commands_length >= max_command_queue_length)
-    {
-      // if the queue if full then not process any more receive untill the queue read
-      uint32_t start_time = (xTaskGetTickCount() * portTICK_PERIOD_MS); // gives ms time used for timeout
-      // maximum wait for 1 second
-      while (this->queueCheck() == false && (xTaskGetTickCount() * portTICK_PERIOD_MS - start_time) < 1000)
-      {
-        // wait until queue has space
-        vTaskDelay(pdMS_TO_TICKS(10)); // wait for 10ms
-      }
-    }
-    this->processEachData(all_bytes[x]); // if the queue full it return false
+    // Serial.println("Received:"+String(packet_size));
+    // packet size is valid
+    packet_length = packet_size; // update packet size
+    // register current time to register timeout of receving data
+    packet_timeout_at = millis() + (packet_size * 2) + 100;
+    // minimum baud rate could 4800bps that mean 600bytes for second, considering 2ms for each of byte, and some extra delay (100ms)
+  }
+  else if (stream_enabled)
+  {
+    streamStart(packet_size); // too big for a slot, goes to an onStream() handler in chunks
+  }
+  else
+  {
+    statAdd(stats.rx_oversize);
   }
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::feedBytes(R *all_bytes, size_t len)
+void DevicePacket<R, N>::updateRxCRC(Command_t<R, N> *cmd, uint16_t upto)
 {
-  if (!this->queueCheck())
-    return;
-  this->processBytes(all_bytes, len);
+  if (upto > rx_crc_len)
+  {
+    rx_crc = getCRC<R>(cmd->data + rx_crc_len, upto - rx_crc_len, rx_crc);
+    rx_crc_len = upto;
+  }
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::readSerialCommand()
+void DevicePacket<R, N>::resetRxCRC()
 {
-  if (serial_dev == nullptr)
-    return;
-  // command receiving from receiving thread
-  if (!this->queueCheck())
-    return;
-
-  if (bulk_read_enabled)
-  {
-    // if bulk read enabled
-    while (true)
-    {
-      int avail = serial_dev->available();
-      if (avail <= 0)
-        break; // no more data
-
-      size_t to_read = std::min((size_t)avail, (size_t)N);
-
-      R all_bytes[to_read];
-      size_t working_bytes = serial_dev->readBytes((uint8_t *)all_bytes, to_read); // size_t HardwareSerial::read(uint8_t *buffer, size_t size)
+  rx_crc = 0x0000;
+  rx_crc_len = 0;
+}
 
-      this->processBytes(all_bytes, working_bytes);
-    }
-  }
-  else
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::publishFrame(bool framed)
+{
+  Command_t<R, N> *cmd = rx_frame;
+  cmd->framed = framed;
+  updateRxCRC(cmd, cmd->len); // the last partial batch
+  // a frame of only the CRC (or less) can never be valid
+  cmd->crc = cmd->len > CRC_BYTE_LEN ? rx_crc : 0xFFFF;
+  resetRxCRC();
+  if (trace_enabled)
   {
-    while (serial_dev->available())
-    {
-      if (!this->processEachData(serial_dev->read()))
-        break; // if the queue if full then not process any more receive
-    }
+    cmd->stamps.complete = PACKET_TRACE_CLOCK();
+    cmd->stamps.first_byte = rx_trace_open ? rx_trace_first : cmd->stamps.complete;
+    rx_trace_open = false;
   }
-  // Serial.println();
+
+  // reliable delivery: data frames are queued in sequence order, acks never reach the queue
+  if (framed && arq_window != 0 && cmd->len > TRANSFER_DATA_ARQ_HEADER_LEN + CRC_BYTE_LEN && cmd->data[0] == TRANSFER_DATA_BUFFER_SIG &&
+      (cmd->data[1] == BUFFER_ARQ_DATA_RESPNOSE || cmd->data[1] == BUFFER_ARQ_ACK_RESPNOSE))
+    return arqReceive(cmd);
+  return queueFrame();
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::processingQueueCommands()
+bool DevicePacket<R, N>::queueFrame()
 {
-  // command process from listening thread
-  if (current_commands_length > 0 && commpleted_cmd_read == false)
-  { // if only the queue has data
-    for (uint8_t i = 0; i < current_commands_length; i++)
+  // the in-flight frame, complete and CRC checked, goes to its receive queue
+  Command_t<R, N> *cmd = rx_frame;
+
+  // with RX_QUEUE_DROP receiving goes on while the queue is full: a frame without room is discarded
+  // whole and its slot reused, no other policy gets here without room for it
+  if (rx_channel_queues)
+  {
+    uint8_t channel = frameChannel(cmd->data, cmd->len, cmd->framed);
+    if (channel != 0 && channel < PACKET_CHANNELS && rx_channels[channel].slots)
     {
-      Command_t<R, N> *cmd = &(commands_holder[i]);
-      if (cmd->completed)
-      {
-        commandProcess(cmd->data, cmd->len); // process the command
-        this->receiver_lock();
-        cmd->completed = false;
-        this->receiver_unlock();
-      }
-      this->receiver_lock();
-      // restore default: when writing to that it is ensure that other thread is not writing in this
+      // a channel with its own slots, the in-flight slot is reused
+      if (channelPush(&rx_channels[channel], cmd))
+        framePublished();
+      else
+        statAdd(stats.rx_dropped);
       cmd->len = 0;
-      this->receiver_unlock();
+      return rx_policy == RX_QUEUE_DROP || !queueFull();
     }
-    // current_commands_length = 0;
-    this->receiver_lock();
-    commpleted_cmd_read = true;
-    this->receiver_unlock();
   }
+
+  if (rx_arena)
+  {
+    if (arenaPush(cmd))
+      framePublished();
+    else
+      statAdd(stats.rx_dropped);
+    cmd->len = 0;
+    return rx_policy == RX_QUEUE_DROP || !queueFull();
+  }
+
+  uint16_t next = nextSlot(rx_head.load(std::memory_order_relaxed));
+  if (next == rx_tail.load(std::memory_order_acquire))
+  {
+    statAdd(stats.rx_dropped);
+    cmd->len = 0;
+    return true;
+  }
+  framePublished();
+  rx_frame = &(commands_holder[next]);
+  rx_frame->len = 0; // the next slot is free, it is never inside [rx_tail, rx_head)
+
+  // release: the frame bytes are visible before the processing thread sees the new head
+  rx_head.store(next, std::memory_order_release);
+
+  return rx_policy == RX_QUEUE_DROP || !queueFull(); // if the queue if full then not process any more receive
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::setDevicePort(Stream *serial)
+bool DevicePacket<R, N>::channelPush(RxChannel_t<R, N> *queue, Command_t<R, N> *cmd)
 {
-  serial_dev = serial;
+  uint16_t head = queue->head.load(std::memory_order_relaxed);
+  uint16_t next = (head + 1) % queue->size;
+  if (next == queue->tail.load(std::memory_order_acquire))
+    return false; // only with RX_QUEUE_DROP, otherwise receiving stops while a queue is full
+
+  Command_t<R, N> *slot = &(queue->slots[head]);
+  memcpy(slot->data, cmd->data, cmd->len * sizeof(R));
+  slot->len = cmd->len;
+  slot->crc = cmd->crc;
+  slot->framed = cmd->framed;
+  slot->stamps = cmd->stamps;
+
+  // release: the frame bytes are visible before the processing thread sees the new head
+  queue->head.store(next, std::memory_order_release);
+  return true;
 }
 
 template <typename R, uint16_t N>
-bool DevicePacket<R, N>::getBufferMode()
+uint32_t DevicePacket<R, N>::arenaRecordSize(uint16_t len)
 {
-  return response_buffer_mode;
+  // header + frame + the byte textCommandProcess() NUL terminates (+ the timestamps while
+  // tracing), rounded up to RX_ARENA_ALIGN
+  uint32_t size = sizeof(ArenaRecord_t) + ((uint32_t)len + 1) * sizeof(R);
+  size = (size + RX_ARENA_ALIGN - 1) & ~(uint32_t)(RX_ARENA_ALIGN - 1);
+  return trace_enabled ? size + sizeof(FrameStamps_t) : size;
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::setBufferMode(bool state)
+FrameStamps_t *DevicePacket<R, N>::arenaStamps(ArenaRecord_t *record)
 {
-  response_buffer_mode = state;
+  uint32_t offset = sizeof(ArenaRecord_t) + ((uint32_t)record->len + 1) * sizeof(R);
+  offset = (offset + RX_ARENA_ALIGN - 1) & ~(uint32_t)(RX_ARENA_ALIGN - 1);
+  return (FrameStamps_t *)((uint8_t *)record + offset);
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::setAutoFlush(bool state)
+bool DevicePacket<R, N>::arenaFit(uint32_t need, uint32_t *at)
 {
-  auto_flush = state;
+  // the head never catches up with the tail, arena_head == arena_tail always means empty
+  uint32_t head = arena_head.load(std::memory_order_relaxed);
+  uint32_t tail = arena_tail.load(std::memory_order_acquire); // the processing thread is done with the bytes before it
+
+  if (head < tail)
+  {
+    *at = head;
+    return head + need < tail;
+  }
+
+  // free space is [head, end) and [0, tail): a record is never split, it goes to the start instead
+  if (head + need < rx_arena_size || (head + need == rx_arena_size && tail != 0))
+  {
+    *at = head;
+    return true;
+  }
+  *at = 0;
+  return need < tail;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::arenaPush(Command_t<R, N> *cmd)
+{
+  uint32_t need = arenaRecordSize(cmd->len);
+  uint32_t at;
+  if (!arenaFit(need, &at))
+    return false;
+
+  uint32_t head = arena_head.load(std::memory_order_relaxed);
+  if (at != head)
+    ((ArenaRecord_t *)(rx_arena + head))->len = RX_ARENA_WRAP; // the processing thread skips to 0 here
+
+  ArenaRecord_t *record = (ArenaRecord_t *)(rx_arena + at);
+  record->len = cmd->len;
+  record->crc = cmd->crc;
+  record->framed = cmd->framed;
+  memcpy(record + 1, cmd->data, cmd->len * sizeof(R));
+  if (trace_enabled)
+    *arenaStamps(record) = cmd->stamps;
+
+  head = at + need;
+  // release: the record is visible before the processing thread sees the new head
+  arena_head.store(head >= rx_arena_size ? 0 : head, std::memory_order_release);
+  return true;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::enableRxArena(uint32_t arena_size)
+{
+  // setup-time call: nothing may be queued and no thread may be receiving or processing
+  arena_size &= ~(uint32_t)(RX_ARENA_ALIGN - 1);
+  if (arena_size <= arenaRecordSize(N - 1))
+    return false; // must hold at least one frame of the longest length
+
+  delete[] commands_holder;
+  delete[] rx_arena;
+  commands_holder_size = 1; // only the in-flight frame
+  commands_holder = new Command_t<R, N>[commands_holder_size];
+  rx_frame = commands_holder;
+  rx_head = rx_tail = 0;
+
+  rx_arena = new uint8_t[arena_size];
+  rx_arena_size = arena_size;
+  arena_head = arena_tail = 0;
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::setRxBackpressure(uint8_t policy, uint16_t block_ms)
+{
+  // setup-time call
+  rx_policy = policy;
+  rx_block_ms = block_ms;
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (policy == RX_QUEUE_BLOCK && rx_space == NULL)
+    rx_space = xSemaphoreCreateBinary();
+#endif
+}
+
+template <typename R, uint16_t N>
+uint32_t DevicePacket<R, N>::rxDropped()
+{
+  return stats.rx_dropped.load(std::memory_order_relaxed);
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::rxWaitSpace(uint32_t deadline)
+{
+  // RX_QUEUE_BLOCK: sleeps until the processing thread has dispatched a frame, false at the deadline
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (rx_space != NULL)
+  {
+    while (queueFull())
+    {
+      int32_t left = (int32_t)(deadline - (uint32_t)millis());
+      if (left <= 0)
+        return false;
+      rx_waiting.store(true);
+      std::atomic_thread_fence(std::memory_order_seq_cst); // pairs with rxSpaceMade(), no slot freed from here on is missed
+      if (queueFull())
+        xSemaphoreTake(rx_space, pdMS_TO_TICKS(left) + 1);
+      rx_waiting.store(false);
+    }
+    return true;
+  }
+#endif
+  return false; // without an RTOS nothing makes room while the receiving side waits
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::rxSpaceMade()
+{
+  // processing thread, after a frame was handed back
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (rx_space == NULL)
+    return;
+  std::atomic_thread_fence(std::memory_order_seq_cst); // the new tail is visible before rx_waiting is read
+  if (rx_waiting.load(std::memory_order_relaxed))
+    xSemaphoreGive(rx_space);
+#endif
+}
+
+template <typename R, uint16_t N>
+size_t DevicePacket<R, N>::processChunk(R *all_bytes, size_t len)
+{
+  // chunk scanner: only the bytes that can complete a signature ('>') or a delimiter
+  // (its last byte) go through processEachData(), everything between is copied in runs
+  if (sizeof(R) != 1 || delimeter_len == 0)
+  {
+    for (size_t x = 0; x < len; x++)
+    {
+      if (!this->processEachData(all_bytes[x]))
+        return x + 1;
+    }
+    return len;
+  }
+
+  const uint8_t *bytes = (const uint8_t *)all_bytes;
+  const uint8_t sig_end = packet_info[PACKET_SIGNETURE_LEN - 1];
+  const uint8_t del_end = (uint8_t)delimeters[delimeter_len - 1];
+  const size_t not_searched = (size_t)-1;
+  size_t sig_pos = not_searched; // next possible signature end in the chunk (len = none)
+  size_t del_pos = not_searched; // next possible delimiter end in the chunk (len = none)
+
+  // a compact header has no fixed last byte: from its first sync byte on, the next
+  // PACKET_COMPACT_MAX_LEN bytes go the per-byte path; one may have begun in the last chunk
+  const bool compact = framing_caps != PACKET_FRAMING_NIBBLE;
+  size_t sync_pos = compact ? not_searched : len;
+  size_t per_byte_until = compact ? std::min(len, (size_t)(PACKET_COMPACT_MAX_LEN - 1)) : 0;
+
+  size_t x = 0;
+  while (x < len)
+  {
+    if (stream_length != 0)
+    {
+      x += processStreamBytes(all_bytes + x, len - x);
+      continue;
+    }
+    if (trace_enabled && !rx_trace_open)
+      traceFirst();
+
+    Command_t<R, N> *cmd = rx_frame;
+
+    if (packet_length != 0)
+    {
+      // packet receiving mode: the payload is opaque, copy as much as the packet still needs
+      size_t run = std::min(len - x, (size_t)(packet_length - cmd->len));
+      memcpy(cmd->data + cmd->len, all_bytes + x, run * sizeof(R));
+      cmd->len += run;
+      x += run;
+      updateRxCRC(cmd, cmd->len);
+
+      if (cmd->len == packet_length)
+      {
+        packet_length = 0;
+        packet_timeout_at = 0; // reset timeout
+        if (!publishFrame(true))
+          return x; // if the queue if full then not process any more receive
+      }
+      continue;
+    }
+
+    if (x < per_byte_until)
+    {
+      if (bytes[x] == PACKET_COMPACT_SYNC0)
+        per_byte_until = std::min(len, x + PACKET_COMPACT_MAX_LEN);
+      bool has_space = this->processEachData(all_bytes[x]);
+      x++;
+      if (!has_space)
+        return x;
+      continue;
+    }
+
+    // non packet mode: find the next byte where a frame boundary can complete
+    if (sync_pos == not_searched || sync_pos < x)
+    {
+      const uint8_t *found = (const uint8_t *)memchr(bytes + x, PACKET_COMPACT_SYNC0, len - x);
+      sync_pos = found ? (size_t)(found - bytes) : len;
+    }
+    if (sig_pos == not_searched || sig_pos < x)
+    {
+      const uint8_t *found = (const uint8_t *)memchr(bytes + x, sig_end, len - x);
+      sig_pos = found ? (size_t)(found - bytes) : len;
+    }
+    if (del_pos == not_searched || del_pos < x)
+    {
+      const uint8_t *found = (const uint8_t *)memchr(bytes + x, del_end, len - x);
+      del_pos = found ? (size_t)(found - bytes) : len;
+    }
+    size_t boundary = std::min(std::min(sig_pos, del_pos), sync_pos);
+
+    // copy the run before the boundary, keeping the same wrap at N as processEachData()
+    while (x < boundary)
+    {
+      size_t run = std::min(boundary - x, (size_t)(N - cmd->len));
+      memcpy(cmd->data + cmd->len, all_bytes + x, run * sizeof(R));
+      cmd->len += run;
+      x += run;
+      if (cmd->len >= N)
+      {
+        statAdd(stats.rx_oversize);
+        cmd->len = 0;
+        resetRxCRC();
+        rx_trace_open = false;
+      }
+      else if (cmd->len > delimeter_len)
+      {
+        updateRxCRC(cmd, cmd->len - delimeter_len);
+      }
+    }
+
+    if (x < len)
+    {
+      if (x == sync_pos)
+      {
+        // a whole compact header in the chunk is taken in one step, unless one of its bytes could
+        // end something else first or the slot would wrap inside it (the per-byte path decides then)
+        uint8_t header_len = 0;
+        uint16_t packet_size = compactHeaderAt(bytes + x, len - x, &header_len);
+        bool clean = packet_size != 0 && cmd->len + header_len < N;
+        for (uint8_t i = 0; clean && i + 1 < header_len; i++)
+          clean = bytes[x + i] != sig_end && bytes[x + i] != del_end;
+        if (clean)
+        {
+          packetStart(packet_size);
+          x += header_len;
+          continue;
+        }
+        per_byte_until = std::min(len, x + PACKET_COMPACT_MAX_LEN);
+      }
+
+      // the boundary byte itself takes the per-byte path
+      bool has_space = this->processEachData(all_bytes[x]);
+      x++;
+      if (!has_space)
+        return x;
+    }
+  }
+
+  return len;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::streamStart(uint16_t packet_size)
+{
+  stream_length = packet_size;
+  stream_received = 0;
+  stream_header_len = 0;
+  stream_draining = false;
+  stream_handler = nullptr;
+  resetRxCRC();
+  packet_timeout_at = millis() + (packet_size * 2) + 100; // same budget as a queued packet
+}
+
+template <typename R, uint16_t N>
+size_t DevicePacket<R, N>::processStreamBytes(R *all_bytes, size_t len)
+{
+  // the in-flight slot is the chunk buffer, nothing is queued while a frame is streamed
+  Command_t<R, N> *cmd = rx_frame;
+  size_t run = std::min(len, (size_t)(stream_length - stream_received));
+
+  size_t x = 0;
+  while (x < run)
+  {
+    if (stream_draining)
+    {
+      stream_received += run - x;
+      x = run;
+      break;
+    }
+
+    if (stream_header_len == 0)
+    {
+      // byte by byte until the record header and the name are complete
+      cmd->data[cmd->len++] = all_bytes[x++];
+      stream_received++;
+      if (streamHeader(cmd))
+        cmd->len = 0; // the chunk buffer now only holds payload
+      continue;
+    }
+
+    size_t take = std::min(run - x, (size_t)(N - cmd->len));
+    memcpy(cmd->data + cmd->len, all_bytes + x, take * sizeof(R));
+    cmd->len += take;
+    stream_received += take;
+    x += take;
+    if (cmd->len == N || stream_received == stream_length)
+      streamChunkOut(cmd);
+  }
+
+  if (stream_received == stream_length)
+  {
+    if (!stream_draining && rx_crc != 0)
+      statAdd(stats.rx_crc_errors);
+    streamEnd(!stream_draining && rx_crc == 0);
+  }
+  return run;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::streamHeader(Command_t<R, N> *cmd)
+{
+  // params: sig, 0x5F, type, pram_len, data_len(2), name
+  // array : sig, 0x60, type, type_size, pram_len, data_size(2), name
+  R *data = cmd->data;
+  uint16_t len = cmd->len;
+  if (len < 2)
+    return false;
+
+  uint16_t fixed_len = data[1] == BUFFER_PARAM_RESPNOSE ? TRANSFER_DATA_PARAMS_HEADER_LEN : TRANSFER_DATA_ARRAY_HEADER_LEN;
+  if (data[0] != TRANSFER_DATA_BUFFER_SIG || (data[1] != BUFFER_PARAM_RESPNOSE && data[1] != BUFFER_ARRY_RESPNOSE))
+  {
+    stream_draining = true; // text and batch frames are never streamed
+    return true;
+  }
+  if (len < fixed_len)
+    return false;
+
+  bool is_array = data[1] == BUFFER_ARRY_RESPNOSE;
+  uint8_t data_type = data[2];
+  uint8_t pram_len = is_array ? data[4] : data[3];
+  uint16_t type_size = is_array ? data[3] : (((uint8_t)data[4] << 8) | (uint8_t)data[5]);
+  uint16_t count = is_array ? (((uint8_t)data[5] << 8) | (uint8_t)data[6]) : 1;
+  uint32_t header_len = fixed_len + pram_len;
+
+  if (header_len > N || (uint32_t)type_size * count + header_len + CRC_BYTE_LEN != stream_length)
+  {
+    stream_draining = true; // the name does not fit the chunk buffer or the sizes disagree
+    return true;
+  }
+  if (len < header_len)
+    return false;
+
+  stream_header_len = header_len;
+  rx_crc = getCRC<R>(data, header_len, 0x0000);
+
+  Handler_t<R> *handler = handlers.find(HANDLER_STREAM, (const char *)(data + fixed_len), pram_len);
+  if (handler == nullptr || handler->stream_chunk == nullptr || (handler->stream_begin && !handler->stream_begin(data_type, type_size, count)))
+  {
+    if (handler == nullptr)
+      statAdd(stats.rx_unhandled);
+    stream_draining = true;
+    return true;
+  }
+  stream_handler = handler;
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::streamChunkOut(Command_t<R, N> *cmd)
+{
+  rx_crc = getCRC<R>(cmd->data, cmd->len, rx_crc);
+
+  // the trailing CRC bytes are checked, never delivered
+  uint32_t chunk_at = stream_received - cmd->len;
+  uint32_t payload_end = stream_length - CRC_BYTE_LEN;
+  if (chunk_at < payload_end)
+  {
+    uint16_t deliver = (uint16_t)std::min((uint32_t)cmd->len, payload_end - chunk_at);
+    stream_handler->stream_chunk(cmd->data, deliver, chunk_at - stream_header_len);
+  }
+  cmd->len = 0;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::streamEnd(bool commit)
+{
+  if (stream_handler && stream_handler->stream_end)
+    stream_handler->stream_end(commit);
+
+  rx_frame->len = 0;
+  rx_trace_open = false;
+  stream_length = 0;
+  stream_handler = nullptr;
+  stream_draining = false;
+  packet_timeout_at = 0;
+  resetRxCRC();
+}
+
+template <typename R, uint16_t N>
+size_t DevicePacket<R, N>::processBytes(R *all_bytes, size_t len)
+{
+  // returns the bytes taken: fewer than len when the queue is full (RX_QUEUE_RETURN, RX_QUEUE_BLOCK
+  // past its deadline), the caller offers the rest again after processingQueueCommands() made room
+  uint32_t deadline = 0;
+  bool waited = false;
+  size_t x = 0;
+  while (x < len)
+  {
+    if (rx_policy != RX_QUEUE_DROP && queueFull())
+    {
+      if (!waited)
+      {
+        statAdd(stats.rx_queue_full);
+        deadline = (uint32_t)millis() + rx_block_ms; // one deadline for the whole call
+      }
+      waited = true;
+      if (rx_policy != RX_QUEUE_BLOCK || !rxWaitSpace(deadline))
+        break;
+    }
+    x += this->processChunk(all_bytes + x, len - x);
+  }
+  statAddSingle(stats.rx_bytes, x);
+  return x;
+}
+
+template <typename R, uint16_t N>
+size_t DevicePacket<R, N>::feedBytes(R *all_bytes, size_t len)
+{
+  this->queueCheck(); // packet timeouts, a full queue is up to processBytes()
+  size_t taken = this->processBytes(all_bytes, len);
+
+  if (rx_events && rx_published)
+  {
+    rx_published = false;
+    notifyReceive(); // one wake up for all the frames of this call
+  }
+  if (arq_window != 0)
+    arqService();
+  return taken;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::readSerialCommand()
+{
+  if (serial_dev == nullptr)
+    return;
+  // command receiving from receiving thread
+  if (!this->queueCheck())
+    return;
+  if (trace_enabled)
+    tracePoll();
+
+  if (bulk_read_enabled)
+  {
+    // if bulk read enabled: what the queue had no room for stays in rx_bulk for the next call
+    while (true)
+    {
+      if (rx_bulk_pos == rx_bulk_len)
+      {
+        int avail = serial_dev->available();
+        if (avail <= 0)
+          break; // no more data
+
+        size_t to_read = std::min((size_t)avail, (size_t)N);
+        rx_bulk_len = serial_dev->readBytes((uint8_t *)rx_bulk, to_read); // size_t HardwareSerial::read(uint8_t *buffer, size_t size)
+        rx_bulk_pos = 0;
+        if (rx_bulk_len == 0)
+          break;
+      }
+
+      rx_bulk_pos += this->processBytes(rx_bulk + rx_bulk_pos, rx_bulk_len - rx_bulk_pos);
+      if (rx_bulk_pos < rx_bulk_len)
+        break; // the queue is full
+    }
+  }
+  else
+  {
+    uint32_t taken = 0;
+    while (serial_dev->available())
+    {
+      taken++;
+      if (!this->processEachData(serial_dev->read()))
+      {
+        statAdd(stats.rx_queue_full);
+        break; // if the queue if full then not process any more receive
+      }
+    }
+    statAddSingle(stats.rx_bytes, taken);
+  }
+  rx_trace_polling = false;
+  if (arq_window != 0)
+    arqService(); // acks for what was read, retransmissions that are due
+  // Serial.println();
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::enableEventReceive(bool receive_task)
+{
+  // setup-time call
+  disableEventReceive();
+
+#if !(defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION))
+  if (receive_task)
+    return false; // no RTOS: pass receive_task=false and call serviceReceive() when waitReceive(0) is true
+#endif
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  rx_wakeup = xSemaphoreCreateBinary();
+  rx_stopped = xSemaphoreCreateBinary();
+#endif
+  rx_published = false;
+  rx_notified = false;
+  rx_events = true;
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (receive_task)
+  {
+    rx_running = true;
+    if (xTaskCreate(rxTask, "packet_rx", PACKET_RX_TASK_STACK, this, PACKET_RX_TASK_PRIORITY, NULL) != pdPASS)
+    {
+      rx_running = false;
+      disableEventReceive();
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::disableEventReceive()
+{
+  if (!rx_events)
+    return;
+  rx_events = false;
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (rx_running)
+  {
+    rx_running = false;
+    xSemaphoreGive(rx_wakeup);
+    xSemaphoreTake(rx_stopped, portMAX_DELAY);
+  }
+  vSemaphoreDelete(rx_wakeup);
+  vSemaphoreDelete(rx_stopped);
+  rx_wakeup = rx_stopped = NULL;
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::notifyReceive()
+{
+  // data is ready: from a UART event callback (HardwareSerial::onReceive) or any other task
+  if (trace_enabled)
+    rx_trace_notified.store(PACKET_TRACE_CLOCK() | 1, std::memory_order_relaxed); // never 0
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (rx_wakeup != NULL)
+  {
+    xSemaphoreGive(rx_wakeup);
+    return;
+  }
+#endif
+  rx_notified = true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::notifyReceiveFromISR()
+{
+  // the same from an interrupt handler
+  if (trace_enabled)
+    rx_trace_notified.store(PACKET_TRACE_CLOCK() | 1, std::memory_order_relaxed);
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (rx_wakeup != NULL)
+  {
+    BaseType_t woken = pdFALSE;
+    xSemaphoreGiveFromISR(rx_wakeup, &woken);
+    portYIELD_FROM_ISR(woken); // switch to the receive task right away when it has the higher priority
+    return;
+  }
+#endif
+  rx_notified = true;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::waitReceive(uint32_t timeout_ms)
+{
+  // for an own receive task (enableEventReceive(false)): true when notified within timeout_ms
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (rx_wakeup != NULL)
+    return xSemaphoreTake(rx_wakeup, timeout_ms == 0xFFFFFFFF ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+#endif
+  return rx_notified.exchange(false);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::serviceReceive()
+{
+  // receiving and processing thread in one: everything the Stream holds is read and dispatched,
+  // again while the receive queue filled up before the Stream was empty
+  do
+  {
+    readSerialCommand();
+    processingQueueCommands();
+  } while (serial_dev != nullptr && serial_dev->available() > 0);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::rxTask(void *param)
+{
+  DevicePacket<R, N> *device = (DevicePacket<R, N> *)param;
+  while (device->rx_running)
+  {
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+    // reliable frames in flight: wake often enough to send them again in time
+    bool arq_timers = device->arq_pending.load(std::memory_order_relaxed) != 0;
+    xSemaphoreTake(device->rx_wakeup, pdMS_TO_TICKS(arq_timers ? PACKET_ARQ_MIN_RTO_MS : PACKET_RX_IDLE_MS));
+#endif
+    if (device->rx_running)
+      device->serviceReceive();
+  }
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(device->rx_stopped);
+  vTaskDelete(NULL);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::processingQueueCommands()
+{
+  // command process from listening thread
+  if (!rx_channel_queues)
+  {
+    while (dispatchShared())
+      ;
+    return;
+  }
+
+  // weighted round robin over the shared queue and the channel queues: a backlog on one channel
+  // delays the frames of another by at most its weight per turn
+  bool pending = true;
+  while (pending)
+  {
+    pending = false;
+    for (uint8_t i = 0; i < PACKET_CHANNELS; i++)
+    {
+      if (i > 0 && rx_channels[i].slots == nullptr)
+        continue;
+      for (uint8_t n = 0; n < channel_weights[i]; n++)
+      {
+        if (!(i == 0 ? dispatchShared() : dispatchChannel(&rx_channels[i])))
+          break;
+        pending = true;
+      }
+    }
+  }
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::dispatchShared()
+{
+  // one frame of commands_holder / the arena (channel 0 and the channels without slots), false when empty
+  if (rx_arena)
+  {
+    uint32_t at = arena_tail.load(std::memory_order_relaxed);
+
+    // acquire: pairs with the release in arenaPush(), the record is complete
+    if (at == arena_head.load(std::memory_order_acquire))
+      return false;
+
+    ArenaRecord_t *record = (ArenaRecord_t *)(rx_arena + at);
+    if (record->len == RX_ARENA_WRAP)
+    {
+      at = 0;
+      record = (ArenaRecord_t *)rx_arena; // the writer never wraps onto an empty arena, a record is there
+    }
+    if (trace_enabled)
+      traceFrameBegin(arenaStamps(record));
+    commandProcess((R *)(record + 1), record->len, record->crc, record->framed);
+    if (trace_enabled)
+      traceFrameEnd();
+
+    // hand the bytes back to the receiving thread one record at a time
+    at += arenaRecordSize(record->len);
+    if (at >= rx_arena_size)
+      at = 0;
+    arena_tail.store(at, std::memory_order_release);
+    statAddSingle(stats.rx_dispatched);
+    rxSpaceMade();
+    return true;
+  }
+
+  uint16_t tail = rx_tail.load(std::memory_order_relaxed);
+
+  // acquire: pairs with the release in publishFrame(), the frame data is complete
+  if (tail == rx_head.load(std::memory_order_acquire))
+    return false;
+
+  Command_t<R, N> *cmd = &(commands_holder[tail]);
+  if (trace_enabled)
+    traceFrameBegin(&cmd->stamps);
+  commandProcess(cmd->data, cmd->len, cmd->crc, cmd->framed); // process the command
+  if (trace_enabled)
+    traceFrameEnd();
+
+  // hand the slot back to the receiving thread one frame at a time
+  rx_tail.store(nextSlot(tail), std::memory_order_release);
+  statAddSingle(stats.rx_dispatched);
+  rxSpaceMade();
+  return true;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::dispatchChannel(RxChannel_t<R, N> *queue)
+{
+  uint16_t tail = queue->tail.load(std::memory_order_relaxed);
+
+  // acquire: pairs with the release in channelPush()
+  if (tail == queue->head.load(std::memory_order_acquire))
+    return false;
+
+  Command_t<R, N> *cmd = &(queue->slots[tail]);
+  if (trace_enabled)
+    traceFrameBegin(&cmd->stamps);
+  commandProcess(cmd->data, cmd->len, cmd->crc, cmd->framed);
+  if (trace_enabled)
+    traceFrameEnd();
+  queue->tail.store((tail + 1) % queue->size, std::memory_order_release);
+  statAddSingle(stats.rx_dispatched);
+  rxSpaceMade();
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::setDevicePort(Stream *serial)
+{
+  serial_dev = serial;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::getBufferMode()
+{
+  return response_buffer_mode;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::setBufferMode(bool state)
+{
+  response_buffer_mode = state;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::setAutoFlush(bool state)
+{
+  auto_flush = state;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::flushDataPort()
+{
+  if (serial_dev == nullptr)
+    return;
+  flushTx(); // async mode: everything queued so far goes out first
+  // thread safe flush
+  this->writer_lock();
+  serial_dev->flush();
+  this->writer_unlock();
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::writeToPort(uint8_t *buff, uint16_t size)
+{
+  if (serial_dev == nullptr)
+    return false;
+
+  if (tx_queues[0].ring != nullptr)
+  {
+    // async mode: keep the order with the queued frames
+    const uint8_t *parts[1] = {buff};
+    const uint16_t lens[1] = {size};
+    return txEnqueue(0, parts, lens, 1);
+  }
+
+  // thread safe write
+  this->writer_lock();
+  portWrite(buff, size);
+  this->writer_unlock();
+
+  if (auto_flush)
+    flushDataPort();
+  return true;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::enableAsyncTx(uint32_t ring_size, uint16_t max_frames, uint8_t policy, bool writer_task)
+{
+  // setup-time call: not safe while other threads are transmitting
+  disableAsyncTx();
+  if (ring_size == 0 || max_frames == 0 || arq_window != 0)
+    return false; // reliable frames are written by their producer (and sent again by the receiving side)
+
+#if !(defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION))
+  if (writer_task)
+    return false; // no RTOS: pass writer_task=false and call processTxQueue() from loop()
+#endif
+
+  tx_queue_bytes = ring_size;
+  tx_queue_frames = max_frames;
+  tx_turn = 0;
+  tx_turn_credited = false;
+  tx_chunk = new uint8_t[PACKET_TX_CHUNK_LEN];
+  tx_writing = false;
+  tx_policy = policy;
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  tx_locker = xSemaphoreCreateMutex();
+  tx_wakeup = xSemaphoreCreateBinary();
+  tx_space = xSemaphoreCreateBinary();
+  tx_stopped = xSemaphoreCreateBinary();
+#endif
+
+  // every added channel gets a ring of its own, so a backlog on one of them cannot hold up another
+  for (uint8_t i = 1; i < PACKET_CHANNELS; i++)
+  {
+    if (channel_mask & ((uint32_t)1 << i))
+      txAllocQueue(&tx_queues[i]);
+  }
+  txAllocQueue(&tx_queues[0]); // from here on dataOutToSerial() queues
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (writer_task)
+  {
+    tx_running = true;
+    if (xTaskCreate(txTask, "packet_tx", PACKET_TX_TASK_STACK, this, PACKET_TX_TASK_PRIORITY, NULL) != pdPASS)
+    {
+      tx_running = false;
+      disableAsyncTx();
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::txAllocQueue(TxQueue_t *queue)
+{
+  if (queue->ring != nullptr)
+    return true;
+  queue->size = tx_queue_bytes;
+  queue->head = queue->tail = queue->used = 0;
+  queue->frames = new uint16_t[tx_queue_frames];
+  queue->frames_size = tx_queue_frames;
+  queue->frame_tail = queue->frame_count = queue->frame_sent = 0;
+  queue->deficit = 0;
+  queue->ring = new uint8_t[tx_queue_bytes];
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::disableAsyncTx()
+{
+  if (tx_queues[0].ring == nullptr)
+    return;
+
+  flushTx(1000); // give the writer a second to drain, a dead port must not hang the teardown
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (tx_running)
+  {
+    tx_running = false;
+    xSemaphoreGive(tx_wakeup);
+    xSemaphoreTake(tx_stopped, portMAX_DELAY);
+  }
+#endif
+
+  uint8_t *ring = tx_queues[0].ring;
+  tx_queues[0].ring = nullptr; // back to synchronous transmit
+  delete[] ring;
+  for (uint8_t i = 0; i < PACKET_CHANNELS; i++)
+  {
+    TxQueue_t *queue = &tx_queues[i];
+    delete[] queue->ring;
+    delete[] queue->frames;
+    queue->ring = nullptr;
+    queue->frames = nullptr;
+  }
+  delete[] tx_chunk;
+  tx_chunk = nullptr;
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  vSemaphoreDelete(tx_locker);
+  vSemaphoreDelete(tx_wakeup);
+  vSemaphoreDelete(tx_space);
+  vSemaphoreDelete(tx_stopped);
+  tx_locker = tx_wakeup = tx_space = tx_stopped = NULL;
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::txTask(void *param)
+{
+  DevicePacket<R, N> *device = (DevicePacket<R, N> *)param;
+  while (device->tx_running)
+  {
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+    xSemaphoreTake(device->tx_wakeup, pdMS_TO_TICKS(100));
+#endif
+    while (device->processTxQueue())
+      ;
+  }
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(device->tx_stopped);
+  vTaskDelete(NULL);
+#endif
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::txEnqueue(uint8_t channel, const uint8_t *parts[], const uint16_t lens[], uint8_t count)
+{
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < count; i++)
+    total += lens[i];
+  if (total == 0)
+    return true;
+
+  if (total > tx_queue_bytes || total > 0xFFFF)
+  {
+    // can never fit the ring: keep the order and send it from the caller's thread
+    flushTx();
+    this->writer_lock();
+    for (uint8_t i = 0; i < count; i++)
+    {
+      if (lens[i] > 0)
+        portWrite(parts[i], lens[i]);
+    }
+    this->writer_unlock();
+    return true;
+  }
+
+  this->tx_lock();
+  // a channel without a ring of its own shares the one of channel 0
+  TxQueue_t *queue = &tx_queues[channel < PACKET_CHANNELS && tx_queues[channel].ring != nullptr ? channel : 0];
+  while (queue->size - queue->used < total || queue->frame_count >= queue->frames_size)
+  {
+    if (tx_policy == TX_QUEUE_DROP_OLDEST && txDropOldest(queue))
+      continue;
+
+    if (tx_policy != TX_QUEUE_BLOCK)
+    {
+      // drop newest, or drop oldest when the oldest frame is already partly on the wire
+      statAdd(stats.tx_dropped);
+      this->tx_unlock();
+      return false;
+    }
+
+    this->tx_unlock();
+    txWait();
+    this->tx_lock();
+  }
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint32_t len = lens[i];
+    if (len == 0)
+      continue;
+    uint32_t first = queue->size - queue->head;
+    if (first > len)
+      first = len;
+    memcpy(queue->ring + queue->head, parts[i], first);
+    if (len > first)
+      memcpy(queue->ring, parts[i] + first, len - first);
+    queue->head = (queue->head + len) % queue->size;
+  }
+  queue->frames[(queue->frame_tail + queue->frame_count) % queue->frames_size] = (uint16_t)total;
+  queue->frame_count++;
+  bool was_empty = queue->used == 0;
+  queue->used += total;
+  this->tx_unlock();
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (was_empty)
+    xSemaphoreGive(tx_wakeup); // the writer drains until empty, only the first frame has to wake it
+#endif
+  return true;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::txDropOldest(TxQueue_t *queue)
+{
+  // tx_locker held; a frame the writer already started cannot be cut
+  if (queue->frame_count == 0 || queue->frame_sent > 0)
+    return false;
+
+  uint16_t len = queue->frames[queue->frame_tail];
+  queue->tail = (queue->tail + len) % queue->size;
+  queue->used -= len;
+  queue->frame_tail = (queue->frame_tail + 1) % queue->frames_size;
+  queue->frame_count--;
+  statAdd(stats.tx_dropped);
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::txWait()
+{
+  // wait for the writer to make progress, or be the writer when there is no task
+  if (!tx_running)
+  {
+    processTxQueue();
+    return;
+  }
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(tx_wakeup);
+  xSemaphoreTake(tx_space, 1); // one tick at most, several waiters share the signal
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::txNextTurn()
+{
+  tx_turn = tx_turn + 1 >= PACKET_CHANNELS ? 0 : tx_turn + 1;
+  tx_turn_credited = false;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::processTxQueue()
+{
+  if (tx_queues[0].ring == nullptr)
+    return false;
+
+  // take whole frames out of the queues into tx_chunk (a frame bigger than the chunk goes piece by
+  // piece), so the ring space is free again before the slow Stream write starts
+  this->tx_lock();
+  if (tx_writing)
+  {
+    this->tx_unlock();
+    return false; // another thread is the writer right now
+  }
+
+  // deficit round robin: a queue gets PACKET_TX_CHUNK_LEN * weight bytes of credit per visit and
+  // sends whole frames while its credit lasts; a frame that is partly taken is always finished
+  // first, frames of different channels never interleave on the wire
+  uint16_t chunk_len = 0;
+  uint8_t idle_queues = 0;
+  while (chunk_len < PACKET_TX_CHUNK_LEN && idle_queues < PACKET_CHANNELS)
+  {
+    TxQueue_t *queue = &tx_queues[tx_turn];
+    if (queue->ring == nullptr || queue->frame_count == 0)
+    {
+      queue->deficit = 0; // an idle queue does not save up credit
+      txNextTurn();
+      idle_queues++;
+      continue;
+    }
+    idle_queues = 0;
+
+    uint16_t remaining = queue->frames[queue->frame_tail] - queue->frame_sent;
+    if (queue->frame_sent == 0 && queue->deficit < remaining)
+    {
+      if (tx_turn_credited)
+      {
+        txNextTurn(); // its share of this round is used up
+        continue;
+      }
+      queue->deficit += (uint32_t)PACKET_TX_CHUNK_LEN * channel_weights[tx_turn];
+      tx_turn_credited = true;
+      continue;
+    }
+
+    uint16_t take = remaining;
+    if (chunk_len + take > PACKET_TX_CHUNK_LEN)
+    {
+      if (chunk_len > 0)
+        break; // next chunk
+      take = PACKET_TX_CHUNK_LEN;
+    }
+
+    uint32_t first = queue->size - queue->tail;
+    if (first > take)
+      first = take;
+    memcpy(tx_chunk + chunk_len, queue->ring + queue->tail, first);
+    if (take > first)
+      memcpy(tx_chunk + chunk_len + first, queue->ring, take - first);
+    queue->tail = (queue->tail + take) % queue->size;
+    queue->used -= take;
+    queue->deficit -= take < queue->deficit ? take : queue->deficit;
+    chunk_len += take;
+
+    if (take == remaining)
+    {
+      queue->frame_tail = (queue->frame_tail + 1) % queue->frames_size;
+      queue->frame_count--;
+      queue->frame_sent = 0;
+    }
+    else
+      queue->frame_sent += take;
+  }
+  tx_writing = chunk_len > 0;
+  this->tx_unlock();
+
+  if (chunk_len == 0)
+    return false;
+
+  this->writer_lock();
+  portWrite(tx_chunk, chunk_len);
+  if (auto_flush)
+    serial_dev->flush();
+  this->writer_unlock();
+
+  this->tx_lock();
+  tx_writing = false;
+  this->tx_unlock();
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(tx_space);
+#endif
+  return true;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::flushTx(uint32_t timeout_ms)
+{
+  // fence: returns once every frame queued before the call is written to the Stream
+  if (tx_queues[0].ring == nullptr)
+    return true;
+
+  uint32_t start_time = millis();
+  while (true)
+  {
+    this->tx_lock();
+    bool idle = !tx_writing;
+    for (uint8_t i = 0; i < PACKET_CHANNELS; i++)
+      idle = idle && tx_queues[i].used == 0;
+    this->tx_unlock();
+    if (idle)
+      return true;
+
+    if (timeout_ms != 0xFFFFFFFF && (uint32_t)(millis() - start_time) >= timeout_ms)
+      return false;
+    txWait();
+  }
+}
+
+template <typename R, uint16_t N>
+uint32_t DevicePacket<R, N>::txPending()
+{
+  if (tx_queues[0].ring == nullptr)
+    return 0;
+  uint32_t pending = 0;
+  this->tx_lock();
+  for (uint8_t i = 0; i < PACKET_CHANNELS; i++)
+    pending += tx_queues[i].used;
+  this->tx_unlock();
+  return pending;
+}
+
+template <typename R, uint16_t N>
+uint32_t DevicePacket<R, N>::txDropped()
+{
+  return stats.tx_dropped.load(std::memory_order_relaxed);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::statAdd(std::atomic<uint32_t> &counter, uint32_t count)
+{
+  // relaxed: a counter orders nothing, it only has to add up
+  counter.fetch_add(count, std::memory_order_relaxed);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::statAddSingle(std::atomic<uint32_t> &counter, uint32_t count)
+{
+  // a counter only one thread writes (or only under one lock): no locked read-modify-write needed
+  counter.store(counter.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::framePublished()
+{
+  // receiving thread: a frame entered one of the queues
+  rx_published = true;
+  uint32_t frames = stats.rx_frames.load(std::memory_order_relaxed) + 1;
+  stats.rx_frames.store(frames, std::memory_order_relaxed);
+  uint32_t depth = frames - stats.rx_dispatched.load(std::memory_order_relaxed);
+  if (depth > stats.rx_queue_peak.load(std::memory_order_relaxed))
+    stats.rx_queue_peak.store(depth, std::memory_order_relaxed); // the only writer, no CAS needed
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::enableReliable(uint8_t window, uint16_t block_ms)
+{
+  // setup-time call, on both ends of the link: no thread may be sending or receiving
+  disableReliable();
+  if (window == 0 || tx_queues[0].ring != nullptr)
+    return false; // reliable frames are not queued for the async writer
+
+  uint8_t size = 1;
+  while (size * 2 <= window && size < ARQ_MAX_WINDOW)
+    size *= 2; // sequence & (size - 1) picks the slot, it has to stay put when the sequence wraps
+
+  arq_frame_size = PACKET_SIGNETURE_LEN + N; // longer frames are streamed by the peer, they are sent as they are
+  arq_slots.reset(new ArqSlot_t[size]);
+  arq_tx_frames.reset(new uint8_t[(size_t)size * arq_frame_size]);
+  arq_rx_frames.reset(new R[(size_t)size * N]);
+  arq_rx_lens.reset(new uint16_t[size]);
+  arq_block_ms = block_ms;
+  arq_session = (uint8_t)(micros() ^ (micros() >> 8) ^ (uintptr_t)this); // a restarted sender starts a new session
+  arq_base = arq_next = 0;
+  arq_pending = 0;
+  arq_rtt_valid = false;
+  arq_rto = (uint32_t)PACKET_ARQ_INITIAL_RTO_MS * 1000;
+  arq_rx_synced = false;
+  arq_rx_held = 0;
+  arq_ack_due = false;
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  arq_space = xSemaphoreCreateBinary();
+#endif
+  arq_window = size;
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::disableReliable()
+{
+  // setup-time call, frames still in flight are forgotten
+  if (arq_window == 0)
+    return;
+  arq_window = 0;
+  arq_pending = 0;
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  vSemaphoreDelete(arq_space);
+  arq_space = NULL;
+#endif
+  arq_slots.reset();
+  arq_tx_frames.reset();
+  arq_rx_frames.reset();
+  arq_rx_lens.reset();
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::processReliable()
+{
+  // receiving thread: readSerialCommand() and feedBytes() already do this after every call, only
+  // needed when the link is not read for longer than a retransmission timeout
+  if (arq_window != 0)
+    arqService();
+}
+
+template <typename R, uint16_t N>
+uint8_t DevicePacket<R, N>::reliablePending()
+{
+  // frames sent and not acked yet, the window is full at enableReliable()'s window
+  return arq_pending.load(std::memory_order_relaxed);
+}
+
+template <typename R, uint16_t N>
+uint32_t DevicePacket<R, N>::reliableRto()
+{
+  // current retransmission timeout in us, from the measured RTT
+  arq_lock();
+  uint32_t rto = arq_rto;
+  arq_unlock();
+  return rto;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::arqReceive(Command_t<R, N> *cmd)
+{
+  // receiving thread: a reliable data frame or an ack, CRC already known
+  R *data = cmd->data;
+  if (cmd->crc != 0)
+    statAdd(stats.rx_crc_errors); // a data frame is sent again when its ack does not come
+  else if (data[1] == BUFFER_ARQ_ACK_RESPNOSE)
+  {
+    if (cmd->len >= TRANSFER_DATA_ARQ_ACK_LEN + CRC_BYTE_LEN)
+      arqAcked(data);
+  }
+  else
+  {
+    uint8_t session = (uint8_t)data[2];
+    uint8_t sequence = (uint8_t)data[3];
+    if (!arq_rx_synced || session != arq_rx_session)
+    {
+      // the peer (re)started: whatever was held belongs to a session it gave up
+      arq_rx_synced = true;
+      arq_rx_session = session;
+      arq_rx_expected = 0;
+      arq_rx_held = 0;
+    }
+    arq_ack_due = true;
+
+    uint8_t ahead = sequence - arq_rx_expected;
+    if (ahead >= arq_window || (arq_rx_held >> ahead) & 1)
+      statAdd(stats.rx_duplicates); // queued already (its ack was lost) or held
+    else
+    {
+      // the frame without the prefix, as the peer would have sent it without reliable delivery
+      cmd->len -= TRANSFER_DATA_ARQ_HEADER_LEN;
+      memmove(data, data + TRANSFER_DATA_ARQ_HEADER_LEN, cmd->len * sizeof(R));
+      if (ahead == 0 && !queueFull())
+      {
+        // next in sequence: queued straight from the in-flight slot, then the frames held behind it
+        arq_rx_expected++;
+        arq_rx_held >>= 1;
+        queueFrame();
+        arqDrain();
+        return rx_policy == RX_QUEUE_DROP || !queueFull();
+      }
+
+      uint8_t slot = sequence & (arq_window - 1);
+      memcpy(arq_rx_frames.get() + (size_t)slot * N, data, cmd->len * sizeof(R));
+      arq_rx_lens[slot] = cmd->len;
+      arq_rx_held |= (uint32_t)1 << ahead;
+      arqDrain();
+    }
+  }
+  rx_frame->len = 0; // cmd, unless arqDrain() queued it and moved on to the next slot
+  return rx_policy == RX_QUEUE_DROP || !queueFull();
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arqDrain()
+{
+  // held frames that are next in sequence go to the receive queue while it has room
+  while ((arq_rx_held & 1) && !queueFull())
+  {
+    uint8_t slot = arq_rx_expected & (arq_window - 1);
+    Command_t<R, N> *cmd = rx_frame;
+    memcpy(cmd->data, arq_rx_frames.get() + (size_t)slot * N, arq_rx_lens[slot] * sizeof(R));
+    cmd->len = arq_rx_lens[slot];
+    cmd->crc = 0;
+    cmd->framed = true;
+    if (trace_enabled)
+      cmd->stamps.first_byte = cmd->stamps.complete = PACKET_TRACE_CLOCK();
+    arq_rx_held >>= 1;
+    arq_rx_expected++;
+    queueFrame();
+  }
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arqSendAck()
+{
+  // receiving thread: everything before next is queued or held, the map has the frames after it
+  uint8_t held = 0;
+  while (held < arq_window && (arq_rx_held >> held) & 1)
+    held++;
+  uint8_t next = arq_rx_expected + held;
+  uint32_t map = held + 1 < 32 ? arq_rx_held >> (held + 1) : 0;
+  uint8_t header[TRANSFER_DATA_ARQ_ACK_LEN] = {TRANSFER_DATA_BUFFER_SIG, BUFFER_ARQ_ACK_RESPNOSE, arq_rx_session, next,
+                                               (uint8_t)(map >> 24), (uint8_t)(map >> 16), (uint8_t)(map >> 8), (uint8_t)map};
+  frameOut(nullptr, 0, header, TRANSFER_DATA_ARQ_ACK_LEN);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arqService()
+{
+  // receiving thread, after every read: one ack for all the frames of the read, then the timers
+  if (arq_ack_due)
+  {
+    arq_ack_due = false;
+    arqSendAck();
+  }
+  if (arq_pending.load(std::memory_order_relaxed) != 0)
+  {
+    arq_lock();
+    arqRetransmit();
+    arq_unlock();
+  }
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arqAcked(const R *data)
+{
+  // receiving thread: an ack from the peer frees the window up to the first frame it is missing
+  arq_lock();
+  uint8_t next = (uint8_t)data[3];
+  uint8_t in_flight = arq_next - arq_base;
+  if ((uint8_t)data[2] != arq_session || (uint8_t)(next - arq_base) > in_flight)
+  {
+    arq_unlock();
+    return; // an old session, or older than the window (acks can overtake each other on retries)
+  }
+  uint32_t map = ((uint32_t)(uint8_t)data[4] << 24) | ((uint32_t)(uint8_t)data[5] << 16) | ((uint32_t)(uint8_t)data[6] << 8) | (uint8_t)data[7];
+
+  uint32_t now = micros();
+  uint8_t covered = next - arq_base; // acked by the cumulative part
+  for (uint8_t i = 0; i < in_flight; i++)
+  {
+    uint8_t sequence = arq_base + i;
+    uint8_t after = sequence - next; // frames after next are in the map, bit after - 1
+    bool acked = i < covered || (after != 0 && after <= 32 && (map >> (after - 1)) & 1);
+    ArqSlot_t *slot = &arq_slots[sequence & (arq_window - 1)];
+    if (acked && !slot->acked)
+    {
+      slot->acked = true;
+      if (slot->tries == 1)
+        arqRtt(now - slot->sent_at);
+    }
+  }
+
+  // fast retransmit: a frame missing while PACKET_ARQ_FAST_RETRANSMIT later ones arrived is lost,
+  // it goes again now instead of after its timeout
+  uint8_t later = 0;
+  for (uint8_t i = in_flight; i > 0; i--)
+  {
+    ArqSlot_t *slot = &arq_slots[(uint8_t)(arq_base + i - 1) & (arq_window - 1)];
+    if (slot->acked)
+      later++;
+    else if (later >= PACKET_ARQ_FAST_RETRANSMIT && !slot->fast)
+    {
+      slot->fast = true;
+      arqResend(slot, now);
+    }
+  }
+
+  arqFreed();
+  arq_unlock();
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arqFreed()
+{
+  // arq lock held: the window moves past the acked frames, a waiting producer is woken
+  uint8_t base = arq_base;
+  while (arq_base != arq_next && arq_slots[arq_base & (arq_window - 1)].acked)
+    arq_base++;
+  arq_pending.store(arq_next - arq_base, std::memory_order_relaxed);
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (arq_base != base && arq_waiting)
+    xSemaphoreGive(arq_space);
+#else
+  (void)base;
+#endif
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::flushDataPort()
+void DevicePacket<R, N>::arqRtt(uint32_t sample)
 {
-  if (serial_dev == nullptr)
-    return;
-  // thread safe flush
+  // RFC 6298 estimator, in us
+  if (!arq_rtt_valid)
+  {
+    arq_srtt = sample;
+    arq_rttvar = sample / 2;
+    arq_rtt_valid = true;
+  }
+  else
+  {
+    uint32_t delta = arq_srtt > sample ? arq_srtt - sample : sample - arq_srtt;
+    arq_rttvar = (3 * arq_rttvar + delta) / 4;
+    arq_srtt = (7 * arq_srtt + sample) / 8;
+  }
+  uint32_t rto = arq_srtt + 4 * arq_rttvar;
+  arq_rto = std::min(std::max(rto, (uint32_t)PACKET_ARQ_MIN_RTO_MS * 1000), (uint32_t)PACKET_ARQ_MAX_RTO_MS * 1000);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arqResend(ArqSlot_t *slot, uint32_t now)
+{
+  // arq lock held, the writer lock is taken inside it
+  uint8_t *frame = arq_tx_frames.get() + (size_t)(slot - arq_slots.get()) * arq_frame_size;
   this->writer_lock();
-  serial_dev->flush();
+  portWrite(frame, slot->len);
+  this->writer_unlock();
+  slot->tries++;
+  slot->sent_at = now;
+  statAdd(stats.tx_retransmits);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arqRetransmit()
+{
+  // arq lock held: every frame whose timeout passed is sent again, with the timeout doubled
+  uint32_t now = micros();
+  for (uint8_t sequence = arq_base; sequence != arq_next; sequence++)
+  {
+    ArqSlot_t *slot = &arq_slots[sequence & (arq_window - 1)];
+    if (slot->acked || (uint32_t)(now - slot->sent_at) < slot->rto)
+      continue;
+    if (slot->tries > PACKET_ARQ_MAX_RETRIES)
+    {
+      arqReset();
+      return;
+    }
+    slot->rto = std::min(slot->rto * 2, (uint32_t)PACKET_ARQ_MAX_RTO_MS * 1000);
+    arqResend(slot, now);
+  }
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arqReset()
+{
+  // arq lock held: the peer has not answered for PACKET_ARQ_MAX_RETRIES timeouts, what is in
+  // flight is dropped and a new session starts, which the peer takes from its first frame
+  for (uint8_t sequence = arq_base; sequence != arq_next; sequence++)
+  {
+    if (!arq_slots[sequence & (arq_window - 1)].acked)
+      statAdd(stats.tx_dropped);
+  }
+  arq_session++;
+  arq_base = arq_next = 0;
+  arq_rtt_valid = false;
+  arq_rto = (uint32_t)PACKET_ARQ_INITIAL_RTO_MS * 1000;
+  arqFreed();
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (arq_waiting)
+    xSemaphoreGive(arq_space);
+#endif
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::arqWaitSpace()
+{
+  // arq lock held (and held again on return): sleeps until acks free the window, false after
+  // block_ms; the retransmission timers are served meanwhile in case nothing else reads the link
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  uint32_t deadline = (uint32_t)millis() + arq_block_ms;
+  while ((uint8_t)(arq_next - arq_base) >= arq_window)
+  {
+    int32_t left = (int32_t)(deadline - (uint32_t)millis());
+    if (left <= 0)
+      return false;
+    arq_waiting = true;
+    arq_unlock();
+    xSemaphoreTake(arq_space, pdMS_TO_TICKS(std::min((uint32_t)left, arq_rto / 1000 + 1)));
+    arq_lock();
+    arq_waiting = false;
+    arqRetransmit();
+  }
+  return true;
+#else
+  return false; // without an RTOS nothing reads the acks while the producer waits
+#endif
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::arqOut(uint8_t *buff, uint16_t size, uint8_t *header, uint8_t header_size)
+{
+  // the frame with the reliable prefix is built in its window slot, written, and kept there until
+  // acked; false when it does not fit a slot, the caller then sends it as it is
+  uint16_t packet_size = TRANSFER_DATA_ARQ_HEADER_LEN + header_size + size + CRC_BYTE_LEN;
+  if (packet_size >= N)
+  {
+    // too long for a slot with the prefix: it goes out as before, for the peer's onStream(), and
+    // is counted apart so the caller can tell that it was not protected
+    statAdd(stats.tx_unreliable);
+    return false;
+  }
+  uint8_t framing = tx_framing.load(std::memory_order_relaxed);
+  uint16_t signeture_len = signetureLen(framing, packet_size);
+
+  arq_lock();
+  if ((uint8_t)(arq_next - arq_base) >= arq_window && !arqWaitSpace())
+  {
+    arq_unlock();
+    statAdd(stats.tx_dropped); // the window stayed full for block_ms
+    return true;
+  }
+
+  uint8_t sequence = arq_next;
+  uint8_t index = sequence & (arq_window - 1);
+  uint8_t *frame = arq_tx_frames.get() + (size_t)index * arq_frame_size;
+  writeSigneture(frame, framing, packet_size);
+  uint8_t *body = frame + signeture_len;
+  body[0] = TRANSFER_DATA_BUFFER_SIG;
+  body[1] = BUFFER_ARQ_DATA_RESPNOSE;
+  body[2] = arq_session;
+  body[3] = sequence;
+  memcpy(body + TRANSFER_DATA_ARQ_HEADER_LEN, header, header_size);
+  if (size > 0)
+    memcpy(body + TRANSFER_DATA_ARQ_HEADER_LEN + header_size, buff, size);
+  uint16_t body_len = TRANSFER_DATA_ARQ_HEADER_LEN + header_size + size;
+  uint16_t crc = getCRC<uint8_t>(body, body_len);
+  body[body_len] = (uint8_t)(crc >> 8);
+  body[body_len + 1] = (uint8_t)crc;
+
+  ArqSlot_t *slot = &arq_slots[index];
+  slot->len = signeture_len + body_len + CRC_BYTE_LEN;
+  slot->tries = 1;
+  slot->acked = false;
+  slot->fast = false;
+  slot->rto = arq_rto;
+  slot->sent_at = micros();
+  arq_next = sequence + 1;
+  arq_pending.store(arq_next - arq_base, std::memory_order_relaxed);
+  uint16_t len = slot->len;
+  arq_unlock();
+
+  // written outside the arq lock so acks are taken in while the port is busy; the slot is not
+  // reused before the peer acked this very write
+  this->writer_lock();
+  portWrite(frame, len);
+  statAddSingle(stats.tx_frames);
   this->writer_unlock();
+  return true;
+}
+
+template <typename R, uint16_t N>
+PacketStats_t DevicePacket<R, N>::getStats()
+{
+  // a copy of the counters, each one read on its own (not a snapshot of all of them at one instant)
+  PacketStats_t copy;
+  copy.rx_bytes = stats.rx_bytes.load(std::memory_order_relaxed);
+  copy.rx_frames = stats.rx_frames.load(std::memory_order_relaxed);
+  copy.rx_dispatched = stats.rx_dispatched.load(std::memory_order_relaxed);
+  copy.rx_crc_errors = stats.rx_crc_errors.load(std::memory_order_relaxed);
+  copy.rx_timeouts = stats.rx_timeouts.load(std::memory_order_relaxed);
+  copy.rx_oversize = stats.rx_oversize.load(std::memory_order_relaxed);
+  copy.rx_queue_full = stats.rx_queue_full.load(std::memory_order_relaxed);
+  copy.rx_dropped = stats.rx_dropped.load(std::memory_order_relaxed);
+  copy.rx_unhandled = stats.rx_unhandled.load(std::memory_order_relaxed);
+  copy.rx_queue_peak = stats.rx_queue_peak.load(std::memory_order_relaxed);
+  copy.tx_bytes = stats.tx_bytes.load(std::memory_order_relaxed);
+  copy.tx_frames = stats.tx_frames.load(std::memory_order_relaxed);
+  copy.tx_dropped = stats.tx_dropped.load(std::memory_order_relaxed);
+  copy.rx_duplicates = stats.rx_duplicates.load(std::memory_order_relaxed);
+  copy.tx_retransmits = stats.tx_retransmits.load(std::memory_order_relaxed);
+  copy.tx_unreliable = stats.tx_unreliable.load(std::memory_order_relaxed);
+  return copy;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::resetStats()
+{
+  // rx_frames and rx_dispatched keep counting: their difference is the queue depth
+  stats.rx_bytes = 0;
+  stats.rx_crc_errors = 0;
+  stats.rx_timeouts = 0;
+  stats.rx_oversize = 0;
+  stats.rx_queue_full = 0;
+  stats.rx_dropped = 0;
+  stats.rx_unhandled = 0;
+  stats.rx_queue_peak = 0;
+  stats.tx_bytes = 0;
+  stats.tx_frames = 0;
+  stats.tx_dropped = 0;
+  stats.rx_duplicates = 0;
+  stats.tx_retransmits = 0;
+  stats.tx_unreliable = 0;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::enableStatsProperty(bool state)
+{
+  stats_property = state;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::statsCommand(const char *cmd, uint16_t cmd_len)
+{
+  // PACKET_STATS_PROPERTY as a text command or buffered text, only looked at when no handler claimed it
+  static const uint16_t len = sizeof(PACKET_STATS_PROPERTY) - 1;
+  if (!stats_property || cmd_len != len || memcmp(cmd, PACKET_STATS_PROPERTY, len) != 0)
+    return false;
+  statsOut();
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::statsOut()
+{
+  PacketStats_t copy = getStats();
+  restRawOut<PacketStats_t>(PACKET_STATS_PROPERTY, &copy);
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::enableTrace(uint16_t records)
+{
+  // setup-time call, before enableRxArena(): arena records carry the timestamps while tracing
+  if (rx_arena)
+    return false;
+
+  trace_histograms.reset(new PacketRegistry<TraceHistogram_t, PACKET_TRACE_CAPACITY, PACKET_TRACE_NAME_POOL>());
+  trace_records.reset(records > 0 ? new TraceRecord_t[records] : nullptr);
+  trace_records_size = records;
+  trace_records_next = 0;
+  trace_records_count = 0;
+  trace_open = nullptr;
+  rx_trace_open = false;
+  trace_enabled = true;
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::disableTrace()
+{
+  // setup-time call, like enableTrace(); the arena keeps its record layout until the device is gone
+  if (rx_arena)
+    return;
+  trace_enabled = false;
+  trace_open = nullptr;
+  trace_histograms.reset();
+  trace_records.reset();
+  trace_records_size = 0;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::traceFirst()
+{
+  // receiving thread: the first byte of the in-flight frame
+  rx_trace_first = rx_trace_polling ? rx_trace_since : PACKET_TRACE_CLOCK();
+  rx_trace_open = true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::tracePoll()
+{
+  uint32_t now = PACKET_TRACE_CLOCK();
+  uint32_t notified = rx_trace_notified.exchange(0, std::memory_order_relaxed);
+  rx_trace_since = notified != 0 ? notified : (rx_trace_polled != 0 ? rx_trace_polled : now);
+  rx_trace_polled = now;
+  rx_trace_polling = true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::traceFrameBegin(const FrameStamps_t *stamps)
+{
+  trace_frame = *stamps;
+  trace_dispatch = 0; // stamped by the first handler call, the clock is read as seldom as possible
+  trace_open = nullptr;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::traceFrameEnd()
+{
+  if (trace_open)
+    traceClose(PACKET_TRACE_CLOCK());
+  trace_open = nullptr;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::traceHandler(const char *name, uint8_t name_len)
+{
+  // processing thread, right before a handler is called: the previous call of a batch frame ends here
+  if (!trace_enabled)
+    return;
+  uint32_t now = PACKET_TRACE_CLOCK();
+  if (trace_open)
+    traceClose(now);
+  if (trace_dispatch == 0)
+    trace_dispatch = now | 1;
+
+  trace_open = trace_histograms->insert(TRACE_SLOT, name, name_len); // nullptr when full: not traced
+  if (trace_open == nullptr)
+    return;
+  trace_pending.first_byte = trace_frame.first_byte;
+  trace_pending.complete = trace_frame.complete;
+  trace_pending.dispatch = trace_dispatch;
+  trace_pending.handler = now;
+  uint8_t copy = name_len < PACKET_TRACE_NAME_LEN - 1 ? name_len : PACKET_TRACE_NAME_LEN - 1;
+  memcpy(trace_pending.name, name, copy);
+  trace_pending.name[copy] = '\0';
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::traceClose(uint32_t now)
+{
+  TraceHistogram_t *histogram = trace_open;
+  histogram->count++;
+  traceAdd(histogram->total, &histogram->total_max, now - trace_pending.first_byte);
+  traceAdd(histogram->wait, &histogram->wait_max, trace_pending.dispatch - trace_pending.complete);
+  traceAdd(histogram->handler, &histogram->handler_max, now - trace_pending.handler);
+
+  if (trace_records)
+  {
+    trace_pending.handler_end = now;
+    trace_records[trace_records_next] = trace_pending;
+    trace_records_next = (trace_records_next + 1) % trace_records_size;
+    trace_records_count++;
+  }
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::traceAdd(uint32_t *buckets, uint32_t *max, uint32_t ticks)
+{
+  // bucket i: [2^i, 2^(i+1)) ticks, 0 and 1 share bucket 0
+#if defined(__GNUC__)
+  uint8_t bucket = ticks > 1 ? 31 - __builtin_clz(ticks) : 0;
+  if (bucket > PACKET_TRACE_BUCKETS - 1)
+    bucket = PACKET_TRACE_BUCKETS - 1;
+#else
+  uint8_t bucket = 0;
+  while (bucket < PACKET_TRACE_BUCKETS - 1 && (ticks >> (bucket + 1)) != 0)
+    bucket++;
+#endif
+  buckets[bucket]++;
+  if (ticks > *max)
+    *max = ticks;
+}
+
+template <typename R, uint16_t N>
+uint16_t DevicePacket<R, N>::traceRecords(TraceRecord_t *out, uint16_t max_records)
+{
+  // the most recent records, oldest first; processing thread (or with it stopped)
+  uint32_t kept = trace_records_count < trace_records_size ? trace_records_count : trace_records_size;
+  uint16_t count = kept < max_records ? (uint16_t)kept : max_records;
+  uint16_t at = (trace_records_next + trace_records_size - count) % (trace_records_size ? trace_records_size : 1);
+  for (uint16_t i = 0; i < count; i++)
+    out[i] = trace_records[(at + i) % trace_records_size];
+  return count;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::dumpTrace(Print *out)
+{
+  // text dump of the histograms and the kept records; processing thread (or with it stopped)
+  char line[32 + PACKET_TRACE_BUCKETS * 11];
+  forEachTrace([&](const char *name, uint8_t name_len, const TraceHistogram_t *histogram)
+               {
+    int len = snprintf(line, sizeof(line), "%.*s: %u calls, max total %u wait %u handler %u\r\n", (int)name_len, name,
+                       (unsigned)histogram->count, (unsigned)histogram->total_max, (unsigned)histogram->wait_max, (unsigned)histogram->handler_max);
+    out->write((const uint8_t *)line, len);
+
+    const uint32_t *rows[3] = {histogram->total, histogram->wait, histogram->handler};
+    const char *row_names[3] = {"  total  ", "  wait   ", "  handler"};
+    for (uint8_t row = 0; row < 3; row++)
+    {
+      len = snprintf(line, sizeof(line), "%s", row_names[row]);
+      for (uint8_t i = 0; i < PACKET_TRACE_BUCKETS; i++)
+        len += snprintf(line + len, sizeof(line) - len, " %u", (unsigned)rows[row][i]);
+      len += snprintf(line + len, sizeof(line) - len, "\r\n");
+      out->write((const uint8_t *)line, len);
+    } });
+
+  uint32_t kept = trace_records_count < trace_records_size ? trace_records_count : trace_records_size;
+  uint16_t at = (trace_records_next + trace_records_size - kept) % (trace_records_size ? trace_records_size : 1);
+  for (uint16_t i = 0; i < kept; i++)
+  {
+    const TraceRecord_t *record = &trace_records[(at + i) % trace_records_size];
+    int len = snprintf(line, sizeof(line), "%s @%u complete +%u dispatch +%u handler +%u end +%u\r\n", record->name, (unsigned)record->first_byte,
+                       (unsigned)(record->complete - record->first_byte), (unsigned)(record->dispatch - record->first_byte),
+                       (unsigned)(record->handler - record->first_byte), (unsigned)(record->handler_end - record->first_byte));
+    out->write((const uint8_t *)line, len);
+  }
+}
+
+template <typename R, uint16_t N>
+size_t DevicePacket<R, N>::portWrite(const uint8_t *buff, size_t size)
+{
+  // writer lock held
+  size_t sent = serial_dev->write(buff, size);
+  statAddSingle(stats.tx_bytes, sent);
+  return sent;
+}
+
+template <typename R, uint16_t N>
+uint16_t DevicePacket<R, N>::getPacketLength(uint8_t *transfer_buff)
+{
+  if (transfer_buff[0] != packet_info[0] || transfer_buff[PACKET_SIGNETURE_LEN - 1] != packet_info[PACKET_SIGNETURE_LEN - 1])
+    return 0;
+
+  uint16_t packet_size = 0;
+  for (uint8_t i = 1; i < (PACKET_SIGNETURE_LEN - 1); i++)
+  {
+    if (packet_info[i] == 0x0F)
+    {
+      // data
+      if (transfer_buff[i] > 0x0F)
+      {
+        // if segment is invalid
+        return 0;
+      }
+      packet_size = (packet_size << 4) | transfer_buff[i];
+    }
+    else if (packet_info[i] != transfer_buff[i])
+    {
+      // format is not matching
+      return 0;
+    }
+  }
+
+  return packet_size;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::updatePacketLength(uint8_t *transfer_buff, uint16_t packet_size)
+{
+  memcpy(transfer_buff, packet_info, PACKET_SIGNETURE_LEN);
+  // Serial.printf("Updating packet length: %d \r\n", packet_size);
+  //{ (packet_size & 0xF000) >> 12, (packet_size & 0x0F00) >> 8, (packet_size & 0x00F0) >> 4, packet_size & 0x000F }
+  for (uint8_t i = 0; i < PACKET_SIGNETURE_DATA_LEN; i++)
+  {
+    transfer_buff[(i * 2) + 1] = (packet_size >> (12 - (i * 4))) & 0x0F;
+    // Serial.printf("Len byte %d : %02X \r\n", (i * 2) + 1, transfer_buff[(i * 2) + 1]);
+  }
+}
+
+template <typename R, uint16_t N>
+uint8_t DevicePacket<R, N>::compactCheck(const uint8_t *header, uint8_t len)
+{
+  // check byte of a compact header: CRC-16 of sync + varint folded to 8 bits
+  uint16_t crc = crc16CCITT(header, len, 0x0000);
+  return (uint8_t)(crc ^ (crc >> 8));
+}
+
+template <typename R, uint16_t N>
+uint16_t DevicePacket<R, N>::getCompactPacketLength(uint8_t *transfer_buff, uint16_t len)
+{
+  // a compact header ending at transfer_buff[len - 1]: sync0 sync1 varint(1-3 bytes) check
+  for (uint8_t varint_len = 1; varint_len <= 3; varint_len++)
+  {
+    uint8_t header_len = varint_len + 3;
+    if (len < header_len)
+      return 0;
+
+    uint8_t *header = transfer_buff + (len - header_len);
+    if (header[0] != PACKET_COMPACT_SYNC0 || header[1] != PACKET_COMPACT_SYNC1)
+      continue;
+
+    uint32_t packet_size = 0;
+    uint8_t i = 0;
+    for (; i < varint_len; i++)
+    {
+      // every byte but the last one has the continuation bit
+      uint8_t part = header[2 + i];
+      if (((part & 0x80) != 0) != (i + 1 < varint_len))
+        break;
+      packet_size |= (uint32_t)(part & 0x7F) << (7 * i);
+    }
+
+    if (i == varint_len && packet_size != 0 && packet_size <= 0xFFFF && header[header_len - 1] == compactCheck(header, header_len - 1))
+      return packet_size;
+  }
+  return 0;
+}
+
+template <typename R, uint16_t N>
+uint16_t DevicePacket<R, N>::compactHeaderAt(const uint8_t *bytes, size_t len, uint8_t *header_len)
+{
+  // a compact header starting at bytes[0], 0 when there is none (or it is not complete yet)
+  if (len < 4 || bytes[0] != PACKET_COMPACT_SYNC0 || bytes[1] != PACKET_COMPACT_SYNC1)
+    return 0;
+
+  uint32_t packet_size = 0;
+  uint8_t i = 0;
+  while (true)
+  {
+    if (i == 3 || (size_t)2 + i + 1 >= len)
+      return 0;
+    uint8_t part = bytes[2 + i];
+    packet_size |= (uint32_t)(part & 0x7F) << (7 * i);
+    i++;
+    if ((part & 0x80) == 0)
+      break;
+  }
+
+  if (packet_size == 0 || packet_size > 0xFFFF || bytes[2 + i] != compactCheck(bytes, 2 + i))
+    return 0;
+  *header_len = 3 + i;
+  return packet_size;
+}
+
+template <typename R, uint16_t N>
+uint8_t DevicePacket<R, N>::signetureLen(uint8_t framing, uint16_t packet_size)
+{
+  if (framing != PACKET_FRAMING_COMPACT)
+    return PACKET_SIGNETURE_LEN;
+  return 3 + (packet_size < 0x80 ? 1 : (packet_size < 0x4000 ? 2 : 3)); // sync(2) + varint + check
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::writeSigneture(uint8_t *transfer_buff, uint8_t framing, uint16_t packet_size)
+{
+  if (framing != PACKET_FRAMING_COMPACT)
+  {
+    updatePacketLength(transfer_buff, packet_size);
+    return;
+  }
+
+  uint8_t len = 0;
+  transfer_buff[len++] = PACKET_COMPACT_SYNC0;
+  transfer_buff[len++] = PACKET_COMPACT_SYNC1;
+  do
+  {
+    uint8_t part = packet_size & 0x7F;
+    packet_size >>= 7;
+    transfer_buff[len++] = packet_size ? (part | 0x80) : part;
+  } while (packet_size);
+  transfer_buff[len] = compactCheck(transfer_buff, len);
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::framingCommand(char *cmd, uint16_t cmd_len)
+{
+  // "#FR=<caps>": the peer can receive these framings, switch to them and answer with ours
+  // "#FA=<caps>": the answer to our own request; only the caps digit is read, a CRC may follow it
+  if (cmd_len < 5)
+    return false;
+  bool request = memcmp(cmd, FRAMING_REQUEST_CMD, 3) == 0;
+  if ((!request && memcmp(cmd, FRAMING_ACCEPT_CMD, 3) != 0) || cmd[3] != '=')
+    return false;
+
+  uint8_t peer_caps = (cmd[4] >= '0' && cmd[4] <= '9') ? cmd[4] - '0' : 0;
+  if (peer_caps & framing_caps & PACKET_FRAMING_COMPACT)
+    tx_framing = PACKET_FRAMING_COMPACT;
+
+  if (request)
+    dataOutToSerial(String(FRAMING_ACCEPT_CMD "=") + String(framing_caps));
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::negotiateFraming()
+{
+  // tell the peer what we can receive, it answers with what it can; old firmware ignores it
+  if (framing_caps != PACKET_FRAMING_NIBBLE)
+    dataOutToSerial(String(FRAMING_REQUEST_CMD "=") + String(framing_caps));
+}
+
+template <typename R, uint16_t N>
+uint8_t DevicePacket<R, N>::getFraming()
+{
+  return tx_framing.load(std::memory_order_relaxed);
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::dataOutToSerial(uint8_t *buff, uint16_t size, uint8_t *header, uint8_t header_size, uint8_t channel, int32_t sequence)
+{
+  if (serial_dev == nullptr && size == 0)
+    return;
+
+  // buffered records are packed into the open batch instead of getting a frame of their own,
+  // anything else goes out after the records already pending
+  if (batch_buff != nullptr)
+  {
+    if (channel == 0 && sequence == PACKET_NO_SEQUENCE && response_buffer_mode && header_size > 0 && batchAppend(buff, size, header, header_size))
+      return;
+    flushBatch();
+  }
+
+  if ((channel != 0 || sequence != PACKET_NO_SEQUENCE) && response_buffer_mode && header_size > 0)
+  {
+    // record of another channel and/or a request / reply: the channel prefix, then the sequence
+    // prefix go in front of its header, under the same CRC
+    uint8_t prefixed[TRANSFER_DATA_CHANNEL_HEADER_LEN + TRANSFER_DATA_SEQUENCE_HEADER_LEN + header_size];
+    uint8_t prefix_len = 0;
+    if (channel != 0)
+    {
+      prefixed[0] = TRANSFER_DATA_BUFFER_SIG;
+      prefixed[1] = BUFFER_CHANNEL_RESPNOSE;
+      prefixed[2] = channel;
+      prefix_len = TRANSFER_DATA_CHANNEL_HEADER_LEN;
+    }
+    if (sequence != PACKET_NO_SEQUENCE)
+    {
+      prefixed[prefix_len] = TRANSFER_DATA_BUFFER_SIG;
+      prefixed[prefix_len + 1] = BUFFER_SEQUENCE_RESPNOSE;
+      prefixed[prefix_len + 2] = (uint8_t)(sequence >> 8);
+      prefixed[prefix_len + 3] = (uint8_t)sequence;
+      prefix_len += TRANSFER_DATA_SEQUENCE_HEADER_LEN;
+    }
+    memcpy(prefixed + prefix_len, header, header_size);
+    frameOut(buff, size, prefixed, prefix_len + header_size, channel);
+    return;
+  }
+
+  frameOut(buff, size, header, header_size, channel);
 }
 
 template <typename R, uint16_t N>
-bool DevicePacket<R, N>::writeToPort(uint8_t *buff, uint16_t size)
+void DevicePacket<R, N>::frameOut(uint8_t *buff, uint16_t size, uint8_t *header, uint8_t header_size, uint8_t channel)
 {
-  if (serial_dev == nullptr)
-    return false;
+  // reliable delivery: binary frames (not the acks themselves) are kept until the peer acked them
+  if (arq_window != 0 && response_buffer_mode && header_size > 0 && header[1] != BUFFER_ARQ_ACK_RESPNOSE && arqOut(buff, size, header, header_size))
+    return;
 
-  // thread safe write
-  this->writer_lock();
-  serial_dev->write(buff, size);
-  this->writer_unlock();
+  uint8_t framing = tx_framing.load(std::memory_order_relaxed);
+  uint16_t packet_size = header_size + size + CRC_BYTE_LEN;
+  uint16_t signeture_len = response_buffer_mode ? signetureLen(framing, packet_size) : 0;
+  uint16_t end_len = CRC_BYTE_LEN + (response_buffer_mode ? 0 : delimeter_len);
+  uint32_t frame_size = (uint32_t)signeture_len + header_size + size + end_len;
+
+  uint16_t crc = header_size > 0 ? getCRC<uint8_t>(header, header_size) : 0;
+  crc = getCRC<uint8_t>(buff, size, crc);
+
+  if (tx_queues[0].ring != nullptr)
+  {
+    // async mode: the frame is copied into the TX ring and the writer task sends it
+    uint8_t transfer_buff[PACKET_SIGNETURE_LEN];
+    if (response_buffer_mode)
+      writeSigneture(transfer_buff, framing, packet_size);
+
+    uint8_t end_bytes[end_len] = {(uint8_t)(crc >> 8), (uint8_t)crc};
+    if (end_len > CRC_BYTE_LEN)
+      memcpy(end_bytes + CRC_BYTE_LEN, delimeters, delimeter_len);
+
+    const uint8_t *parts[4] = {transfer_buff, header, buff, end_bytes};
+    const uint16_t lens[4] = {signeture_len, header_size, size, end_len};
+    if (txEnqueue(channel, parts, lens, 4))
+      statAdd(stats.tx_frames);
+    return; // auto_flush is done by the writer
+  }
+
+  if (frame_size <= PACKET_TX_STAGING_LEN)
+  {
+    // gather signeture + header + payload + crc (+ delimeters) into one stack buffer so the frame
+    // leaves in a single serial_dev->write() (one USB/BT transfer, one syscall on a host tty);
+    // the frame is built outside the lock, the lock only covers the write itself
+    uint8_t staging[PACKET_TX_STAGING_LEN];
+    uint8_t *body = staging + signeture_len;
+    if (header_size > 0)
+      memcpy(body, header, header_size);
+    if (size > 0)
+      memcpy(body + header_size, buff, size);
+
+    uint16_t body_len = header_size + size;
+    body[body_len] = (uint8_t)(crc >> 8);
+    body[body_len + 1] = (uint8_t)crc;
+
+    if (response_buffer_mode)
+      writeSigneture(staging, framing, packet_size);
+    else if (delimeter_len > 0)
+      memcpy(body + body_len + CRC_BYTE_LEN, delimeters, delimeter_len);
+
+    this->writer_lock();
+    portWrite(staging, frame_size);
+    statAddSingle(stats.tx_frames); // synchronous frames are all counted under the writer lock
+    this->writer_unlock();
+  }
+  else
+  {
+    // bigger frames: signeture + header are still coalesced, the payload is written straight from
+    // the caller's memory instead of being copied, the crc (+ delimeters) closes the frame
+    uint8_t head[PACKET_SIGNETURE_LEN + header_size];
+    if (response_buffer_mode)
+      writeSigneture(head, framing, packet_size);
+    if (header_size > 0)
+      memcpy(head + signeture_len, header, header_size);
+
+    uint8_t end_bytes[end_len] = {(uint8_t)(crc >> 8), (uint8_t)crc};
+    if (end_len > CRC_BYTE_LEN)
+      memcpy(end_bytes + CRC_BYTE_LEN, delimeters, delimeter_len);
+
+    this->writer_lock();
+    if (signeture_len + header_size > 0)
+      portWrite(head, signeture_len + header_size);
+    portWrite(buff, size);
+    portWrite(end_bytes, end_len);
+    statAddSingle(stats.tx_frames);
+    this->writer_unlock();
+  }
 
   if (auto_flush)
     flushDataPort();
-  return true;
 }
 
 template <typename R, uint16_t N>
-uint16_t DevicePacket<R, N>::getPacketLength(uint8_t *transfer_buff)
+void DevicePacket<R, N>::textPut(TextFrame_t *frame, const char *text, size_t len)
 {
-  if (transfer_buff[0] != packet_info[0] || transfer_buff[PACKET_SIGNETURE_LEN - 1] != packet_info[PACKET_SIGNETURE_LEN - 1])
-    return 0;
+  while (len > 0)
+  {
+    if (frame->len == PACKET_TEXT_CHUNK_LEN)
+      textSpill(frame);
+    size_t take = PACKET_TEXT_CHUNK_LEN - frame->len;
+    take = take < len ? take : len;
+    memcpy(frame->chunk + frame->len, text, take);
+    frame->len += take;
+    text += take;
+    len -= take;
+  }
+}
 
-  uint16_t packet_size = 0;
-  for (uint8_t i = 1; i < (PACKET_SIGNETURE_LEN - 1); i++)
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::textSpill(TextFrame_t *frame)
+{
+  if (tx_queues[0].ring != nullptr && !frame->streaming)
   {
-    if (packet_info[i] == 0x0F)
+    // the TX ring takes whole frames only: collect it, the buffer doubles so a long array grows it
+    // O(log n) times, up to the longest frame the ring can hold (with its CRC and delimiter)
+    uint32_t limit = std::min(tx_queue_bytes, (uint32_t)0xFFFF) - CRC_BYTE_LEN - delimeter_len;
+    uint32_t need = frame->spill_len + frame->len;
+    if (need <= limit && need > frame->spill_capacity)
     {
-      // data
-      if (transfer_buff[i] > 0x0F)
+      uint32_t capacity = frame->spill_capacity ? frame->spill_capacity * 2 : PACKET_TEXT_CHUNK_LEN * 4;
+      capacity = std::min(std::max(capacity, need), limit);
+      char *grown = new (std::nothrow) char[capacity];
+      if (grown != nullptr)
       {
-        // if segment is invalid
-        return 0;
+        if (frame->spill_len > 0)
+          memcpy(grown, frame->spill.get(), frame->spill_len);
+        frame->spill.reset(grown);
+        frame->spill_capacity = capacity;
       }
-      packet_size = (packet_size << 4) | transfer_buff[i];
     }
-    else if (packet_info[i] != transfer_buff[i])
+    if (need <= frame->spill_capacity)
     {
-      // format is not matching
-      return 0;
+      memcpy(frame->spill.get() + frame->spill_len, frame->chunk, frame->len);
+      frame->spill_len += frame->len;
+      frame->len = 0;
+      return;
     }
+    // longer than the ring holds (or no memory to collect it): like txEnqueue() does for such a
+    // frame, everything queued before it goes first, then it is written from this thread
   }
 
-  return packet_size;
+  // synchronous: the frame is written as it is formatted, like the payload of a big binary frame
+  if (!frame->streaming)
+  {
+    if (batch_buff != nullptr)
+      flushBatch();
+    flushTx();
+    this->writer_lock();
+    frame->streaming = true;
+    if (frame->spill_len > 0)
+    {
+      frame->crc = getCRC<uint8_t>((uint8_t *)frame->spill.get(), frame->spill_len, frame->crc);
+      portWrite((uint8_t *)frame->spill.get(), frame->spill_len);
+      frame->spill_len = 0;
+    }
+  }
+  frame->crc = getCRC<uint8_t>((uint8_t *)frame->chunk, frame->len, frame->crc);
+  portWrite((uint8_t *)frame->chunk, frame->len);
+  frame->len = 0;
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::updatePacketLength(uint8_t *transfer_buff, uint16_t packet_size)
+void DevicePacket<R, N>::textEnd(TextFrame_t *frame)
 {
-  memcpy(transfer_buff, packet_info, PACKET_SIGNETURE_LEN);
-  // Serial.printf("Updating packet length: %d \r\n", packet_size);
-  //{ (packet_size & 0xF000) >> 12, (packet_size & 0x0F00) >> 8, (packet_size & 0x00F0) >> 4, packet_size & 0x000F }
-  for (uint8_t i = 0; i < PACKET_SIGNETURE_DATA_LEN; i++)
+  if (!frame->streaming && frame->spill_len > 0)
+    textSpill(frame); // the rest of chunk joins the collected bytes, or the frame turns out too long for the ring
+
+  if (frame->streaming)
   {
-    transfer_buff[(i * 2) + 1] = (packet_size >> (12 - (i * 4))) & 0x0F;
-    // Serial.printf("Len byte %d : %02X \r\n", (i * 2) + 1, transfer_buff[(i * 2) + 1]);
+    frame->crc = getCRC<uint8_t>((uint8_t *)frame->chunk, frame->len, frame->crc);
+    uint8_t end_bytes[CRC_BYTE_LEN + delimeter_len] = {(uint8_t)(frame->crc >> 8), (uint8_t)frame->crc};
+    memcpy(end_bytes + CRC_BYTE_LEN, delimeters, delimeter_len);
+    if (frame->len > 0)
+      portWrite((uint8_t *)frame->chunk, frame->len);
+    portWrite(end_bytes, CRC_BYTE_LEN + delimeter_len);
+    statAddSingle(stats.tx_frames);
+    this->writer_unlock();
+    frame->streaming = false;
+
+    if (auto_flush)
+      flushDataPort();
+  }
+  else if (frame->spill_len > 0)
+  {
+    dataOutToSerial((uint8_t *)frame->spill.get(), frame->spill_len);
+  }
+  else
+  {
+    dataOutToSerial((uint8_t *)frame->chunk, frame->len);
   }
+  frame->len = 0;
+  frame->spill_len = 0;
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::dataOutToSerial(uint8_t *buff, uint16_t size, uint8_t *header, uint8_t header_size)
+bool DevicePacket<R, N>::beginBatch(uint16_t max_frame_len, uint16_t max_age_ms)
 {
-  if (serial_dev == nullptr && size == 0)
-    return;
+  // max_frame_len is the receiver's N: it takes batch header + records + CRC below N, a frame of
+  // N bytes would already be oversize (or streamed) there
+  if (max_frame_len < TRANSFER_DATA_BATCH_HEADER_LEN + CRC_BYTE_LEN + 2)
+    return false;
 
-  uint16_t crc = header_size > 0 ? getCRC<uint8_t>(header, header_size) : 0;
-  crc = getCRC<uint8_t>(buff, size, crc);
+  endBatch();
+
+  this->batch_lock();
+  batch_capacity = max_frame_len - CRC_BYTE_LEN - 1;
+  batch_len = TRANSFER_DATA_BATCH_HEADER_LEN;
+  batch_count = 0;
+  batch_max_age = max_age_ms;
+  batch_buff = new uint8_t[batch_capacity];
+  this->batch_unlock();
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::flushBatch()
+{
+  this->batch_lock();
+  batchSend();
+  this->batch_unlock();
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::endBatch()
+{
+  this->batch_lock();
+  batchSend();
+  uint8_t *buff = batch_buff;
+  batch_buff = nullptr; // back to one frame per record
+  delete[] buff;
+  this->batch_unlock();
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::setDeltaMode(bool state, uint16_t keyframe_interval)
+{
+  this->delta_lock();
+  delta_mode = state;
+  delta_keyframe_interval = keyframe_interval; // the states are kept, both ends still hold the same previous frame
+  this->delta_unlock();
+}
 
-  if (response_buffer_mode)
+template <typename R, uint16_t N>
+DeltaState_t *DevicePacket<R, N>::deltaState(uint8_t kind, const char *name, uint8_t name_len, uint8_t data_type, uint8_t type_size, uint16_t count)
+{
+  DeltaState_t *state = delta_states.insert(kind, name, name_len);
+  if (state == nullptr)
+    return nullptr; // table or name pool full
+
+  if (!state->values || state->data_type != data_type || state->type_size != type_size || state->count != count)
   {
-    uint8_t crc_bytes[CRC_BYTE_LEN] = {(uint8_t)(crc >> 8), (uint8_t)crc};
-    uint16_t packet_size = header_size + size + CRC_BYTE_LEN;
+    // new property or its shape changed: start over from a keyframe
+    uint32_t data_len = (uint32_t)type_size * count;
+    state->values.reset(new uint8_t[(kind & DELTA_STATE_TX) ? data_len * 2 : data_len]); // kind: direction | channel << 2
+    state->data_type = data_type;
+    state->type_size = type_size;
+    state->count = count;
+    state->since_keyframe = 0;
+    state->synced = false;
+  }
+  return state;
+}
 
-    uint8_t transfer_buff[PACKET_SIGNETURE_LEN];
-    updatePacketLength(transfer_buff, packet_size);
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::arrayDeltaOut(String &properties, uint8_t data_type, uint8_t type_size, uint8_t *data, uint16_t data_size, uint8_t channel)
+{
+  uint8_t codec = deltaCodec(data_type, type_size);
+  if (codec == DELTA_CODEC_NONE || data_size == 0)
+    return false; // plain array frame
 
-    this->writer_lock();
-    serial_dev->write(transfer_buff, PACKET_SIGNETURE_LEN);
-    if (header_size > 0)
-      serial_dev->write(header, header_size);
-    serial_dev->write(buff, size);
-    serial_dev->write(crc_bytes, CRC_BYTE_LEN);
-    this->writer_unlock();
+  uint8_t pram_len = properties.length();
+  uint16_t data_len = type_size * data_size;
+
+  this->delta_lock();
+  DeltaState_t *state = deltaState(DELTA_STATE_TX | (channel << 2), properties.c_str(), pram_len, data_type, type_size, data_size);
+  if (state == nullptr)
+  {
+    this->delta_unlock();
+    return false;
+  }
+
+  // a delta only goes out when it is smaller than the array itself, anything else is a keyframe
+  uint8_t *encoded = state->values.get() + data_len;
+  bool keyframe = !state->synced || (delta_keyframe_interval != 0 && state->since_keyframe >= delta_keyframe_interval);
+  uint16_t payload_len = keyframe ? 0 : deltaEncode(codec, type_size, state->values.get(), data, data_size, encoded, data_len - 1);
+  if (payload_len == 0)
+  {
+    keyframe = true;
+    payload_len = data_len;
+  }
+
+  uint16_t header_size = TRANSFER_DATA_DELTA_HEADER_LEN + pram_len;
+  uint8_t header[header_size] = {TRANSFER_DATA_BUFFER_SIG, BUFFER_DELTA_ARRY_RESPNOSE, data_type, type_size, pram_len, (data_size >> 8) & 0xFF, data_size & 0xFF,
+                                 keyframe ? DELTA_FLAG_KEYFRAME : 0, state->sequence, (payload_len >> 8) & 0xFF, payload_len & 0xFF};
+  memcpy(header + TRANSFER_DATA_DELTA_HEADER_LEN, (uint8_t *)properties.c_str(), pram_len);
+
+  memcpy(state->values.get(), data, data_len);
+  state->since_keyframe = keyframe ? 1 : state->since_keyframe + 1;
+  state->synced = true;
+  state->sequence++;
+
+  // still under delta_locker, frames of one property have to leave in sequence order
+  dataOutToSerial(keyframe ? data : encoded, payload_len, header, header_size, channel);
+  this->delta_unlock();
+  return true;
+}
+
+template <typename R, uint16_t N>
+uint8_t *DevicePacket<R, N>::deltaReceive(uint8_t channel, const char *name, uint8_t name_len, uint8_t data_type, uint8_t type_size, uint16_t count, uint8_t flags, uint8_t sequence, const uint8_t *payload, uint16_t payload_len)
+{
+  // processing thread only; returns the rebuilt array, nullptr while waiting for a keyframe
+  uint32_t data_len = (uint32_t)type_size * count;
+  if (data_len == 0)
+    return nullptr;
+
+  DeltaState_t *state = deltaState(DELTA_STATE_RX | (channel << 2), name, name_len, data_type, type_size, count);
+  if (state == nullptr)
+    return nullptr;
+
+  bool applied;
+  if (flags & DELTA_FLAG_KEYFRAME)
+  {
+    applied = payload_len == data_len;
+    if (applied)
+      memcpy(state->values.get(), payload, data_len);
   }
   else
   {
-    uint8_t end_bytes[CRC_BYTE_LEN + delimeter_len] = {(uint8_t)(crc >> 8), (uint8_t)crc};
-    if (delimeter_len > 0)
-      memcpy(end_bytes + CRC_BYTE_LEN, delimeters, delimeter_len);
+    // a missing frame (sequence gap) or a broken one leaves the state unusable until the next keyframe
+    applied = state->synced && sequence == state->sequence &&
+              deltaDecode(deltaCodec(data_type, type_size), type_size, state->values.get(), count, payload, payload_len);
+  }
 
-    this->writer_lock();
-    if (header_size > 0)
-      serial_dev->write(header, header_size);
-    serial_dev->write(buff, size);
-    serial_dev->write(end_bytes, CRC_BYTE_LEN + delimeter_len);
-    this->writer_unlock();
+  state->synced = applied;
+  state->sequence = sequence + 1;
+  return applied ? state->values.get() : nullptr;
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::enablePublish(uint16_t interval_ms, bool publish_task)
+{
+  // setup-time call, the mailboxes are kept
+  disablePublish();
+
+#if !(defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION))
+  if (publish_task)
+    return false; // no RTOS: pass publish_task=false and call processPublish() from loop()
+#endif
+
+  publish_interval = interval_ms;
+  publish_last_at = millis();
+  this->publish_lock();
+  publish_enabled = true;
+  this->publish_unlock();
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (publish_task)
+  {
+    publish_wakeup = xSemaphoreCreateBinary();
+    publish_stopped = xSemaphoreCreateBinary();
+    publish_running = true;
+    if (xTaskCreate(publishTask, "packet_publish", PACKET_PUBLISH_TASK_STACK, this, PACKET_PUBLISH_TASK_PRIORITY, NULL) != pdPASS)
+    {
+      publish_running = false;
+      disablePublish();
+      return false;
+    }
+  }
+#endif
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::disablePublish()
+{
+  if (!publish_enabled)
+    return;
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  if (publish_running)
+  {
+    publish_running = false;
+    xSemaphoreGive(publish_wakeup);
+    xSemaphoreTake(publish_stopped, portMAX_DELAY);
+  }
+  if (publish_wakeup != NULL)
+  {
+    vSemaphoreDelete(publish_wakeup);
+    vSemaphoreDelete(publish_stopped);
+    publish_wakeup = publish_stopped = NULL;
   }
+#endif
 
-  if (auto_flush)
-    flushDataPort();
+  this->publish_lock();
+  publish_enabled = false;
+  this->publish_unlock();
+  publishDrain(); // the latest values still go out, from here on publish() sends right away
+}
+
+template <typename R, uint16_t N>
+uint16_t DevicePacket<R, N>::processPublish(bool now)
+{
+  if (!now && (uint32_t)(millis() - publish_last_at) < publish_interval)
+    return 0;
+  publish_last_at = millis();
+  return publishDrain();
+}
+
+template <typename R, uint16_t N>
+uint16_t DevicePacket<R, N>::publishDrain()
+{
+  // the dirty values are taken under the lock and sent after it, so a slow port never blocks publish()
+  struct pending_t
+  {
+    const char *name; // in the registry name pool, never moves
+    uint8_t name_len;
+    uint8_t value[8];
+    void (*out)(DevicePacket<R, N> *, const char *, uint8_t, const uint8_t *);
+  } pending[PACKET_PUBLISH_CAPACITY];
+  uint16_t count = 0;
+
+  this->publish_lock();
+  publish_slots.forEach(PUBLISH_SLOT, [&](const char *name, uint8_t name_len, PublishSlot_t<DevicePacket<R, N>> *slot)
+                        {
+    if (!slot->dirty)
+      return;
+    pending_t *item = &pending[count++];
+    item->name = name;
+    item->name_len = name_len;
+    memcpy(item->value, slot->value, sizeof(item->value));
+    item->out = slot->out;
+    slot->dirty = false;
+    slot->sent = slot->number;
+    slot->has_sent = true; });
+  this->publish_unlock();
+
+  for (uint16_t i = 0; i < count; i++)
+    pending[i].out(this, pending[i].name, pending[i].name_len, pending[i].value);
+  return count;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::publishTask(void *param)
+{
+  DevicePacket<R, N> *device = (DevicePacket<R, N> *)param;
+  while (device->publish_running)
+  {
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+    xSemaphoreTake(device->publish_wakeup, pdMS_TO_TICKS(device->publish_interval > 0 ? device->publish_interval : 1));
+#endif
+    if (device->publish_running)
+      device->publishDrain();
+  }
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(device->publish_stopped);
+  vTaskDelete(NULL);
+#endif
+}
+
+template <typename R, uint16_t N>
+bool DevicePacket<R, N>::batchAppend(uint8_t *buff, uint16_t size, uint8_t *header, uint8_t header_size)
+{
+  this->batch_lock();
+  if (batch_buff == nullptr)
+  {
+    this->batch_unlock();
+    return false; // batch closed meanwhile
+  }
+
+  // reliable delivery puts its prefix in front of the batch frame, it has to fit the receiver too
+  uint16_t capacity = batch_capacity - (arq_window != 0 ? TRANSFER_DATA_ARQ_HEADER_LEN : 0);
+  uint32_t record_len = (uint32_t)header_size + size;
+  if (batch_count > 0 && (batch_len + record_len > capacity || batch_count == 0xFFFF || (batch_max_age > 0 && (uint32_t)(millis() - batch_started_at) >= batch_max_age)))
+    batchSend(); // full or too old
+
+  if (TRANSFER_DATA_BATCH_HEADER_LEN + record_len > capacity)
+  {
+    // too big for any batch, goes out on its own after the pending records
+    this->batch_unlock();
+    return false;
+  }
+
+  if (batch_count == 0)
+    batch_started_at = millis();
+  memcpy(batch_buff + batch_len, header, header_size);
+  if (size > 0)
+    memcpy(batch_buff + batch_len + header_size, buff, size);
+  batch_len += record_len;
+  batch_count++;
+  this->batch_unlock();
+  return true;
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::batchSend()
+{
+  // batch_locker held
+  if (batch_buff == nullptr || batch_count == 0)
+    return;
+
+  // buff_signeture(1 byte)+data_signeture(1 byte)+record_count(2 bytes)+records
+  batch_buff[0] = TRANSFER_DATA_BUFFER_SIG;
+  batch_buff[1] = BUFFER_BATCH_RESPNOSE;
+  batch_buff[2] = batch_count >> 8;
+  batch_buff[3] = batch_count & 0xFF;
+  frameOut(batch_buff + TRANSFER_DATA_BATCH_HEADER_LEN, batch_len - TRANSFER_DATA_BATCH_HEADER_LEN, batch_buff, TRANSFER_DATA_BATCH_HEADER_LEN);
+
+  batch_len = TRANSFER_DATA_BATCH_HEADER_LEN;
+  batch_count = 0;
 }
 
 template <typename R, uint16_t N>
@@ -635,6 +3398,22 @@ void DevicePacket<R, N>::restOutError(String err)
   restOutStr("error", err);
 }
 
+template <typename R, uint16_t N>
+void PacketChannel<R, N>::onReceive(String name, void (*fun)())
+{
+  device->handler_channel = id;
+  device->onReceive(name, fun);
+  device->handler_channel = 0;
+}
+
+template <typename R, uint16_t N>
+void PacketChannel<R, N>::onReceive(String name, void (*fun)(R *, uint8_t, uint16_t, uint16_t))
+{
+  device->handler_channel = id;
+  device->onReceive(name, fun);
+  device->handler_channel = 0;
+}
+
 template <typename R, uint16_t N>
 void DevicePacket<R, N>::writer_lock()
 {
@@ -652,18 +3431,82 @@ void DevicePacket<R, N>::writer_unlock()
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::receiver_lock()
+void DevicePacket<R, N>::tx_lock()
+{
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreTake(this->tx_locker, portMAX_DELAY);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::tx_unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(this->tx_locker);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::delta_lock()
+{
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreTake(this->delta_locker, portMAX_DELAY);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::delta_unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(this->delta_locker);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arq_lock()
+{
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreTake(this->arq_locker, portMAX_DELAY);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::arq_unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(this->arq_locker);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::publish_lock()
+{
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreTake(this->publish_locker, portMAX_DELAY);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::publish_unlock()
+{
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
+  xSemaphoreGive(this->publish_locker);
+#endif
+}
+
+template <typename R, uint16_t N>
+void DevicePacket<R, N>::batch_lock()
 {
 #if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
-  xSemaphoreTake(this->receiver_locker, portMAX_DELAY);
+  xSemaphoreTake(this->batch_locker, portMAX_DELAY);
 #endif
 }
 
 template <typename R, uint16_t N>
-void DevicePacket<R, N>::receiver_unlock()
+void DevicePacket<R, N>::batch_unlock()
 {
 #if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
-  xSemaphoreGive(this->receiver_locker);
+  xSemaphoreGive(this->batch_locker);
 #endif
 }
 
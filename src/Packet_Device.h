@@ -41,11 +41,19 @@
 #include <map>
 #include <functional>
 #include <any>
+#include <atomic>
+#include <memory>
+#include <new> // std::nothrow
 #include <cstring> // For memcpy()
 
 #include <BluetoothSerial.h>
 #include <HardwareSerial.h>
 #include "./communication_flags.h"
+#include "./Packet_CRC.h"
+#include "./Packet_Registry.h"
+#include "./Packet_Delta.h"
+#include "./Packet_Format.h"
+#include "./Packet_Bound.h"
 
 #define MAX_COMMAND_QUEUE_LEN 5 // maximum 5 commands at once (default)
 #define MAX_COMMAND_DEFAULT_LEN 128
@@ -54,109 +62,689 @@
 #define PACKET_SIGNETURE_DATA_LEN 4
 #define PACKET_SIGNETURE_LEN 9
 
+// frame header formats, PACKET_FRAMING_COMPACT is also the capability bit of the handshake
+#define PACKET_FRAMING_NIBBLE 0x00  // the 9 byte signeture above
+#define PACKET_FRAMING_COMPACT 0x01 // sync word + varint length + check byte, 4 to 6 bytes
+#define PACKET_COMPACT_MAX_LEN 6
+
 #define TRANSFER_DATA_TEXT_HEADER_LEN 4 //buff_signeture(1 byte)+data_signeture(1 byte) +data_len(2 bytes)
 
 #define TRANSFER_DATA_PARAMS_HEADER_LEN 6 //buff_signeture(1 byte)+data_signeture(1 byte)+data_type(1 byte)+pram_len(1 bytes)+data_len(2 bytes)
 #define TRANSFER_DATA_ARRAY_HEADER_LEN 7 //buff_signeture(1 byte)+data_signeture(1 byte)+type(1 bytes)+type_size(1 bytes)+pram_len(1 bytes)+data_size(2 bytes)
+#define TRANSFER_DATA_BATCH_HEADER_LEN 4 //buff_signeture(1 byte)+data_signeture(1 byte)+record_count(2 bytes), then text/params/array records without CRC
+#define TRANSFER_DATA_DELTA_HEADER_LEN 11 //buff_signeture(1 byte)+data_signeture(1 byte)+type(1 bytes)+type_size(1 bytes)+pram_len(1 bytes)+data_size(2 bytes)+flags(1 byte)+sequence(1 byte)+payload_len(2 bytes)
+#define TRANSFER_DATA_CHANNEL_HEADER_LEN 3 //buff_signeture(1 byte)+data_signeture(1 byte)+channel(1 byte), in front of the record of a channel other than 0
+#define TRANSFER_DATA_SEQUENCE_HEADER_LEN 4 //buff_signeture(1 byte)+data_signeture(1 byte)+sequence(2 bytes), after the channel prefix of a request or reply record
+#define PACKET_NO_SEQUENCE -1                // records sent without a sequence prefix
+#define TRANSFER_DATA_ARQ_HEADER_LEN 4 //buff_signeture(1 byte)+data_signeture(1 byte)+session(1 byte)+sequence(1 byte), in front of every frame sent reliably
+#define TRANSFER_DATA_ARQ_ACK_LEN 8    //buff_signeture(1 byte)+data_signeture(1 byte)+session(1 byte)+next expected(1 byte)+received map(4 bytes)
 
 #define CRC_BYTE_LEN 2
+#define PACKET_RX_CRC_BATCH 16 // per-byte receive feeds the running CRC every 16 bytes
+
+#ifndef PACKET_TX_STAGING_LEN
+#define PACKET_TX_STAGING_LEN 128 // frames up to this size leave in a single write (stack buffer)
+#endif
+
+// asynchronous transmit (enableAsyncTx): what a producer does when the TX ring is full
+#define TX_QUEUE_BLOCK 0       // wait for the writer to make room
+#define TX_QUEUE_DROP_OLDEST 1 // evict the oldest queued frames
+#define TX_QUEUE_DROP_NEWEST 2 // discard the frame being sent
+
+// receive backpressure (setRxBackpressure): what the receiving side does when the receive queue is full
+#define RX_QUEUE_RETURN 0 // stop and report the bytes taken, the rest is offered again later
+#define RX_QUEUE_DROP 1   // keep receiving, a complete frame that finds no room is discarded whole
+#define RX_QUEUE_BLOCK 2  // wait up to block_ms for the processing thread, then as RX_QUEUE_RETURN
+
+// receive arena (enableRxArena)
+#define RX_ARENA_ALIGN 4       // records start on this boundary so their headers stay aligned
+#define RX_ARENA_WRAP 0xFFFF   // record length marking the jump back to the start of the arena
+
+// delta coded arrays (setDeltaMode)
+#define DELTA_FLAG_KEYFRAME 0x01 // the payload is the plain array, not a delta
+#define DELTA_STATE_TX 1
+#define DELTA_STATE_RX 2
+
+#ifndef PACKET_DELTA_KEYFRAME_INTERVAL
+#define PACKET_DELTA_KEYFRAME_INTERVAL 32 // frames per keyframe, a receiver that lost one resyncs at the next
+#endif
+
+#ifndef PACKET_DELTA_CAPACITY
+#define PACKET_DELTA_CAPACITY 8 // sent + received delta properties (power of two, one slot stays free)
+#endif
+
+#ifndef PACKET_DELTA_NAME_POOL
+#define PACKET_DELTA_NAME_POOL 128 // bytes for the names of those properties
+#endif
+
+// conflating publish (publish/enablePublish): per-property filter, the deadband argument
+#define PUBLISH_DEADBAND_OFF -1.0f // every new value is sent, only the latest one per interval
+#define PUBLISH_UNCHANGED 0.0f     // a value equal to the last sent one is not sent again
+#define PUBLISH_SLOT 1             // registry kind of the mailboxes
+
+#ifndef PACKET_PUBLISH_CAPACITY
+#define PACKET_PUBLISH_CAPACITY 16 // published properties (power of two, one slot stays free)
+#endif
+
+#ifndef PACKET_PUBLISH_NAME_POOL
+#define PACKET_PUBLISH_NAME_POOL 256 // bytes for the names of those properties
+#endif
 
-// CRC 256-entry lookup table for CRC-16/CCITT-FALSE
-static const uint16_t crc16_ccitt_tbl[256] = {
-    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
-    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
-    0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
-    0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
-    0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
-    0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
-    0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
-    0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
-    0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
-    0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
-    0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
-    0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
-    0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
-    0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
-    0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
-    0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
-    0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
-    0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
-    0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
-    0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
-    0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
-    0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
-    0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
-    0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
-    0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
-    0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
-    0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
-    0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
-    0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
-    0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
-    0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
-    0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0};
+#ifndef PACKET_PUBLISH_TASK_STACK
+#define PACKET_PUBLISH_TASK_STACK 4096
+#endif
+#ifndef PACKET_PUBLISH_TASK_PRIORITY
+#define PACKET_PUBLISH_TASK_PRIORITY 1
+#endif
+
+// event driven receive (enableEventReceive)
+#ifndef PACKET_RX_TASK_STACK
+#define PACKET_RX_TASK_STACK 4096
+#endif
+#ifndef PACKET_RX_TASK_PRIORITY
+#define PACKET_RX_TASK_PRIORITY 2
+#endif
+#ifndef PACKET_RX_IDLE_MS
+#define PACKET_RX_IDLE_MS 100 // the receive task also wakes this often without a notification (packet timeouts)
+#endif
+
+// link statistics (getStats/enableStatsProperty)
+#ifndef PACKET_STATS_PROPERTY
+#define PACKET_STATS_PROPERTY "stats" // command the host polls, answered with restRawOut of PacketStats_t
+#endif
+
+// reliable delivery (enableReliable): selective repeat over the frames of the binary protocol
+#define ARQ_MAX_WINDOW 32 // frames in flight, the selective ack map covers that many
+#ifndef PACKET_ARQ_INITIAL_RTO_MS
+#define PACKET_ARQ_INITIAL_RTO_MS 250 // retransmission timeout until the first RTT was measured
+#endif
+#ifndef PACKET_ARQ_MIN_RTO_MS
+#define PACKET_ARQ_MIN_RTO_MS 5
+#endif
+#ifndef PACKET_ARQ_MAX_RTO_MS
+#define PACKET_ARQ_MAX_RTO_MS 2000
+#endif
+#ifndef PACKET_ARQ_MAX_RETRIES
+#define PACKET_ARQ_MAX_RETRIES 10 // a frame sent this often without an ack: the link is lost, a new session starts
+#endif
+#ifndef PACKET_ARQ_FAST_RETRANSMIT
+#define PACKET_ARQ_FAST_RETRANSMIT 3 // a missing frame is sent again once this many later ones were acked
+#endif
+
+// latency tracing (enableTrace): clock of the timestamps, micros() on the board and the steady_clock
+// based micros() of the host build; any monotonic uint32_t clock can be plugged in
+#ifndef PACKET_TRACE_CLOCK
+#define PACKET_TRACE_CLOCK() ((uint32_t)micros())
+#endif
+#ifndef PACKET_TRACE_BUCKETS
+#define PACKET_TRACE_BUCKETS 20 // histogram bucket i counts [2^i, 2^(i+1)) clock ticks, the last one everything above
+#endif
+#ifndef PACKET_TRACE_CAPACITY
+#define PACKET_TRACE_CAPACITY 16 // traced handler names (power of two, one slot stays free)
+#endif
+#ifndef PACKET_TRACE_NAME_POOL
+#define PACKET_TRACE_NAME_POOL 256 // bytes for those names
+#endif
+#ifndef PACKET_TRACE_NAME_LEN
+#define PACKET_TRACE_NAME_LEN 12 // name bytes kept in a trace record, NUL included
+#endif
+#define TRACE_SLOT 1 // registry kind of the histograms
+
+#ifndef PACKET_TEXT_CHUNK_LEN
+#define PACKET_TEXT_CHUNK_LEN 256 // JSON text frames are formatted in this stack buffer, longer ones leave in pieces
+#endif
+
+// logical channels (addChannel/channel): every channel has its own handler namespace, and optionally
+// its own receive queue and TX queue; channel 0 is the plain protocol and carries no prefix
+#ifndef PACKET_CHANNELS
+#define PACKET_CHANNELS 4 // channel ids 0 .. PACKET_CHANNELS-1, at most 32
+#endif
+
+#ifndef PACKET_TX_CHUNK_LEN
+#define PACKET_TX_CHUNK_LEN 256 // bytes the writer takes out of the TX ring per Stream write
+#endif
+#ifndef PACKET_TX_TASK_STACK
+#define PACKET_TX_TASK_STACK 4096
+#endif
+#ifndef PACKET_TX_TASK_PRIORITY
+#define PACKET_TX_TASK_PRIORITY 1
+#endif
+
+// handler registry size (compile time, no heap after setup)
+#ifndef PACKET_HANDLER_CAPACITY
+#define PACKET_HANDLER_CAPACITY 64 // slots, power of two, about 2x the registered handlers
+#endif
+#ifndef PACKET_HANDLER_NAME_POOL
+#define PACKET_HANDLER_NAME_POOL 512 // bytes for all handler names
+#endif
+
+// handler kinds, one registry namespace each
+#define HANDLER_TEXT_PRAM_DATA 1 // COMMAND:PRAM=DATA
+#define HANDLER_TEXT_DATA 2      // COMMAND=DATA
+#define HANDLER_TEXT_PRAM 3      // COMMAND:PRAM
+#define HANDLER_PROCESS 4        // COMMAND (and buffered text)
+#define HANDLER_BUFFER 5         // buffered param/array data
+#define HANDLER_STREAM 6         // param/array frames bigger than N, delivered in chunks
+#define HANDLER_CHANNEL_SHIFT 3  // registry kind = kind | channel << 3, channel 0 keeps the plain kinds
+
+
+// receive timestamps of a queued frame (enableTrace), PACKET_TRACE_CLOCK ticks
+struct FrameStamps_t
+{
+  uint32_t first_byte = 0; // the first byte of the frame (its signeture) arrived
+  uint32_t complete = 0;   // the frame was queued
+};
 
 template <typename T, uint16_t N>
 struct Command_t
 {
   T data[N];
   uint16_t len = 0;
-  bool completed = false;
+  uint16_t crc = 0xFFFF; // CRC residue of the frame, 0 when its trailing CRC is valid
+  bool framed = false;   // arrived behind a packet signeture: only such frames carry prefixes, a delimited one is text
+  FrameStamps_t stamps;  // only written while tracing
 };
 
+// receive queue of a channel with its own slots (addChannel), frames are copied in from the
+// in-flight slot on publish; same single-producer/single-consumer protocol as commands_holder
+template <typename T, uint16_t N>
+struct RxChannel_t
+{
+  Command_t<T, N> *slots = nullptr; // nullptr: the channel shares commands_holder
+  uint16_t size = 0;
+  std::atomic<uint16_t> head{0}; // written by the receiving thread only
+  std::atomic<uint16_t> tail{0}; // written by the processing thread only
+};
+
+// asynchronous TX queue of one channel: whole frames in a byte ring plus their lengths
+struct TxQueue_t
+{
+  uint8_t *ring = nullptr; // nullptr: the channel is queued in the ring of channel 0
+  uint32_t size = 0;
+  uint32_t head = 0; // write offset
+  uint32_t tail = 0; // read offset
+  uint32_t used = 0; // queued bytes
+  uint16_t *frames = nullptr; // queued frame lengths, oldest at frame_tail
+  uint16_t frames_size = 0;
+  uint16_t frame_tail = 0;
+  uint16_t frame_count = 0;
+  uint16_t frame_sent = 0; // bytes of the oldest frame already taken by the writer
+  uint32_t deficit = 0;    // bytes the queue may still send in this round (deficit round robin)
+};
+
+// previous frame of one delta coded array property, one per direction
+struct DeltaState_t
+{
+  std::unique_ptr<uint8_t[]> values; // the previous frame (sending: followed by the encode buffer)
+  uint8_t data_type = 0;
+  uint8_t type_size = 0;
+  uint16_t count = 0;
+  uint8_t sequence = 0;        // next sequence number to send / expected
+  uint16_t since_keyframe = 0; // frames sent since the last keyframe
+  bool synced = false;         // false: only a keyframe can be applied (sent) next
+};
+
+// latest value mailbox of one published property, a newer value overwrites an unsent one
+template <typename D>
+struct PublishSlot_t
+{
+  uint8_t value[8];                   // the newest value, native bytes
+  double number = 0;                  // the same value as a number, for the deadband
+  double sent = 0;                    // the value last sent
+  float deadband = PUBLISH_DEADBAND_OFF;
+  bool dirty = false;                 // value not sent yet
+  bool has_sent = false;
+  void (*out)(D *, const char *, uint8_t, const uint8_t *) = nullptr; // restOut<T> of the published type
+};
+
+// JSON text frame being formatted (setBufferMode(false)). It stays in chunk while it fits; a longer
+// one is written out chunk by chunk with a running CRC, or collected in spill for the async TX ring.
+struct TextFrame_t
+{
+  char chunk[PACKET_TEXT_CHUNK_LEN];
+  uint16_t len = 0;       // bytes in chunk
+  uint16_t crc = 0x0000;  // CRC of the bytes already written out
+  bool streaming = false; // the frame is being written, writer lock held
+  std::unique_ptr<char[]> spill;
+  uint32_t spill_len = 0;
+  uint32_t spill_capacity = 0;
+};
+
+// record header in the receive arena, the frame bytes and a spare byte for the NUL follow (then,
+// while tracing, the FrameStamps_t of the frame on the next RX_ARENA_ALIGN boundary)
+struct ArenaRecord_t
+{
+  uint16_t len; // RX_ARENA_WRAP: the rest of the arena is unused, continue at offset 0
+  uint16_t crc;
+  bool framed; // Command_t::framed
+};
+
+// link statistics: LinkCounters_t<std::atomic<uint32_t>> inside the device, relaxed counters on the
+// hot paths (a plain load/store for the ones with a single writer), and LinkCounters_t<uint32_t>
+// (PacketStats_t) as the copy getStats() returns and the "stats" property sends; counters wrap around
+template <typename T>
+struct LinkCounters_t
+{
+  T rx_bytes{};      // bytes taken by the receiving side
+  T rx_frames{};     // frames queued
+  T rx_dispatched{}; // frames taken out of the queues by processingQueueCommands()
+  T rx_crc_errors{}; // binary frames (and streamed ones) whose CRC did not match
+  T rx_timeouts{};   // frames cut off by the packet timeout
+  T rx_oversize{};   // frames of N bytes or more without an onStream() handler, discarded
+  T rx_queue_full{}; // times receiving stopped at a full queue
+  T rx_dropped{};    // complete frames discarded for lack of room (RX_QUEUE_DROP, arena)
+  T rx_unhandled{};  // frames and commands without a handler
+  T rx_queue_peak{}; // most frames queued at once
+  T tx_bytes{};      // bytes written to the Stream
+  T tx_frames{};     // frames sent or queued for the writer
+  T tx_dropped{};    // frames discarded by the TX queue policy
+  T rx_duplicates{}; // reliable frames received again, already delivered or held (enableReliable)
+  T tx_retransmits{}; // reliable frames sent again, after a timeout or a gap in the acks
+  T tx_unreliable{};  // frames too long for a reliable slot, sent without the prefix (streamed by the peer)
+};
+
+typedef LinkCounters_t<uint32_t> PacketStats_t;
+
+// one reliable frame in flight (enableReliable), its wire bytes are kept until the peer acked it
+struct ArqSlot_t
+{
+  uint16_t len = 0;     // wire bytes of the frame
+  uint32_t sent_at = 0; // micros() of the last transmission
+  uint32_t rto = 0;     // us until it is sent again, doubled on every timeout
+  uint8_t tries = 0;    // transmissions, only frames sent once give an RTT sample (Karn)
+  bool acked = false;
+  bool fast = false; // sent again because later frames were acked, once per gap
+};
+
+// latency histograms of one handler name (enableTrace), PACKET_TRACE_CLOCK ticks
+struct TraceHistogram_t
+{
+  uint32_t total[PACKET_TRACE_BUCKETS] = {};   // first byte -> handler end
+  uint32_t wait[PACKET_TRACE_BUCKETS] = {};    // frame complete -> dispatch start (queue and polling gaps)
+  uint32_t handler[PACKET_TRACE_BUCKETS] = {}; // handler start -> handler end
+  uint32_t count = 0;
+  uint32_t total_max = 0;
+  uint32_t wait_max = 0;
+  uint32_t handler_max = 0;
+};
+
+// one traced handler call, kept in the ring of recent records (enableTrace(records))
+struct TraceRecord_t
+{
+  uint32_t first_byte;  // the first byte of the frame arrived
+  uint32_t complete;    // the frame was queued
+  uint32_t dispatch;    // processingQueueCommands() reached its first handler
+  uint32_t handler;     // the handler was called (a batch frame calls several)
+  uint32_t handler_end; // and returned
+  char name[PACKET_TRACE_NAME_LEN];
+};
+
+// non-owning view of a text command token, it points into the received frame and is only
+// valid inside the handler call; the parser NUL terminates every token in place
+struct TextView_t
+{
+  const char *data = "";
+  uint16_t len = 0;
+
+  uint16_t length() const { return len; }
+  const char *c_str() const { return data; }
+  char operator[](uint16_t index) const { return index < len ? data[index] : '\0'; }
+  bool equals(const char *str) const { return strlen(str) == len && memcmp(data, str, len) == 0; }
+  long toInt() const { return strtol(data, nullptr, 10); }
+  float toFloat() const { return strtof(data, nullptr); }
+  String toString() const { return String(data, len); }
+};
+
+template <typename R>
+struct Handler_t
+{
+  union
+  {
+    void (*buff)(R *, uint8_t, uint16_t, uint16_t) = nullptr; // HANDLER_BUFFER
+    void (*pram_data)(String, String);                         // HANDLER_TEXT_PRAM_DATA
+    void (*pram_data_view)(TextView_t, TextView_t);            // HANDLER_TEXT_PRAM_DATA (text_views)
+    void (*data)(String);                                      // HANDLER_TEXT_DATA, HANDLER_TEXT_PRAM
+    void (*data_view)(TextView_t);                             // HANDLER_TEXT_DATA, HANDLER_TEXT_PRAM (text_views)
+    void (*process)();                                         // HANDLER_PROCESS
+  };
+  bool text_views = false;                                   // zero-copy signature, else String adapter
+  std::function<void(R *, uint8_t, uint16_t, uint16_t)> any; // typed HANDLER_BUFFER with captures, takes precedence over buff
+
+  // typed HANDLER_BUFFER without captures: a thunk per T with the type check folded in, it calls
+  // typed_fun cast back to void (*)(T *) / void (*)(T *, uint16_t). Takes precedence over any.
+  void (*typed)(const Handler_t *, R *, uint8_t, uint16_t, uint16_t) = nullptr;
+  void (*typed_fun)() = nullptr;
+  void *target = nullptr; // bind<T>: the PacketBound<T> the payload is stored into
+
+  // HANDLER_STREAM
+  bool (*stream_begin)(uint8_t, uint16_t, uint16_t) = nullptr; // type, type_size, count like buff; false skips the frame
+  void (*stream_chunk)(R *, uint16_t, uint32_t) = nullptr;      // chunk, length, payload offset
+  void (*stream_end)(bool) = nullptr;                           // true: commit (CRC matched), false: abort
+};
+
+template <typename R, uint16_t N>
+class PacketChannel;
+template <typename R, uint16_t N>
+class PacketReply;
+
 template <typename R, uint16_t N>
 class DevicePacket
 {
+  friend class PacketChannel<R, N>;
+  friend class PacketReply<R, N>;
+
 private:
   Stream *serial_dev = NULL;
   bool response_buffer_mode = true;
   bool auto_flush = false;
 
+  // single-producer/single-consumer ring of received frames:
+  // readSerialCommand() fills commands_holder[rx_head] and publishes it by advancing rx_head,
+  // processingQueueCommands() dispatches from rx_tail and releases each slot by advancing rx_tail.
+  // One extra slot is allocated so the in-flight frame never aliases a queued one.
   Command_t<R, N> *commands_holder;
-  uint8_t max_command_queue_length = 0;
-  uint8_t current_commands_length = 0;
-  bool commpleted_cmd_read = false;
+  uint16_t commands_holder_size = 0;
+  std::atomic<uint16_t> rx_head{0}; // written by the receiving thread only
+  std::atomic<uint16_t> rx_tail{0}; // written by the processing thread only
+  Command_t<R, N> *rx_frame;        // the in-flight frame, owned by the receiving thread
+
+  // receive arena (enableRxArena): queued frames take only their own length out of one byte ring
+  // instead of a whole N-byte slot. commands_holder then is just the in-flight frame, it is copied
+  // into the arena on publish and the records are released in FIFO order as they are dispatched.
+  uint8_t *rx_arena = nullptr; // nullptr: fixed N-byte slots
+  uint32_t rx_arena_size = 0;
+  std::atomic<uint32_t> arena_head{0}; // write offset, receiving thread only
+  std::atomic<uint32_t> arena_tail{0}; // read offset, processing thread only
 
-  std::map<String, void (*)(String, String)> insert_pram_data_cmnds;
-  std::map<String, void (*)(String)> insert_data_cmnds;
-  std::map<String, void (*)(String)> get_pram_cmnds;
-  std::map<String, void (*)()> get_process_cmnds;
-  std::map<String, void (*)(R *, uint8_t, uint16_t, uint16_t)> get_response_buff;
-  std::map<String, std::function<void(R *, uint8_t, uint16_t, uint16_t)>> any_response_buff;
+  PacketRegistry<Handler_t<R>, PACKET_HANDLER_CAPACITY, PACKET_HANDLER_NAME_POOL> handlers;
 
   static uint8_t packet_info[PACKET_SIGNETURE_LEN]; // packet length signeture
   uint16_t packet_length = 0;
   uint64_t packet_timeout_at = 0; // packet receving timeout
 
+  // framing: what this device can receive (set at construction) and what frames are sent with,
+  // the latter switches to compact once the peer has announced it in the handshake
+  uint8_t framing_caps = PACKET_FRAMING_NIBBLE;
+  std::atomic<uint8_t> tx_framing{PACKET_FRAMING_NIBBLE};
+
+  uint16_t rx_crc = 0x0000; // running CRC of the in-flight frame
+  uint16_t rx_crc_len = 0;  // bytes of the in-flight frame already in rx_crc
+
+  // streaming receive (onStream): a frame of N bytes or more is passed through the head slot in
+  // chunks of up to N bytes instead of being queued, its CRC is checked when the last byte arrives
+  bool stream_enabled = false;     // an onStream() handler exists
+  uint16_t stream_length = 0;      // length of the frame being streamed, 0: not streaming
+  uint16_t stream_received = 0;    // bytes of that frame seen so far
+  uint16_t stream_header_len = 0;  // param/array header + name, 0 until it is complete
+  bool stream_draining = false;    // unknown or rejected frame, its bytes are skipped
+  Handler_t<R> *stream_handler = nullptr;
+
+  // event driven receive (enableEventReceive): notifyReceive(), or feedBytes() queuing a frame, wakes
+  // the receive task, which reads the Stream and dispatches right away instead of polling on a timer
+  bool rx_events = false;
+  bool rx_published = false;            // a frame was queued since feedBytes() last notified, receiving thread only
+  std::atomic<bool> rx_notified{false}; // no RTOS: notifyReceive() sets it, waitReceive() takes it
+  std::atomic<bool> rx_running{false};  // receive task alive
+  SemaphoreHandle_t rx_wakeup = NULL;   // notifyReceive -> receive task / waitReceive
+  SemaphoreHandle_t rx_stopped = NULL;  // task -> disableEventReceive: left its loop
+
+  // receive backpressure (setRxBackpressure): the receiving side only ever sleeps with RX_QUEUE_BLOCK
+  uint8_t rx_policy = RX_QUEUE_RETURN;
+  uint16_t rx_block_ms = 0;
+  std::atomic<bool> rx_waiting{false};  // the receiving thread sleeps in rxWaitSpace()
+  SemaphoreHandle_t rx_space = NULL;    // processing thread -> rxWaitSpace: a frame was dispatched
+
+  // link statistics (getStats): relaxed counters, cheap enough to stay on
+  LinkCounters_t<std::atomic<uint32_t>> stats;
+  bool stats_property = false; // PACKET_STATS_PROPERTY is answered when no handler claims it
+
+  // latency tracing (enableTrace): the receiving thread stamps the first byte and the completion of
+  // every frame into its slot, the processing thread the dispatch and every handler call, and adds
+  // them up per handler name; histograms and records are only touched by the processing thread
+  bool trace_enabled = false;
+  bool rx_trace_open = false;  // the in-flight frame has its first byte, receiving thread only
+  uint32_t rx_trace_first = 0; // when it arrived
+  // readSerialCommand() cannot see when bytes reached the Stream: they count from the notifyReceive()
+  // that woke it, else from the previous call (the earliest they can have come, so polling gaps show)
+  bool rx_trace_polling = false; // inside readSerialCommand()
+  uint32_t rx_trace_since = 0;   // arrival time of the bytes it reads
+  uint32_t rx_trace_polled = 0;  // when the previous call read the Stream
+  std::atomic<uint32_t> rx_trace_notified{0}; // notifyReceive() since, 0: none
+  std::unique_ptr<PacketRegistry<TraceHistogram_t, PACKET_TRACE_CAPACITY, PACKET_TRACE_NAME_POOL>> trace_histograms;
+  FrameStamps_t trace_frame;             // frame being dispatched
+  uint32_t trace_dispatch = 0;           // when its first handler was called, 0: not yet
+  TraceHistogram_t *trace_open = nullptr; // handler call being timed
+  TraceRecord_t trace_pending;           // and its record
+  std::unique_ptr<TraceRecord_t[]> trace_records; // ring of recent records, nullptr: none kept
+  uint16_t trace_records_size = 0;
+  uint16_t trace_records_next = 0;
+  uint32_t trace_records_count = 0; // records ever written
+
+  // reliable delivery (enableReliable): every binary frame gets a session + sequence prefix and a
+  // copy of its wire bytes stays in arq_tx_frames until the peer acks it; the receiving side holds
+  // frames that arrive ahead of a gap in arq_rx_frames and queues them in order once it is filled.
+  // Sender state is guarded by the writer lock, receiver state belongs to the receiving thread.
+  uint8_t arq_window = 0; // 0: off, else a power of two up to ARQ_MAX_WINDOW
+  uint16_t arq_block_ms = 0;
+  uint16_t arq_frame_size = 0; // bytes per kept frame, the longest that is not streamed
+  std::unique_ptr<ArqSlot_t[]> arq_slots;
+  std::unique_ptr<uint8_t[]> arq_tx_frames;
+  uint8_t arq_session = 0; // changes when the link was given up, the peer then starts over
+  uint8_t arq_base = 0;    // oldest sequence not acked yet
+  uint8_t arq_next = 0;    // next sequence to send
+  std::atomic<uint8_t> arq_pending{0}; // arq_next - arq_base, readable without the lock
+  bool arq_rtt_valid = false;
+  uint32_t arq_srtt = 0;   // smoothed RTT, us
+  uint32_t arq_rttvar = 0; // its variation, us
+  uint32_t arq_rto = (uint32_t)PACKET_ARQ_INITIAL_RTO_MS * 1000;
+  bool arq_waiting = false;           // a producer sleeps for window space
+  SemaphoreHandle_t arq_locker = NULL; // window state; taken before the writer lock, never after it
+  SemaphoreHandle_t arq_space = NULL; // acks -> producer: frames left the window
+  std::unique_ptr<R[]> arq_rx_frames;  // arq_window frames of N
+  std::unique_ptr<uint16_t[]> arq_rx_lens;
+  bool arq_rx_synced = false;   // a frame of the peer's session arrived
+  uint8_t arq_rx_session = 0;
+  uint8_t arq_rx_expected = 0;  // next sequence to queue
+  uint32_t arq_rx_held = 0;     // bit i: sequence arq_rx_expected + i is held in arq_rx_frames
+  bool arq_ack_due = false;     // a reliable frame arrived since the last ack
+
   R *delimeters;
   bool bulk_read_enabled = false;
+  R *rx_bulk = nullptr;     // enableBulkRead: the chunk read from the Stream
+  uint16_t rx_bulk_pos = 0; // bytes of it taken so far, the rest waits for room in the queue
+  uint16_t rx_bulk_len = 0;
 
   size_t delimeter_len = 0;
 
-  SemaphoreHandle_t receiver_locker = NULL;
   SemaphoreHandle_t writter_locker = NULL;
 
-  void commandProcess(R *data, uint16_t len);
+  // message batching (beginBatch/endBatch): params/array/text records are packed behind one
+  // batch header and leave as one frame, with one signeture and one CRC
+  uint8_t *batch_buff = nullptr; // nullptr: one frame per record
+  uint16_t batch_capacity = 0;   // batch header + records, the frame CRC is not stored
+  uint16_t batch_len = 0;
+  uint16_t batch_count = 0;
+  uint32_t batch_started_at = 0; // millis() of the oldest pending record
+  uint16_t batch_max_age = 0;    // ms, 0: only when full or on flushBatch/endBatch
+  SemaphoreHandle_t batch_locker = NULL;
+
+  // delta coded arrays (setDeltaMode): restArrayOut sends the difference to the previous frame of
+  // the same property, with a keyframe every delta_keyframe_interval frames
+  PacketRegistry<DeltaState_t, PACKET_DELTA_CAPACITY, PACKET_DELTA_NAME_POOL> delta_states;
+  bool delta_mode = false;
+  uint16_t delta_keyframe_interval = PACKET_DELTA_KEYFRAME_INTERVAL;
+  SemaphoreHandle_t delta_locker = NULL;
+
+  // conflating publish (publish/enablePublish): every property has one mailbox, producers only
+  // overwrite it, the dirty ones are sent every publish_interval ms by the publish task (or by
+  // processPublish() on boards without an RTOS)
+  PacketRegistry<PublishSlot_t<DevicePacket<R, N>>, PACKET_PUBLISH_CAPACITY, PACKET_PUBLISH_NAME_POOL> publish_slots;
+  bool publish_enabled = false; // false: publish() sends right away (after the deadband filter)
+  uint16_t publish_interval = 0;
+  uint32_t publish_last_at = 0; // millis() of the last drain
+  std::atomic<bool> publish_running{false}; // publish task alive
+  SemaphoreHandle_t publish_locker = NULL;
+  SemaphoreHandle_t publish_wakeup = NULL;  // disablePublish -> task: stop now
+  SemaphoreHandle_t publish_stopped = NULL; // task -> disablePublish: left its loop
+
+  // asynchronous transmit: producers copy finished frames into the TX queue of their channel and
+  // return at once, the writer task (or processTxQueue() on boards without an RTOS) moves them to
+  // the Stream, serving the queues by deficit round robin. Queue state is guarded by tx_locker,
+  // which is only ever held for a memcpy. tx_queues[0].ring == nullptr: synchronous transmit.
+  TxQueue_t tx_queues[PACKET_CHANNELS];
+  uint32_t tx_queue_bytes = 0;  // ring size of every queue (enableAsyncTx)
+  uint16_t tx_queue_frames = 0; // frame slots of every queue
+  uint8_t tx_turn = 0;          // queue the scheduler is serving
+  bool tx_turn_credited = false; // that queue got its quantum for this visit
+  uint8_t *tx_chunk = nullptr; // writer side copy, written to the Stream outside tx_locker
+  bool tx_writing = false;     // a chunk is taken but not written yet
+  uint8_t tx_policy = TX_QUEUE_BLOCK;
+  std::atomic<bool> tx_running{false}; // writer task alive
+
+  SemaphoreHandle_t tx_locker = NULL;
+  SemaphoreHandle_t tx_wakeup = NULL;  // producer -> writer: frames queued
+  SemaphoreHandle_t tx_space = NULL;   // writer -> producers/flushTx: room made, chunk written
+  SemaphoreHandle_t tx_stopped = NULL; // writer -> disableAsyncTx: task left its loop
+
+  // logical channels: frames of channel c > 0 start with a channel prefix record; a channel added
+  // with its own receive slots is queued there and dispatched round robin with the shared queue,
+  // channel_weights[c] frames (RX) or PACKET_TX_CHUNK_LEN * weight bytes (TX) per turn
+  RxChannel_t<R, N> rx_channels[PACKET_CHANNELS]; // [0] unused, channel 0 is commands_holder / the arena
+  uint8_t channel_weights[PACKET_CHANNELS];
+  uint32_t channel_mask = 1; // bit c: channel c was added (channel 0 always is)
+  bool rx_channel_queues = false; // any channel has its own receive slots
+  uint8_t handler_channel = 0;   // channel that addHandler() registers into (channel(c).onReceive)
+
+  // request / reply correlation: the channel and sequence id of the frame being dispatched, valid
+  // on the processing thread while its handlers run (reply() echoes them), and the id counter of
+  // the requests this side sends (nextSequence)
+  uint8_t rx_reply_channel = 0;
+  int32_t rx_sequence = PACKET_NO_SEQUENCE;
+  std::atomic<uint16_t> tx_sequence{0};
+
+  void commandProcess(R *data, uint16_t len, uint16_t crc_residue, bool framed);
+  void textCommandProcess(char *cmd, uint16_t cmd_len);
+  uint16_t bufferRecordProcess(R *data, uint16_t len, uint8_t channel);
+  static uint8_t channelKind(uint8_t kind, uint8_t channel);
+  static uint8_t frameChannel(const R *data, uint16_t len, bool framed);
 
   uint16_t getPacketLength(uint8_t *transfer_buff);
   void updatePacketLength(uint8_t *transfer_buff, uint16_t packet_size);
-  void dataOutToSerial(uint8_t *buff, uint16_t size,uint8_t *header=nullptr, uint8_t header_size=0);
+  uint16_t getCompactPacketLength(uint8_t *transfer_buff, uint16_t len);
+  static uint16_t compactHeaderAt(const uint8_t *bytes, size_t len, uint8_t *header_len);
+  static uint8_t compactCheck(const uint8_t *header, uint8_t len);
+  static uint8_t signetureLen(uint8_t framing, uint16_t packet_size);
+  void writeSigneture(uint8_t *transfer_buff, uint8_t framing, uint16_t packet_size);
+  bool framingCommand(char *cmd, uint16_t cmd_len);
+  void dataOutToSerial(uint8_t *buff, uint16_t size,uint8_t *header=nullptr, uint8_t header_size=0, uint8_t channel=0, int32_t sequence=PACKET_NO_SEQUENCE);
   void dataOutToSerial(String str);
+  void frameOut(uint8_t *buff, uint16_t size, uint8_t *header, uint8_t header_size, uint8_t channel = 0);
+  void textPut(TextFrame_t *frame, const char *text, size_t len);
+  template <typename T>
+  void textValue(TextFrame_t *frame, const T &value, uint8_t decimals);
+  void textSpill(TextFrame_t *frame);
+  void textEnd(TextFrame_t *frame);
+  bool batchAppend(uint8_t *buff, uint16_t size, uint8_t *header, uint8_t header_size);
+  void batchSend();
+  DeltaState_t *deltaState(uint8_t kind, const char *name, uint8_t name_len, uint8_t data_type, uint8_t type_size, uint16_t count);
+  bool arrayDeltaOut(String &properties, uint8_t data_type, uint8_t type_size, uint8_t *data, uint16_t data_size, uint8_t channel);
+  uint16_t publishDrain();
+  static void publishTask(void *param);
+  static void rxTask(void *param);
+  uint8_t *deltaReceive(uint8_t channel, const char *name, uint8_t name_len, uint8_t data_type, uint8_t type_size, uint16_t count, uint8_t flags, uint8_t sequence, const uint8_t *payload, uint16_t payload_len);
 
   void writer_lock();
   void writer_unlock();
-  void receiver_lock();
-  void receiver_unlock();
+
+  void tx_lock();
+  void tx_unlock();
+  void batch_lock();
+  void batch_unlock();
+  void delta_lock();
+  void delta_unlock();
+  void publish_lock();
+  void publish_unlock();
+  void arq_lock();
+  void arq_unlock();
+  bool txEnqueue(uint8_t channel, const uint8_t *parts[], const uint16_t lens[], uint8_t count);
+  bool txDropOldest(TxQueue_t *queue);
+  bool txAllocQueue(TxQueue_t *queue);
+  void txNextTurn();
+  void txWait();
+  static void txTask(void *param);
+
+  uint16_t nextSlot(uint16_t index);
+  bool queueFull();
+  bool rxWaitSpace(uint32_t deadline);
+  static void statAdd(std::atomic<uint32_t> &counter, uint32_t count = 1);
+  static void statAddSingle(std::atomic<uint32_t> &counter, uint32_t count = 1);
+  void framePublished();
+  void traceFirst();
+  void tracePoll();
+  void traceFrameBegin(const FrameStamps_t *stamps);
+  void traceFrameEnd();
+  void traceHandler(const char *name, uint8_t name_len);
+  void traceClose(uint32_t now);
+  static void traceAdd(uint32_t *buckets, uint32_t *max, uint32_t ticks);
+  void statsOut();
+  bool statsCommand(const char *cmd, uint16_t cmd_len);
+  size_t portWrite(const uint8_t *buff, size_t size);
+  void rxSpaceMade();
+  bool publishFrame(bool framed);
+  bool queueFrame();
+  bool arqReceive(Command_t<R, N> *cmd);
+  void arqDrain();
+  void arqAcked(const R *data);
+  void arqSendAck();
+  void arqService();
+  bool arqOut(uint8_t *buff, uint16_t size, uint8_t *header, uint8_t header_size);
+  bool arqWaitSpace();
+  void arqRetransmit();
+  void arqResend(ArqSlot_t *slot, uint32_t now);
+  void arqRtt(uint32_t sample);
+  void arqReset();
+  void arqFreed();
+  bool channelPush(RxChannel_t<R, N> *queue, Command_t<R, N> *cmd);
+  bool dispatchShared();
+  bool dispatchChannel(RxChannel_t<R, N> *queue);
+  uint32_t arenaRecordSize(uint16_t len);
+  FrameStamps_t *arenaStamps(ArenaRecord_t *record);
+  bool arenaFit(uint32_t need, uint32_t *at);
+  bool arenaPush(Command_t<R, N> *cmd);
+  void packetStart(uint16_t packet_size);
+  void updateRxCRC(Command_t<R, N> *cmd, uint16_t upto);
+  void resetRxCRC();
+  Handler_t<R> *addHandler(uint8_t kind, const String &name);
+  static void bufferDispatch(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t len);
+  template <typename T>
+  static bool typeMatches(uint8_t type, uint16_t type_size);
+  template <typename T>
+  static void typedThunk(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t len);
+  template <typename T>
+  static void typedCountThunk(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t len);
+  template <typename T, void (*F)(T *)>
+  static void staticThunk(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t len);
+  template <typename T>
+  static void boundThunk(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t len);
 
   bool queueCheck();
   bool processEachData(R inchar);
+  size_t processChunk(R *all_bytes, size_t len);
+  void streamStart(uint16_t packet_size);
+  size_t processStreamBytes(R *all_bytes, size_t len);
+  bool streamHeader(Command_t<R, N> *cmd);
+  void streamChunkOut(Command_t<R, N> *cmd);
+  void streamEnd(bool commit);
 
 public:
   template <size_t D>
-  DevicePacket(Stream *serial, uint8_t receiver_size, const R (&del)[D])
+  DevicePacket(Stream *serial, uint8_t receiver_size, const R (&del)[D], uint8_t framing = PACKET_FRAMING_NIBBLE)
   {
-    commands_holder = new Command_t<R, N>[receiver_size];
-    max_command_queue_length = receiver_size;
+    framing_caps = framing;
+
+    commands_holder_size = (uint16_t)receiver_size + 1; // +1 for the in-flight frame
+    commands_holder = new Command_t<R, N>[commands_holder_size];
+    rx_frame = commands_holder;
 
     delimeters = new R[D];
     std::memcpy(delimeters, del, D * sizeof(R)); // Copy memory block
@@ -164,9 +752,15 @@ public:
 
     serial_dev = serial;
 
+    for (uint8_t i = 0; i < PACKET_CHANNELS; i++)
+      channel_weights[i] = 1;
+
 #if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
-    receiver_locker = xSemaphoreCreateMutex();
     writter_locker = xSemaphoreCreateMutex();
+    batch_locker = xSemaphoreCreateMutex();
+    delta_locker = xSemaphoreCreateMutex();
+    publish_locker = xSemaphoreCreateMutex();
+    arq_locker = xSemaphoreCreateMutex();
 #endif
   }
 
@@ -190,15 +784,28 @@ public:
 
   ~DevicePacket()
   {
+    disableEventReceive();
+    disablePublish();
+    endBatch();
+    disableAsyncTx();
+    disableReliable();
 
 #if defined(ARDUINO_ARCH_ESP32) || defined(ESP32) || defined(FREERTOS) || defined(configUSE_PREEMPTION)
-    vSemaphoreDelete(receiver_locker);
     vSemaphoreDelete(writter_locker);
+    vSemaphoreDelete(batch_locker);
+    vSemaphoreDelete(delta_locker);
+    vSemaphoreDelete(publish_locker);
+    vSemaphoreDelete(arq_locker);
+    if (rx_space != NULL)
+      vSemaphoreDelete(rx_space);
 #endif
 
-    delete serial_dev;
+    // serial_dev is not owned by the packet device
     delete[] commands_holder;
-    delete &insert_pram_data_cmnds, &insert_data_cmnds, &get_pram_cmnds, &get_process_cmnds, &get_response_buff, &any_response_buff;
+    for (uint8_t i = 1; i < PACKET_CHANNELS; i++)
+      delete[] rx_channels[i].slots;
+    delete[] rx_arena;
+    delete[] rx_bulk;
     delete[] delimeters;
   }
 
@@ -217,34 +824,95 @@ public:
 
   void onReceive(String name, void (*fun)(String, String));
   void onReceive(String name, void (*fun)(String), bool prams = false);
+  void onReceive(String name, void (*fun)(TextView_t, TextView_t));
+  void onReceive(String name, void (*fun)(TextView_t), bool prams = false);
   void onReceive(String name, void (*fun)());
   void onReceive(String name, void (*fun)(R *, uint8_t, uint16_t, uint16_t));
+  void onStream(String name, void (*chunk)(R *, uint16_t, uint32_t), void (*end)(bool), bool (*begin)(uint8_t, uint16_t, uint16_t) = nullptr);
+  template <typename T, typename F>
+  void onReceive(String name, F fun);
+  template <typename T, void (*F)(T *)>
+  void onReceive(String name);
   template <typename T>
-  void onReceive(String name, std::function<void(T *)> fun);
-  template <typename T>
-  void onReceive(String name, std::function<void(T *, uint16_t)> fun);
+  void bind(String name, PacketBound<T> *dest);
 
-  void processBytes(R *all_bytes, size_t len);
-  void feedBytes(R *all_bytes, size_t len);
+  size_t processBytes(R *all_bytes, size_t len);
+  size_t feedBytes(R *all_bytes, size_t len);
   void readSerialCommand();
   void processingQueueCommands();
+  bool enableRxArena(uint32_t arena_size);
+  void setRxBackpressure(uint8_t policy, uint16_t block_ms = 0);
+  uint32_t rxDropped();
+
+  bool enableEventReceive(bool receive_task = true);
+  void disableEventReceive();
+  void notifyReceive();
+  void notifyReceiveFromISR();
+  bool waitReceive(uint32_t timeout_ms = 0xFFFFFFFF);
+  void serviceReceive();
 
   void setDevicePort(Stream *serial);
   bool getBufferMode();
   void setBufferMode(bool state);
   void setAutoFlush(bool state);
   void flushDataPort();
+  void negotiateFraming();
+  uint8_t getFraming();
   bool writeToPort(uint8_t *buff, uint16_t size);
 
+  bool enableAsyncTx(uint32_t ring_size, uint16_t max_frames, uint8_t policy = TX_QUEUE_BLOCK, bool writer_task = true);
+  void disableAsyncTx();
+  bool processTxQueue();
+  bool flushTx(uint32_t timeout_ms = 0xFFFFFFFF);
+  uint32_t txPending();
+  uint32_t txDropped();
+
+  PacketStats_t getStats();
+  void resetStats();
+  void enableStatsProperty(bool state = true);
+
+  bool enableReliable(uint8_t window = 8, uint16_t block_ms = 100);
+  void disableReliable();
+  void processReliable();
+  uint8_t reliablePending();
+  uint32_t reliableRto();
+
+  bool enableTrace(uint16_t records = 0);
+  void disableTrace();
+  template <typename F>
+  void forEachTrace(F fn);
+  uint16_t traceRecords(TraceRecord_t *out, uint16_t max_records);
+  void dumpTrace(Print *out);
+
+  bool addChannel(uint8_t channel, uint8_t weight = 1, uint8_t receiver_size = 0);
+  PacketChannel<R, N> channel(uint8_t channel);
+
+  PacketReply<R, N> reply();
+  PacketReply<R, N> sequenced(uint16_t sequence, uint8_t channel = 0);
+  uint16_t nextSequence();
+  bool rxSequence(uint16_t *sequence);
+
+  bool beginBatch(uint16_t max_frame_len = N, uint16_t max_age_ms = 0);
+  void flushBatch();
+  void endBatch();
+
+  void setDeltaMode(bool state, uint16_t keyframe_interval = PACKET_DELTA_KEYFRAME_INTERVAL);
+
+  bool enablePublish(uint16_t interval_ms, bool publish_task = true);
+  void disablePublish();
+  uint16_t processPublish(bool now = false);
+  template <typename T>
+  bool publish(String properties, T value, float deadband = PUBLISH_DEADBAND_OFF);
+
   // Template function
   template <typename T>
-  void restRawOut(String properties, T *payload);
+  void restRawOut(String properties, T *payload, uint8_t channel = 0, int32_t sequence = PACKET_NO_SEQUENCE);
   // Template function
   template <typename T, bool NSL = false>
-  void restOut(String properties, T payload);
+  void restOut(String properties, T payload, uint8_t channel = 0, int32_t sequence = PACKET_NO_SEQUENCE);
   // Template function
   template <typename T>
-  void restArrayOut(String properties, T data[], uint16_t data_size);
+  void restArrayOut(String properties, T data[], uint16_t data_size, uint8_t channel = 0, int32_t sequence = PACKET_NO_SEQUENCE);
 
   void restOutStr(String properties, String payload);
   void restOutFloat(String properties, float payload);
@@ -255,6 +923,66 @@ public:
   void restOutError(String err);
 };
 
+// one logical channel of a DevicePacket (device.channel(id)): handlers registered through it only
+// see frames of that channel, frames sent through it carry the channel prefix. A small value type,
+// it can be kept or created again whenever needed.
+template <typename R, uint16_t N>
+class PacketChannel
+{
+private:
+  DevicePacket<R, N> *device;
+  uint8_t id;
+
+public:
+  PacketChannel(DevicePacket<R, N> *device, uint8_t id) : device(device), id(id) {}
+
+  uint8_t getId() { return id; }
+
+  void onReceive(String name, void (*fun)());
+  void onReceive(String name, void (*fun)(R *, uint8_t, uint16_t, uint16_t));
+  template <typename T, typename F>
+  void onReceive(String name, F fun);
+  template <typename T, void (*F)(T *)>
+  void onReceive(String name);
+  template <typename T>
+  void bind(String name, PacketBound<T> *dest);
+
+  template <typename T>
+  void restRawOut(String properties, T *payload) { device->template restRawOut<T>(properties, payload, id); }
+  template <typename T, bool NSL = false>
+  void restOut(String properties, T payload) { device->template restOut<T, NSL>(properties, payload, id); }
+  template <typename T>
+  void restArrayOut(String properties, T data[], uint16_t data_size) { device->template restArrayOut<T>(properties, data, data_size, id); }
+};
+
+// where a record goes as a request or a reply: a channel and a sequence id the peer matches the
+// answer by. device.reply() inside a handler echoes the frame being dispatched (no id when it had
+// none, the reply is then an ordinary record), device.sequenced(id) starts a request. A small value
+// type, handlers can keep it and answer later, out of order with other requests.
+template <typename R, uint16_t N>
+class PacketReply
+{
+private:
+  DevicePacket<R, N> *device;
+  uint8_t channel;
+  int32_t sequence;
+
+public:
+  PacketReply(DevicePacket<R, N> *device, uint8_t channel, int32_t sequence) : device(device), channel(channel), sequence(sequence) {}
+
+  uint8_t getChannel() { return channel; }
+  bool hasSequence() { return sequence != PACKET_NO_SEQUENCE; }
+  uint16_t getSequence() { return (uint16_t)sequence; }
+
+  template <typename T>
+  void restRawOut(String properties, T *payload) { device->template restRawOut<T>(properties, payload, channel, sequence); }
+  template <typename T, bool NSL = false>
+  void restOut(String properties, T payload) { device->template restOut<T, NSL>(properties, payload, channel, sequence); }
+  template <typename T>
+  void restArrayOut(String properties, T data[], uint16_t data_size) { device->template restArrayOut<T>(properties, data, data_size, channel, sequence); }
+  void restOutStr(String properties, String payload) { device->template restOut<String>(properties, payload, channel, sequence); }
+};
+
 #include "./Packet_Device_t.h"
 
 #endif
\ No newline at end of file
@@ -3,30 +3,144 @@ uint8_t DevicePacket<R, N>::packet_info[PACKET_SIGNETURE_LEN] = {'<', 0x0F, '-',
 
 template <typename R, uint16_t N>
 template <typename T>
-void DevicePacket<R, N>::onReceive(String name, std::function<void(T *)> fun)
+bool DevicePacket<R, N>::typeMatches(uint8_t type, uint16_t type_size)
 {
-  any_response_buff[name] = [cb = std::move(fun)](R *buffer, uint8_t type, uint16_t type_size, uint16_t len)
-  {
-    // Serial.println("Type:"+String(type)+",  retype:"+String(getTypeID<T>())+",  size:"+String(sizeof(T))+",  rsize:"+String(type_size));
+  // getTypeID<T>() is a constant, so this is a single compare for most T
+  return type == getTypeID<T>() || (type == DATA_TYPE_VOID && sizeof(T) == type_size);
+}
 
-    if (buffer && (type == getTypeID<T>() || (type == DATA_TYPE_VOID && sizeof(T) == type_size)))
-    {
-      cb((T *)(buffer)); // Safely cast buffer to desired type
-    }
-  };
+template <typename R, uint16_t N>
+template <typename T>
+void DevicePacket<R, N>::typedThunk(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t)
+{
+  if (buffer && typeMatches<T>(type, type_size))
+    reinterpret_cast<void (*)(T *)>(handler->typed_fun)((T *)buffer);
+}
+
+template <typename R, uint16_t N>
+template <typename T>
+void DevicePacket<R, N>::typedCountThunk(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t len)
+{
+  if (buffer && typeMatches<T>(type, type_size))
+    reinterpret_cast<void (*)(T *, uint16_t)>(handler->typed_fun)((T *)buffer, len);
+}
+
+template <typename R, uint16_t N>
+template <typename T, void (*F)(T *)>
+void DevicePacket<R, N>::staticThunk(const Handler_t<R> *, R *buffer, uint8_t type, uint16_t type_size, uint16_t)
+{
+  if (buffer && typeMatches<T>(type, type_size))
+    F((T *)buffer); // known at compile time, can be inlined here
 }
 
 template <typename R, uint16_t N>
 template <typename T>
-void DevicePacket<R, N>::onReceive(String name, std::function<void(T *, uint16_t)> fun)
+void DevicePacket<R, N>::boundThunk(const Handler_t<R> *handler, R *buffer, uint8_t type, uint16_t type_size, uint16_t len)
 {
-  any_response_buff[name] = [cb = std::move(fun)](R *buffer, uint8_t type, uint16_t type_size, uint16_t len)
+  // one whole value only: an array record of several, or a record shorter than T (its type id
+  // alone matches), does not fit the target; store() copies sizeof(T) bytes
+  if (buffer && len == 1 && type_size == sizeof(T) && typeMatches<T>(type, type_size))
+    static_cast<PacketBound<T> *>(handler->target)->store(buffer);
+}
+
+template <typename R, uint16_t N>
+template <typename T, typename F>
+void DevicePacket<R, N>::onReceive(String name, F fun)
+{
+  Handler_t<R> *handler = addHandler(HANDLER_BUFFER, name);
+  if (handler == nullptr)
+    return;
+
+  handler->buff = nullptr;
+  handler->any = nullptr;
+  handler->typed = nullptr;
+
+  // functions and lambdas without captures go through a thunk, anything else through std::function
+  if constexpr (std::is_convertible<F, void (*)(T *)>::value)
+  {
+    handler->typed_fun = reinterpret_cast<void (*)()>(static_cast<void (*)(T *)>(fun));
+    handler->typed = &DevicePacket<R, N>::template typedThunk<T>;
+  }
+  else if constexpr (std::is_convertible<F, void (*)(T *, uint16_t)>::value)
   {
-    if (buffer && (type == getTypeID<T>() || (type == DATA_TYPE_VOID && sizeof(T) == type_size)))
+    handler->typed_fun = reinterpret_cast<void (*)()>(static_cast<void (*)(T *, uint16_t)>(fun));
+    handler->typed = &DevicePacket<R, N>::template typedCountThunk<T>;
+  }
+  else if constexpr (std::is_invocable<F, T *>::value)
+  {
+    handler->any = [cb = std::move(fun)](R *buffer, uint8_t type, uint16_t type_size, uint16_t)
     {
-      cb((T *)(buffer), len); // Safely cast buffer to desired type
-    }
-  };
+      // Serial.println("Type:"+String(type)+",  retype:"+String(getTypeID<T>())+",  size:"+String(sizeof(T))+",  rsize:"+String(type_size));
+      if (buffer && typeMatches<T>(type, type_size))
+        cb((T *)(buffer)); // Safely cast buffer to desired type
+    };
+  }
+  else
+  {
+    static_assert(std::is_invocable<F, T *, uint16_t>::value, "onReceive<T> handlers take (T *) or (T *, uint16_t count)");
+    handler->any = [cb = std::move(fun)](R *buffer, uint8_t type, uint16_t type_size, uint16_t len)
+    {
+      if (buffer && typeMatches<T>(type, type_size))
+        cb((T *)(buffer), len);
+    };
+  }
+}
+
+template <typename R, uint16_t N>
+template <typename T, void (*F)(T *)>
+void DevicePacket<R, N>::onReceive(String name)
+{
+  Handler_t<R> *handler = addHandler(HANDLER_BUFFER, name);
+  if (handler == nullptr)
+    return;
+
+  handler->buff = nullptr;
+  handler->any = nullptr;
+  handler->typed = &DevicePacket<R, N>::template staticThunk<T, F>;
+}
+
+template <typename R, uint16_t N>
+template <typename T>
+void DevicePacket<R, N>::bind(String name, PacketBound<T> *dest)
+{
+  // the payload goes straight from the frame into dest, no handler is called; dest must outlive
+  // the device, other tasks read it with dest->load() while this one keeps writing
+  Handler_t<R> *handler = addHandler(HANDLER_BUFFER, name);
+  if (handler == nullptr)
+    return;
+
+  handler->buff = nullptr;
+  handler->any = nullptr;
+  handler->typed_fun = nullptr;
+  handler->target = dest;
+  handler->typed = &DevicePacket<R, N>::template boundThunk<T>;
+}
+
+template <typename R, uint16_t N>
+template <typename T, typename F>
+void PacketChannel<R, N>::onReceive(String name, F fun)
+{
+  device->handler_channel = id;
+  device->template onReceive<T>(name, std::move(fun));
+  device->handler_channel = 0;
+}
+
+template <typename R, uint16_t N>
+template <typename T, void (*F)(T *)>
+void PacketChannel<R, N>::onReceive(String name)
+{
+  device->handler_channel = id;
+  device->template onReceive<T, F>(name);
+  device->handler_channel = 0;
+}
+
+template <typename R, uint16_t N>
+template <typename T>
+void PacketChannel<R, N>::bind(String name, PacketBound<T> *dest)
+{
+  device->handler_channel = id;
+  device->template bind<T>(name, dest);
+  device->handler_channel = 0;
 }
 
 // Template function
@@ -35,6 +149,9 @@ template <typename T>
 uint16_t DevicePacket<R, N>::getCRC(T *data, uint16_t len, uint16_t initial_crc)
 {
   // CRC-16 (CCITT-FALSE)
+  if (sizeof(T) == 1)
+    return crc16CCITT((const uint8_t *)data, len, initial_crc); // engine selected by PACKET_CRC_ENGINE
+
   uint16_t crc = initial_crc; // initial value (XorOut=0x0000)
   for (uint16_t i = 0; i < len; ++i)
   {
@@ -61,7 +178,7 @@ bool DevicePacket<R, N>::verifyCRC(T *data, uint16_t len)
 
 template <typename R, uint16_t N>
 template <typename T>
-void DevicePacket<R, N>::restRawOut(String properties, T *payload)
+void DevicePacket<R, N>::restRawOut(String properties, T *payload, uint8_t channel, int32_t sequence)
 {
   if (serial_dev == nullptr)
     return;
@@ -73,12 +190,12 @@ void DevicePacket<R, N>::restRawOut(String properties, T *payload)
   uint8_t header[header_size] = {TRANSFER_DATA_BUFFER_SIG, BUFFER_PARAM_RESPNOSE, data_type, pram_len, data_len >> 8, data_len & 0xFF}; // buff_signeture(1 byte)+data_signeture(1 byte)+data_type(1 byte)+pram_len(1 bytes)+data_len(2 bytes)+prams_buff+data_buff
   memcpy(header + TRANSFER_DATA_PARAMS_HEADER_LEN, (uint8_t *)properties.c_str(), pram_len);
   // memcpy(buff + (TRANSFER_DATA_PARAMS_HEADER_LEN + pram_len), (uint8_t *)reinterpret_cast<uint8_t *>(payload), data_len);
-  dataOutToSerial((uint8_t *)reinterpret_cast<uint8_t *>(payload), data_len, header, header_size);
+  dataOutToSerial((uint8_t *)reinterpret_cast<uint8_t *>(payload), data_len, header, header_size, channel, sequence);
 }
 
 template <typename R, uint16_t N>
 template <typename T, bool NSL>
-void DevicePacket<R, N>::restOut(String properties, T payload)
+void DevicePacket<R, N>::restOut(String properties, T payload, uint8_t channel, int32_t sequence)
 {
   if (serial_dev == nullptr)
     return;
@@ -95,24 +212,31 @@ void DevicePacket<R, N>::restOut(String properties, T payload)
       uint8_t header[header_size] = {TRANSFER_DATA_BUFFER_SIG, BUFFER_PARAM_RESPNOSE, data_type, pram_len, data_len >> 8, data_len & 0xFF}; // buff_signeture(1 byte)+data_signeture(1 byte)+data_type(1 byte)+pram_len(1 bytes)+data_len(2 bytes)+prams_buff+data_buff
       memcpy(header + TRANSFER_DATA_PARAMS_HEADER_LEN, (uint8_t *)properties.c_str(), pram_len);
       // memcpy(buff + (TRANSFER_DATA_PARAMS_HEADER_LEN + pram_len), (uint8_t *)payload_str.c_str(), data_len);
-      dataOutToSerial((uint8_t *)payload_str.c_str(), data_len, header, header_size);
+      dataOutToSerial((uint8_t *)payload_str.c_str(), data_len, header, header_size, channel, sequence);
     }
     else
     {
-      restRawOut<T>(properties, &payload);
+      restRawOut<T>(properties, &payload, channel, sequence);
     }
   }
   else
   {
-    String data = "{\"" + properties + (data_type == DATA_TYPE_STRING && NSL == false ? "\":\"" : "\":") + String(payload) + (data_type == DATA_TYPE_STRING && NSL == false ? "\"}" : "}");
-    dataOutToSerial((uint8_t *)data.c_str(), data.length());
+    // {"properties":payload}, formatted in place, no String temporaries
+    bool quoted = data_type == DATA_TYPE_STRING && NSL == false;
+    TextFrame_t frame;
+    textPut(&frame, "{\"", 2);
+    textPut(&frame, properties.c_str(), properties.length());
+    textPut(&frame, quoted ? "\":\"" : "\":", quoted ? 3 : 2);
+    textValue(&frame, payload, 2);
+    textPut(&frame, quoted ? "\"}" : "}", quoted ? 2 : 1);
+    textEnd(&frame);
   }
 }
 
 // Template function
 template <typename R, uint16_t N>
 template <typename T>
-void DevicePacket<R, N>::restArrayOut(String properties, T data[], uint16_t data_size)
+void DevicePacket<R, N>::restArrayOut(String properties, T data[], uint16_t data_size, uint8_t channel, int32_t sequence)
 {
   if (serial_dev == nullptr)
     return;
@@ -125,38 +249,114 @@ void DevicePacket<R, N>::restArrayOut(String properties, T data[], uint16_t data
 
     uint16_t header_size = TRANSFER_DATA_ARRAY_HEADER_LEN + pram_len;
     uint8_t type = getTypeID<T>();
-    uint8_t header[header_size] = {TRANSFER_DATA_BUFFER_SIG, BUFFER_ARRY_RESPNOSE, type, type_size, pram_len, (data_size >> 8) && 0xFF, data_size & 0xFF}; // buff_signeture(1 byte)+data_signeture(1 byte)+type(1 bytes)+type_size(1 bytes)+pram_len(1 bytes)+data_size(1 bytes)+prams_buff+data_buff
+    uint8_t header[header_size] = {TRANSFER_DATA_BUFFER_SIG, BUFFER_ARRY_RESPNOSE, type, type_size, pram_len, (data_size >> 8) & 0xFF, data_size & 0xFF}; // buff_signeture(1 byte)+data_signeture(1 byte)+type(1 bytes)+type_size(1 bytes)+pram_len(1 bytes)+data_size(1 bytes)+prams_buff+data_buff
     memcpy(header + TRANSFER_DATA_ARRAY_HEADER_LEN, (uint8_t *)properties.c_str(), pram_len);
 
+    // delta mode: the difference to the previous frame of this property instead, when the type has a
+    // codec; not for replies, they are answers of their own and not part of the property's stream
+    if (delta_mode && sequence == PACKET_NO_SEQUENCE && arrayDeltaOut(properties, type, type_size, (uint8_t *)data, data_size, channel))
+      return;
+
     // memcpy(buff + (TRANSFER_DATA_ARRAY_HEADER_LEN + pram_len), (uint8_t *)data, data_len);
     //  Serial.printf("Sending array response: %d bytes\r\n", transfer_size);
 
-    dataOutToSerial((uint8_t *)data, data_len, header, header_size);
+    dataOutToSerial((uint8_t *)data, data_len, header, header_size, channel, sequence);
   }
   else
   {
-    bool is_float_type = std::is_same<T, float>::value;
-    String str = "[";
-    for (uint8_t i = 0; i < data_size; i++)
+    // {"properties":[v,v,...]}, floats with 5 decimals; arrays longer than the text chunk are written as they are formatted
+    TextFrame_t frame;
+    textPut(&frame, "{\"", 2);
+    textPut(&frame, properties.c_str(), properties.length());
+    textPut(&frame, "\":[", 3);
+    for (uint16_t i = 0; i < data_size; i++)
     {
       if (i != 0)
-      {
-        str += String(",");
-      }
-
-      if (is_float_type)
-        str += String(data[i], 5);
-      else
-        str += String(data[i]);
-
-      // if (data[i] == nullptr) {
-      //   str += "null";
-      // } else {
-      //   if (is_float_type) str += String(data[i], 5);
-      //   else str += String(data[i]);
-      // }
+        textPut(&frame, ",", 1);
+      textValue(&frame, data[i], std::is_same<T, float>::value ? 5 : 2);
     }
-    str += "]";
-    restOut<String, true>(properties, str); // no string last (active)
+    textPut(&frame, "]}", 2);
+    textEnd(&frame);
+  }
+}
+
+template <typename R, uint16_t N>
+template <typename T>
+void DevicePacket<R, N>::textValue(TextFrame_t *frame, const T &value, uint8_t decimals)
+{
+  if constexpr (std::is_arithmetic<T>::value && !std::is_same<T, char>::value)
+  {
+    // straight into the chunk when there is room for any number
+    if (PACKET_TEXT_CHUNK_LEN - frame->len >= PACKET_FORMAT_NUMBER_LEN)
+    {
+      frame->len += formatNumber(frame->chunk + frame->len, value, decimals);
+    }
+    else
+    {
+      char number[PACKET_FORMAT_NUMBER_LEN];
+      textPut(frame, number, formatNumber(number, value, decimals));
+    }
+  }
+  else if constexpr (std::is_same<T, String>::value)
+  {
+    textPut(frame, value.c_str(), value.length());
+  }
+  else
+  {
+    String text = String(value); // char, const char * and other String convertible types
+    textPut(frame, text.c_str(), text.length());
   }
 }
+
+template <typename R, uint16_t N>
+template <typename T>
+bool DevicePacket<R, N>::publish(String properties, T value, float deadband)
+{
+  static_assert(std::is_arithmetic<T>::value && sizeof(T) <= 8, "publish() takes numbers, use restOut() for other types");
+  if (serial_dev == nullptr)
+    return false;
+
+  double number = (double)value;
+  this->publish_lock();
+  PublishSlot_t<DevicePacket<R, N>> *slot = publish_slots.insert(PUBLISH_SLOT, properties.c_str(), properties.length());
+  if (slot == nullptr)
+  {
+    this->publish_unlock();
+    return false; // table or name pool full
+  }
+
+  slot->out = [](DevicePacket<R, N> *device, const char *name, uint8_t name_len, const uint8_t *bytes)
+  {
+    T payload;
+    memcpy(&payload, bytes, sizeof(T));
+    device->template restOut<T>(String(name, name_len), payload);
+  };
+  memcpy(slot->value, &value, sizeof(T));
+  slot->number = number;
+  slot->deadband = deadband;
+  // back within the deadband of what the receiver has: an unsent value is dropped as well
+  slot->dirty = !(deadband >= 0 && slot->has_sent && fabs(number - slot->sent) <= deadband);
+
+  bool send_now = slot->dirty && !publish_enabled;
+  if (send_now)
+  {
+    slot->dirty = false;
+    slot->sent = number;
+    slot->has_sent = true;
+  }
+  this->publish_unlock();
+
+  if (send_now)
+    restOut<T>(properties, value);
+  return true;
+}
+
+template <typename R, uint16_t N>
+template <typename F>
+void DevicePacket<R, N>::forEachTrace(F fn)
+{
+  // fn(name, name_len, const TraceHistogram_t *) for every traced handler name, processing thread
+  if (trace_histograms)
+    trace_histograms->forEach(TRACE_SLOT, [&](const char *name, uint8_t name_len, TraceHistogram_t *histogram)
+                              { fn(name, name_len, (const TraceHistogram_t *)histogram); });
+}
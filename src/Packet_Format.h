@@ -0,0 +1,100 @@
+/*
+ *  Number to text for the JSON text mode (Packet_Device)
+ *  -----------------------------------------------------
+ *  Formats straight into a caller buffer of PACKET_FORMAT_NUMBER_LEN bytes,
+ *  no String and no heap. The text matches what Arduino's String(value) and
+ *  String(value, decimals) give for the same value:
+ *    integers : decimal, std::to_chars
+ *    bool     : "1" / "0"
+ *    float    : fixed point with `decimals` digits, rounded like printf
+ *               (ties to even); "nan", "inf", "-inf"; more than 9 decimals or values
+ *               too big for 64 bit fixed point fall back to snprintf
+ */
+
+#ifndef __PACKET_FORMAT__
+#define __PACKET_FORMAT__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <charconv>
+#include <type_traits>
+
+#define PACKET_FORMAT_NUMBER_LEN 32 // longest text formatNumber() writes
+
+static inline uint16_t formatUnsigned(char *out, uint64_t value)
+{
+  return (uint16_t)(std::to_chars(out, out + PACKET_FORMAT_NUMBER_LEN, value).ptr - out);
+}
+
+static inline uint16_t formatSigned(char *out, int64_t value)
+{
+  return (uint16_t)(std::to_chars(out, out + PACKET_FORMAT_NUMBER_LEN, value).ptr - out);
+}
+
+static inline uint16_t formatFixed(char *out, double value, uint8_t decimals)
+{
+  static const uint32_t scales[10] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+  if (isnan(value))
+  {
+    memcpy(out, "nan", 3);
+    return 3;
+  }
+  if (isinf(value))
+  {
+    memcpy(out, value < 0 ? "-inf" : "inf", value < 0 ? 4 : 3);
+    return value < 0 ? 4 : 3;
+  }
+
+  double magnitude = fabs(value);
+  if (decimals > 9 || magnitude * scales[decimals] >= 9.0e18)
+  {
+    int len = snprintf(out, PACKET_FORMAT_NUMBER_LEN, magnitude >= 9.0e18 ? "%.*e" : "%.*f", (int)decimals, value);
+    return len < PACKET_FORMAT_NUMBER_LEN ? (uint16_t)len : PACKET_FORMAT_NUMBER_LEN - 1; // cut, never past out
+  }
+
+  // round the exact product like printf does: to nearest, ties to even
+  double product = magnitude * scales[decimals];
+  double residual = fma(magnitude, scales[decimals], -product); // product + residual is exact
+  uint64_t scaled = (uint64_t)product;
+  double fraction = (product - (double)scaled) + residual;
+  if (fraction > 0.5 || (fraction == 0.5 && (scaled & 1)))
+    scaled++;
+  uint16_t len = 0;
+  if (signbit(value))
+    out[len++] = '-'; // "-0.00" like printf
+  len += formatUnsigned(out + len, scaled / scales[decimals]);
+  if (decimals > 0)
+  {
+    out[len++] = '.';
+    uint32_t fraction = (uint32_t)(scaled % scales[decimals]);
+    for (uint8_t i = decimals; i > 0; i--)
+    {
+      out[len + i - 1] = '0' + fraction % 10;
+      fraction /= 10;
+    }
+    len += decimals;
+  }
+  return len;
+}
+
+// T arithmetic and not char (String(char) is the character itself)
+template <typename T>
+static inline uint16_t formatNumber(char *out, T value, uint8_t decimals)
+{
+  if constexpr (std::is_same<T, bool>::value)
+  {
+    out[0] = value ? '1' : '0';
+    return 1;
+  }
+  else if constexpr (std::is_floating_point<T>::value)
+    return formatFixed(out, (double)value, decimals);
+  else if constexpr (std::is_signed<T>::value)
+    return formatSigned(out, (int64_t)value);
+  else
+    return formatUnsigned(out, (uint64_t)value);
+}
+
+#endif
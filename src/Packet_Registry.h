@@ -0,0 +1,133 @@
+/*
+ *  Fixed-capacity handler registry for Packet_Device
+ *  -------------------------------------------------
+ *  Open-addressing hash table keyed by (kind, name). Names are copied once
+ *  into an internal pool when a handler is registered, lookups take a
+ *  non-owning view (pointer + length) straight into the received frame, so
+ *  dispatch needs a single probe sequence and no heap at all.
+ *
+ *  C : number of slots (power of two), keep it about 2x the handler count
+ *  P : bytes reserved for handler names
+ */
+
+#ifndef __PACKET_REGISTRY__
+#define __PACKET_REGISTRY__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define REGISTRY_SLOT_EMPTY 0x00
+#define REGISTRY_SLOT_DELETED 0xFF
+
+template <typename V, uint16_t C, uint16_t P>
+class PacketRegistry
+{
+  static_assert(C > 0 && (C & (C - 1)) == 0, "PacketRegistry capacity must be a power of two");
+
+private:
+  struct entry_t
+  {
+    uint8_t kind = REGISTRY_SLOT_EMPTY; // REGISTRY_SLOT_EMPTY / REGISTRY_SLOT_DELETED or the handler kind
+    uint8_t name_len = 0;
+    uint16_t hash = 0;
+    uint16_t name_offset = 0;
+    V value;
+  };
+
+  entry_t entries[C];
+  char names[P];
+  uint16_t names_used = 0;
+  uint16_t used = 0;
+
+  static uint16_t hashOf(uint8_t kind, const char *name, uint8_t len)
+  {
+    // FNV-1a, folded to 16 bits
+    uint32_t h = 2166136261u ^ kind;
+    h *= 16777619u;
+    for (uint8_t i = 0; i < len; i++)
+    {
+      h ^= (uint8_t)name[i];
+      h *= 16777619u;
+    }
+    return (uint16_t)(h ^ (h >> 16));
+  }
+
+  bool matches(const entry_t *entry, uint8_t kind, uint16_t hash, const char *name, uint8_t len) const
+  {
+    return entry->kind == kind && entry->hash == hash && entry->name_len == len && memcmp(names + entry->name_offset, name, len) == 0;
+  }
+
+public:
+  // handler for (kind, name), nullptr when nothing is registered
+  V *find(uint8_t kind, const char *name, size_t len)
+  {
+    if (len > 0xFF)
+      return nullptr;
+
+    uint16_t hash = hashOf(kind, name, (uint8_t)len);
+    for (uint16_t probe = 0, i = hash & (C - 1); probe < C; probe++, i = (i + 1) & (C - 1))
+    {
+      entry_t *entry = &entries[i];
+      if (entry->kind == REGISTRY_SLOT_EMPTY)
+        return nullptr;
+      if (matches(entry, kind, hash, name, (uint8_t)len))
+        return &entry->value;
+    }
+    return nullptr;
+  }
+
+  // slot for (kind, name), created if needed; nullptr when the table or the name pool is full
+  V *insert(uint8_t kind, const char *name, size_t len)
+  {
+    V *existing = find(kind, name, len);
+    if (existing != nullptr)
+      return existing;
+
+    if (len > 0xFF || used >= C - 1 || names_used + len > P)
+      return nullptr;
+
+    uint16_t hash = hashOf(kind, name, (uint8_t)len);
+    uint16_t i = hash & (C - 1);
+    while (entries[i].kind != REGISTRY_SLOT_EMPTY && entries[i].kind != REGISTRY_SLOT_DELETED)
+      i = (i + 1) & (C - 1);
+
+    entry_t *entry = &entries[i];
+    if (entry->kind == REGISTRY_SLOT_EMPTY)
+      used++; // reused tombstones are already counted
+    entry->kind = kind;
+    entry->hash = hash;
+    entry->name_len = (uint8_t)len;
+    entry->name_offset = names_used;
+    entry->value = V();
+    memcpy(names + names_used, name, len);
+    names_used += len;
+    return &entry->value;
+  }
+
+  // calls fn(name, name_len, value) for every entry of one kind, in table order
+  template <typename F>
+  void forEach(uint8_t kind, F fn)
+  {
+    for (uint16_t i = 0; i < C; i++)
+    {
+      if (entries[i].kind == kind)
+        fn(names + entries[i].name_offset, entries[i].name_len, &entries[i].value);
+    }
+  }
+
+  // drop every handler of one kind (the name pool is not reclaimed, this is a setup-time call)
+  void clear(uint8_t kind)
+  {
+    for (uint16_t i = 0; i < C; i++)
+    {
+      if (entries[i].kind == kind)
+      {
+        entries[i].kind = REGISTRY_SLOT_DELETED;
+        entries[i].value = V();
+      }
+    }
+  }
+};
+
+#endif
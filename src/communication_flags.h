@@ -9,6 +9,20 @@
 #define BUFFER_TEXT_RESPNOSE 0x5E
 #define BUFFER_PARAM_RESPNOSE 0x5F
 #define BUFFER_ARRY_RESPNOSE 0x60
+#define BUFFER_BATCH_RESPNOSE 0x61
+#define BUFFER_DELTA_ARRY_RESPNOSE 0x62
+#define BUFFER_CHANNEL_RESPNOSE 0x63 // channel prefix: sig, 0x63, channel id, then the record of that channel
+#define BUFFER_SEQUENCE_RESPNOSE 0x64 // sequence prefix: sig, 0x64, id msb, id lsb, then the request / reply record
+#define BUFFER_ARQ_DATA_RESPNOSE 0x65 // reliable delivery prefix: sig, 0x65, session, sequence, then the frame as it would be sent without it
+#define BUFFER_ARQ_ACK_RESPNOSE 0x66  // reliable delivery ack: sig, 0x66, session, next expected sequence, 32 bit map of the frames after it (msb first)
+
+// compact frame header: sync0 sync1 varint_length(1-3 bytes, low 7 bits first) check
+#define PACKET_COMPACT_SYNC0 0xA5
+#define PACKET_COMPACT_SYNC1 0x96
+
+// framing capability handshake text commands, "#FR=<caps>" asks and "#FA=<caps>" answers
+#define FRAMING_REQUEST_CMD "#FR"
+#define FRAMING_ACCEPT_CMD "#FA"
 
 #define DATA_TYPE_UINT64_T 1
 #define DATA_TYPE_INT64_T 2
@@ -31,43 +45,39 @@
 
 typedef uint8_t null_type;
 
-template<typename T>
-uint8_t getTypeID() {
-  if (std::is_same<T, uint64_t>::value) {
-    return DATA_TYPE_UINT64_T;
-  } else if (std::is_same<T, int64_t>::value) {
-    return DATA_TYPE_INT64_T;
-  } else if (std::is_same<T, uint32_t>::value) {
-    return DATA_TYPE_UINT32_T;
-  } else if (std::is_same<T, int32_t>::value) {
-    return DATA_TYPE_INT32_T;
-  } else if (std::is_same<T, uint16_t>::value) {
-    return DATA_TYPE_UINT16_T;
-  } else if (std::is_same<T, int16_t>::value) {
-    return DATA_TYPE_INT16_T;
-  } else if (std::is_same<T, uint8_t>::value) {
-    return DATA_TYPE_UINT8_T;
-  } else if (std::is_same<T, int8_t>::value) {
-    return DATA_TYPE_INT8_T;
-  } else if (std::is_same<T, int>::value) {
-    return DATA_TYPE_INT;
-  } else if (std::is_same<T, unsigned int>::value) {
-    return DATA_TYPE_UINT;
-  } else if (std::is_same<T, float>::value) {
-    return DATA_TYPE_FLOAT;
-  } else if (std::is_same<T, double>::value) {
-    return DATA_TYPE_DOUBLE;
-  } else if (std::is_same<T, long>::value) {
-    return DATA_TYPE_LONG;
-  } else if (std::is_same<T, unsigned long>::value) {
-    return DATA_TYPE_ULONG;
-  } else if (std::is_same<T, String>::value) {
-    return DATA_TYPE_STRING;
-  } else if (std::is_same<T, bool>::value) {
-    return DATA_TYPE_BOOL;
-  } else if (std::is_same<T, null_type>::value) {
-    return DATA_TYPE_NULL;
-  } else return DATA_TYPE_VOID;
+#define DATA_TYPE_USER 0x80 // first id free for application structs, see PacketTypeID
+
+// wire type id of T, folded at compile time. Application structs can have their own id:
+//   template <> struct PacketTypeID<LockInInfo> { static constexpr uint8_t value = DATA_TYPE_USER + 1; };
+// Without one a struct is DATA_TYPE_VOID and matched by its size only.
+template <typename T>
+struct PacketTypeID
+{
+  // a chain instead of specializations: int32_t and int (or long) are the same type on some targets
+  static constexpr uint8_t value = std::is_same<T, uint64_t>::value ? DATA_TYPE_UINT64_T
+                                   : std::is_same<T, int64_t>::value ? DATA_TYPE_INT64_T
+                                   : std::is_same<T, uint32_t>::value ? DATA_TYPE_UINT32_T
+                                   : std::is_same<T, int32_t>::value ? DATA_TYPE_INT32_T
+                                   : std::is_same<T, uint16_t>::value ? DATA_TYPE_UINT16_T
+                                   : std::is_same<T, int16_t>::value ? DATA_TYPE_INT16_T
+                                   : std::is_same<T, uint8_t>::value ? DATA_TYPE_UINT8_T
+                                   : std::is_same<T, int8_t>::value ? DATA_TYPE_INT8_T
+                                   : std::is_same<T, int>::value ? DATA_TYPE_INT
+                                   : std::is_same<T, unsigned int>::value ? DATA_TYPE_UINT
+                                   : std::is_same<T, float>::value ? DATA_TYPE_FLOAT
+                                   : std::is_same<T, double>::value ? DATA_TYPE_DOUBLE
+                                   : std::is_same<T, long>::value ? DATA_TYPE_LONG
+                                   : std::is_same<T, unsigned long>::value ? DATA_TYPE_ULONG
+                                   : std::is_same<T, String>::value ? DATA_TYPE_STRING
+                                   : std::is_same<T, bool>::value ? DATA_TYPE_BOOL
+                                   : std::is_same<T, null_type>::value ? DATA_TYPE_NULL
+                                                                       : DATA_TYPE_VOID;
+};
+
+template <typename T>
+constexpr uint8_t getTypeID()
+{
+  return PacketTypeID<T>::value;
 }
 
 #endif